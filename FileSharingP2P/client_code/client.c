@@ -10,19 +10,28 @@
 #include "client_cs_protocol.h"
 #include "client_p2p_protocol.h"
 
+#define CATALOG_PAGE_SIZE 100  // số file mỗi trang khi xem danh sách
+
 // Biến trạng thái mới
 int logged_in = 0; 
 
+// Server trả next_cursor toàn 0 ở trang cuối
+static int has_next_page(ResultCursor cursor) {
+    return cursor.key != 0 || cursor.id != 0;
+}
+
 // Hàm hiển thị menu
 void display_menu() {
     printf("\n=== MENU ===\n");
     if (logged_in) {
         printf("Người dùng: %s\n", current_username);
         printf("1. Xem danh sách file chia sẻ\n");
-        printf("2. Tìm kiếm file\n");
-        printf("3. Công bố file\n");
-        printf("4. Hủy công bố file\n");
-        printf("5. Thoát/Đăng xuất\n");
+        printf("2. Xem file được tải nhiều nhất\n");
+        printf("3. Tìm kiếm file\n");
+        printf("4. Công bố file\n");
+        printf("5. Hủy công bố file\n");
+        printf("6. Theo dõi file mới theo từ khóa\n");
+        printf("7. Thoát/Đăng xuất\n");
     } else {
         printf("1. Đăng ký\n");
         printf("2. Đăng nhập\n");
@@ -130,29 +139,74 @@ int main() {
         } else {
             // --- XỬ LÝ KHI ĐÃ ĐĂNG NHẬP
             switch (choice) {
-                case 1: {   
+                case 1: {
                     printf("\n=== DANH SÁCH FILE ĐANG ĐƯỢC CHIA SẺ ===\n");
 
-                    BrowseFilesResponse resp = browse_files();
-
-                    if (resp.count == 0) {
+                    // Chỉ tải những gì đổi từ lần xem trước
+                    if (!sync_catalog()) {
+                        printf("Không cập nhật được danh sách từ server.\n");
+                    }
+                    int count;
+                    const SearchFileInfo* list = local_catalog(&count);
+                    if (count == 0) {
                         printf("Hiện chưa có file nào được chia sẻ.\n");
                         break;
                     }
 
-                    for (int i = 0; i < resp.count; i++) {
-                        printf("%d. %s (%ld bytes)\n",
-                            i + 1,
-                            resp.files[i].filename,
-                            resp.files[i].file_size);
-                        printf("   Hash: %.16s...\n", resp.files[i].filehash);
+                    int start = 0;
+                    int sel;
+                    do {
+                        int end = start + CATALOG_PAGE_SIZE < count ? start + CATALOG_PAGE_SIZE : count;
+                        for (int i = start; i < end; i++) {
+                            printf("%d. %s (%ld bytes)\n", i + 1, list[i].filename, list[i].file_size);
+                            printf("   Hash: %.16s...\n", list[i].filehash);
+                        }
+
+                        sel = 0;
+                        printf(end < count ? "\nChọn file để tải (0 = hủy, -1 = trang sau): "
+                                           : "\nChọn file để tải (0 = hủy): ");
+                        scanf("%d", &sel);
+                        start = end;
+                    } while (sel == -1 && start < count);
+
+                    if (sel > 0 && sel <= count) {
+                        SearchFileInfo file = list[sel - 1];
+                        download_file_chunked(file.filehash, file.filename, file.file_size, file.chunk_size);
                     }
+                    break;
+                }
+                case 2: {
+                    printf("\n=== FILE ĐƯỢC TẢI NHIỀU NHẤT ===\n");
 
+                    ResultCursor cursor = {0, 0};
+                    BrowseFilesResponse resp;
                     int sel;
-                    printf("\nChọn file để tải (0 = hủy): ");
-                    scanf("%d", &sel);
+                    do {
+                        resp = browse_files(BROWSE_POPULAR, 0, cursor);
+
+                        if (resp.count == 0) {
+                            printf("Chưa có file nào được tải gần đây.\n");
+                            break;
+                        }
 
-                    if (sel > 0 && sel <= resp.count) {
+                        for (int i = 0; i < resp.count; i++) {
+                            printf("%d. %s (%ld bytes)\n",
+                                i + 1,
+                                resp.files[i].filename,
+                                resp.files[i].file_size);
+                            printf("   Hash: %.16s...\n", resp.files[i].filehash);
+                            printf("   Lượt tải gần đây: %.1f, thành công %.0f%%\n",
+                                   resp.files[i].popularity, resp.files[i].success_rate * 100.0f);
+                        }
+
+                        sel = 0;
+                        printf(has_next_page(resp.next_cursor) ? "\nChọn file để tải (0 = hủy, -1 = trang sau): "
+                                                               : "\nChọn file để tải (0 = hủy): ");
+                        scanf("%d", &sel);
+                        cursor = resp.next_cursor;
+                    } while (sel == -1 && has_next_page(cursor));
+
+                    if (resp.count > 0 && sel > 0 && sel <= resp.count) {
                         sel--;
                         download_file_chunked(
                             resp.files[sel].filehash,
@@ -163,29 +217,35 @@ int main() {
                     }
                     break;
                 }
-                case 2: { 
+                case 3: { 
                     printf("Từ khóa tìm kiếm: ");
                     scanf("%s", keyword);
-                    SearchResponse resp = search_file(keyword);
-                    
-                    if (resp.count == 0) {
-                        printf("Không tìm thấy file nào khớp với từ khóa!\n");
-                        break;
-                    }
-                    
-                    printf("\n=== %d file được tìm thấy. Chọn file để tải ===\n", resp.count);
-                    for (int i = 0; i < resp.count; i++) {
-                        printf("%d. %s (%ld bytes)\n", i + 1,
-                               resp.files[i].filename,
-                               resp.files[i].file_size);
-                        printf("   Hash: %.16s...\n", resp.files[i].filehash);
-                    }
-                    
+                    ResultCursor cursor = {0, 0};
+                    SearchResponse resp;
                     int sel;
-                    printf("Chọn (0=hủy): ");
-                    scanf("%d", &sel);
+                    do {
+                        resp = search_file(keyword, cursor);
+                        
+                        if (resp.count == 0) {
+                            printf("Không tìm thấy file nào khớp với từ khóa!\n");
+                            break;
+                        }
+                        
+                        printf("\n=== %d file được tìm thấy. Chọn file để tải ===\n", resp.count);
+                        for (int i = 0; i < resp.count; i++) {
+                            printf("%d. %s (%ld bytes)\n", i + 1,
+                                   resp.files[i].filename,
+                                   resp.files[i].file_size);
+                            printf("   Hash: %.16s...\n", resp.files[i].filehash);
+                        }
+                        
+                        sel = 0;
+                        printf(has_next_page(resp.next_cursor) ? "Chọn (0=hủy, -1=trang sau): " : "Chọn (0=hủy): ");
+                        scanf("%d", &sel);
+                        cursor = resp.next_cursor;
+                    } while (sel == -1 && has_next_page(cursor));
                     
-                    if (sel > 0 && sel <= resp.count) {
+                    if (resp.count > 0 && sel > 0 && sel <= resp.count) {
                         sel--;
                         download_file_chunked(resp.files[sel].filehash,
                                             resp.files[sel].filename,
@@ -195,19 +255,29 @@ int main() {
                     break;
                 }
                     
-                case 3: 
+                case 4: 
                     printf("Tên file (trong %s): ", shared_dir);
                     scanf("%s", filename);
                     publish_file(filename);
                     break;
                     
-                case 4: 
+                case 5: 
                     printf("Tên file: ");
                     scanf("%s", filename);
                     unpublish_file(filename);
                     break;
                     
-                case 5: 
+                case 6:
+                    printf("Từ khóa theo dõi: ");
+                    scanf("%s", keyword);
+                    if (subscribe(WATCH_KEYWORD, keyword, 0)) {
+                        printf("Sẽ thông báo khi có file mới chứa \"%s\".\n", keyword);
+                    } else {
+                        printf("Không đăng ký theo dõi được!\n");
+                    }
+                    break;
+                    
+                case 7: 
                     logout_user();
                     logged_in = 0; // Đặt trạng thái về chưa đăng nhập
                     printf("Đã đăng xuất!\n");
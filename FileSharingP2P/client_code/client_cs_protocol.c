@@ -1,13 +1,59 @@
+#define _GNU_SOURCE
 #include "client_cs_protocol.h"
 #include "client_utils.h"
+#include "../wire.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <errno.h>
 
+#define PENDING_BUCKETS 256  // calls waiting for a response, hashed by request_id
+#define MAX_REQUEST_FRAME 2048  // every request struct is under 1 KB
+
+// Largest thing the server can send back
+typedef union {
+    RegisterResponse reg;
+    LoginResponse login;
+    SearchResponse search;
+    BrowseFilesResponse browse;
+    BrowseChangesResponse changes;
+    FindResponse find;
+    PublishResponse publish;
+    UnpublishResponse unpublish;
+    LogoutResponse logout;
+    DownloadStatusResponse status;
+    HeartbeatResponse heartbeat;
+    SubscribeResponse subscribe;
+    NotifyMessage notify;
+} AnyResponse;
+
+// Requests go out from any thread; a single receiver thread reads every
+// response and hands it to the call with the same request_id.
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+static CsCall* pending[PENDING_BUCKETS];
+static int server_alive = 0;
+static int wire_version = WIRE_LEGACY;  // agreed with HELLO when connecting
+
+// Bản sao danh sách file của server, mới công bố trước
+static SearchFileInfo* catalog_files = NULL;
+static int catalog_count = 0;
+static int catalog_cap = 0;
+static uint64_t catalog_seen = 0;  // catalog_version mà bản sao đang phản ánh
+
+// Trong lúc đăng nhập, một luồng gửi HEARTBEAT định kỳ để server tiếp tục
+// đưa peer này vào kết quả FIND
+static pthread_mutex_t heartbeat_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t heartbeat_cond = PTHREAD_COND_INITIALIZER;
+static int heartbeat_running = 0;
+static pthread_t heartbeat_thread;
+
 // Helper function to receive full struct
 static int recv_full(int sock, void* buffer, size_t size) {
     char* buf = (char*)buffer;
@@ -23,28 +69,373 @@ static int recv_full(int sock, void* buffer, size_t size) {
     return total;
 }
 
-// Kết nối đến server
-int connect_to_server(const char* server_ip) {
+static int send_full(int sock, const void* buffer, size_t size) {
+    const char* buf = (const char*)buffer;
+    size_t total = 0;
+    
+    while (total < size) {
+        ssize_t bytes = send(sock, buf + total, size - total, MSG_NOSIGNAL);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        total += bytes;
+    }
+    return 0;
+}
+
+// Caller holds pending_lock
+static void pending_add(CsCall* call) {
+    CsCall** bucket = &pending[call->request_id % PENDING_BUCKETS];
+    call->next = *bucket;
+    *bucket = call;
+}
+
+// Caller holds pending_lock
+static CsCall* pending_remove(uint32_t request_id) {
+    CsCall** link = &pending[request_id % PENDING_BUCKETS];
+    while (*link) {
+        CsCall* call = *link;
+        if (call->request_id == request_id) {
+            *link = call->next;
+            call->next = NULL;
+            return call;
+        }
+        link = &call->next;
+    }
+    return NULL;
+}
+
+// Read one WIRE_V2 frame and decode it into resp. Returns the response
+// size, 0 when the connection is gone or the frame is malformed.
+static size_t recv_frame(int sock, unsigned char* body, AnyResponse* resp) {
+    unsigned char prefix[WIRE_MAX_PREFIX];
+    size_t body_len = 0;
+    int prefix_len = 0;
+    for (size_t got = 0; prefix_len == 0; got++) {
+        if (got == sizeof(prefix) || recv_full(sock, prefix + got, 1) <= 0) {
+            return 0;
+        }
+        prefix_len = wire_frame_prefix(prefix, got + 1, &body_len);
+        if (prefix_len < 0) {
+            printf("[ERROR] Invalid frame from server\n");
+            return 0;
+        }
+    }
+    if (recv_full(sock, body, body_len) <= 0) {
+        return 0;
+    }
+
+    size_t size = wire_decode(body, body_len, 1, resp, sizeof(AnyResponse));
+    if (size == 0) {
+        printf("[ERROR] Malformed frame from server\n");
+    }
+    return size;
+}
+
+// Thông báo server tự gửi cho các đăng ký theo dõi (xem subscribe)
+static void show_notification(const NotifyMessage* msg) {
+    if (msg->event == NOTIFY_PUBLISHED) {
+        printf("\n[THÔNG BÁO] File mới: %s (%ld bytes), hash %.16s...\n",
+               msg->file.filename, msg->file.file_size, msg->file.filehash);
+    } else if (msg->seeders == 0) {
+        printf("\n[THÔNG BÁO] %s (hash %.16s...) không còn ai chia sẻ\n",
+               msg->file.filename, msg->file.filehash);
+    } else {
+        printf("\n[THÔNG BÁO] %s (hash %.16s...) hiện có %d peer chia sẻ\n",
+               msg->file.filename, msg->file.filehash, msg->seeders);
+    }
+    fflush(stdout);
+}
+
+static void* response_receiver(void* arg) {
+    int sock = (int)(intptr_t)arg;
+    AnyResponse* resp = (AnyResponse*)malloc(sizeof(AnyResponse));
+    unsigned char* frame = wire_version == WIRE_V2 ? (unsigned char*)malloc(WIRE_MAX_FRAME) : NULL;
+    char* buf = (char*)resp;
+    if (wire_version == WIRE_V2 && !frame) {
+        free(resp);
+        resp = NULL;
+    }
+    
+    while (resp) {
+        const MessageHeader* header = (const MessageHeader*)buf;
+        size_t size;
+        if (frame) {
+            if ((size = recv_frame(sock, frame, resp)) == 0) {
+                break;
+            }
+        } else {
+            if (recv_full(sock, buf, sizeof(MessageHeader)) <= 0) {
+                break;
+            }
+            
+            size = response_size_for_command(header->command);
+            if (size == 0) {
+                printf("[ERROR] Unknown response from server (command: %d)\n", header->command);
+                break;
+            }
+            if (recv_full(sock, buf + sizeof(MessageHeader), size - sizeof(MessageHeader)) <= 0) {
+                break;
+            }
+        }
+        
+        if (header->command == CMD_NOTIFY) {
+            show_notification(&resp->notify);
+            continue;
+        }
+        
+        pthread_mutex_lock(&pending_lock);
+        CsCall* call = pending_remove(header->request_id);
+        if (call) {
+            memcpy(call->resp, buf, size < call->resp_size ? size : call->resp_size);
+            call->state = CS_CALL_DONE;
+            pthread_cond_broadcast(&pending_cond);
+        }
+        pthread_mutex_unlock(&pending_lock);
+        
+        if (!call) {
+            printf("[DEBUG] Dropped response for unknown request_id %u\n", header->request_id);
+        }
+    }
+    
+    // Server gone: fail everything still waiting
+    pthread_mutex_lock(&pending_lock);
+    server_alive = 0;
+    for (int i = 0; i < PENDING_BUCKETS; i++) {
+        for (CsCall* call = pending[i]; call; call = call->next) {
+            call->state = CS_CALL_FAILED;
+        }
+        pending[i] = NULL;
+    }
+    pthread_cond_broadcast(&pending_cond);
+    pthread_mutex_unlock(&pending_lock);
+    
+    free(frame);
+    free(resp);
+    return NULL;
+}
+
+static int open_connection(const char* server_ip) {
     struct sockaddr_in server_addr;
     
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
         perror("Socket creation failed");
-        return 0;
+        return -1;
     }
     
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(SERVER_PORT);
     inet_pton(AF_INET, server_ip, &server_addr.sin_addr);
     
-    if (connect(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Connection failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Hỏi server dùng framing mới nhất mà hai bên cùng hiểu. Chạy trước khi
+// có luồng nhận nên đọc phản hồi trực tiếp. Trả về 0 nếu server không
+// trả lời được HELLO (server cũ đóng kết nối khi gặp lệnh lạ).
+static int negotiate_wire(int sock) {
+    HelloRequest req;
+    memset(&req, 0, sizeof(req));
+    req.header.command = CMD_HELLO;
+    req.header.request_id = generate_request_id();
+    req.max_version = WIRE_VERSION_MAX;
+    
+    HelloResponse resp;
+    if (send_full(sock, &req, sizeof(req)) < 0 ||
+        recv_full(sock, &resp, sizeof(resp)) <= 0 ||
+        resp.header.command != CMD_HELLO || resp.status != RESP_SUCCESS) {
         return 0;
     }
     
+    wire_version = resp.version == WIRE_V2 ? WIRE_V2 : WIRE_LEGACY;
+    printf("[DEBUG] Wire framing: v%d\n", wire_version);
     return 1;
 }
 
+// Kết nối đến server
+int connect_to_server(const char* server_ip) {
+    server_sock = open_connection(server_ip);
+    if (server_sock < 0) {
+        return 0;
+    }
+    
+    if (!negotiate_wire(server_sock)) {
+        // Server cũ: kết nối lại và giữ nguyên struct cố định
+        close(server_sock);
+        wire_version = WIRE_LEGACY;
+        server_sock = open_connection(server_ip);
+        if (server_sock < 0) {
+            return 0;
+        }
+    }
+    
+    server_alive = 1;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, response_receiver, (void*)(intptr_t)server_sock) != 0) {
+        perror("Could not create response receiver");
+        return 0;
+    }
+    pthread_detach(tid);
+    
+    return 1;
+}
+
+int cs_call_start(CsCall* call, const void* req, size_t req_size, void* resp, size_t resp_size) {
+    call->request_id = ((const MessageHeader*)req)->request_id;
+    call->resp = resp;
+    call->resp_size = resp_size;
+    call->state = CS_CALL_PENDING;
+    call->next = NULL;
+    
+    // Registered before sending so the receiver can never miss the reply
+    pthread_mutex_lock(&pending_lock);
+    if (!server_alive) {
+        call->state = CS_CALL_FAILED;
+        pthread_mutex_unlock(&pending_lock);
+        printf("[ERROR] Not connected to server\n");
+        return 0;
+    }
+    pending_add(call);
+    pthread_mutex_unlock(&pending_lock);
+    
+    unsigned char frame[MAX_REQUEST_FRAME];
+    if (wire_version == WIRE_V2) {
+        req_size = wire_encode(req, req_size, 0, frame, sizeof(frame));
+        req = frame;
+    }
+    
+    pthread_mutex_lock(&send_lock);
+    int sent = req_size > 0 ? send_full(server_sock, req, req_size) : -1;
+    pthread_mutex_unlock(&send_lock);
+    
+    if (sent < 0) {
+        perror("Send request failed");
+        pthread_mutex_lock(&pending_lock);
+        if (pending_remove(call->request_id)) {
+            call->state = CS_CALL_FAILED;
+        }
+        pthread_mutex_unlock(&pending_lock);
+        return 0;
+    }
+    return 1;
+}
+
+int cs_call_wait(CsCall* call) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += CS_CALL_TIMEOUT;
+    
+    pthread_mutex_lock(&pending_lock);
+    while (call->state == CS_CALL_PENDING) {
+        if (pthread_cond_timedwait(&pending_cond, &pending_lock, &deadline) == ETIMEDOUT) {
+            if (call->state == CS_CALL_PENDING) {
+                // A late reply is dropped by the receiver
+                pending_remove(call->request_id);
+                call->state = CS_CALL_FAILED;
+                printf("[ERROR] Request %u timed out\n", call->request_id);
+            }
+        }
+    }
+    int done = (call->state == CS_CALL_DONE);
+    pthread_mutex_unlock(&pending_lock);
+    return done;
+}
+
+// Send one request and block for its response
+static int cs_call(const void* req, size_t req_size, void* resp, size_t resp_size) {
+    CsCall call;
+    if (!cs_call_start(&call, req, req_size, resp, resp_size)) {
+        return 0;
+    }
+    return cs_call_wait(&call);
+}
+
+// Gửi một HEARTBEAT; trả về số giây lease server cấp, 0 nếu thất bại
+static int send_heartbeat(void) {
+    HeartbeatRequest req;
+    HeartbeatResponse resp;
+    
+    memset(&req, 0, sizeof(HeartbeatRequest));
+    
+    req.header.command = CMD_HEARTBEAT;
+    req.header.request_id = generate_request_id();
+    strcpy(req.email, current_email);
+    strcpy(req.access_token, current_token);
+    req.port = p2p_listening_port;
+    req.active_uploads = __atomic_load_n(&active_uploads, __ATOMIC_RELAXED);
+    
+    if (!cs_call(&req, sizeof(HeartbeatRequest), &resp, sizeof(HeartbeatResponse))) {
+        printf("[ERROR] HEARTBEAT request failed\n");
+        return 0;
+    }
+    if (resp.status != RESP_SUCCESS) {
+        printf("[ERROR] HEARTBEAT rejected (status: %d)\n", resp.status);
+        return 0;
+    }
+    return resp.lease_seconds;
+}
+
+static void* heartbeat_loop(void* arg) {
+    (void)arg;
+    int interval = HEARTBEAT_INTERVAL;
+    
+    pthread_mutex_lock(&heartbeat_lock);
+    while (heartbeat_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval;
+        
+        int rc = 0;
+        while (heartbeat_running && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&heartbeat_cond, &heartbeat_lock, &deadline);
+        }
+        if (!heartbeat_running) break;
+        
+        pthread_mutex_unlock(&heartbeat_lock);
+        int lease = send_heartbeat();
+        pthread_mutex_lock(&heartbeat_lock);
+        
+        // Gửi ba lần trong một lease để một lần mất gói không làm rớt peer
+        if (lease >= 3) {
+            interval = lease / 3;
+        }
+    }
+    pthread_mutex_unlock(&heartbeat_lock);
+    return NULL;
+}
+
+static void start_heartbeat(void) {
+    pthread_mutex_lock(&heartbeat_lock);
+    if (!heartbeat_running) {
+        heartbeat_running = 1;
+        if (pthread_create(&heartbeat_thread, NULL, heartbeat_loop, NULL) != 0) {
+            perror("Could not create heartbeat thread");
+            heartbeat_running = 0;
+        }
+    }
+    pthread_mutex_unlock(&heartbeat_lock);
+}
+
+// Dừng và chờ luồng HEARTBEAT, để nó không dùng token sau khi đăng xuất
+static void stop_heartbeat(void) {
+    pthread_mutex_lock(&heartbeat_lock);
+    int running = heartbeat_running;
+    heartbeat_running = 0;
+    pthread_cond_signal(&heartbeat_cond);
+    pthread_mutex_unlock(&heartbeat_lock);
+    
+    if (running) {
+        pthread_join(heartbeat_thread, NULL);
+    }
+}
+
 // Đăng ký với email
 int register_user(const char* email, const char* username, const char* password) {
     RegisterRequest req;
@@ -61,13 +452,8 @@ int register_user(const char* email, const char* username, const char* password)
     printf("[DEBUG] Sending REGISTER request (request_id: %u)\n", req.header.request_id);
     printf("        Email: %s, Username: %s\n", email, username);
     
-    if (send(server_sock, &req, sizeof(RegisterRequest), 0) < 0) {
-        perror("Send register request failed");
-        return 0;
-    }
-    
-    if (recv_full(server_sock, &resp, sizeof(RegisterResponse)) <= 0) {
-        perror("Receive register response failed");
+    if (!cs_call(&req, sizeof(RegisterRequest), &resp, sizeof(RegisterResponse))) {
+        printf("[ERROR] REGISTER request failed\n");
         return 0;
     }
     
@@ -92,13 +478,8 @@ int login_user(const char* email, const char* password) {
     printf("[DEBUG] Sending LOGIN request (request_id: %u)\n", req.header.request_id);
     printf("        Email: %s, P2P Port: %d\n", email, p2p_listening_port);
     
-    if (send(server_sock, &req, sizeof(LoginRequest), 0) < 0) {
-        perror("Send login request failed");
-        return 0;
-    }
-    
-    if (recv_full(server_sock, &resp, sizeof(LoginResponse)) <= 0) {
-        perror("Receive login response failed");
+    if (!cs_call(&req, sizeof(LoginRequest), &resp, sizeof(LoginResponse))) {
+        printf("[ERROR] LOGIN request failed\n");
         return 0;
     }
     
@@ -109,6 +490,7 @@ int login_user(const char* email, const char* password) {
         strcpy(current_username, resp.username);
         strcpy(current_token, resp.access_token);
         printf("[DEBUG] Login successful. Username: %s\n", current_username);
+        start_heartbeat();
         return 1;
     } else if (resp.status == RESP_ALREADY_LOGGED_IN) {
         printf("[ERROR] Tài khoản này đã đăng nhập từ vị trí khác!\n");
@@ -119,7 +501,7 @@ int login_user(const char* email, const char* password) {
     return 0;
 }
 
-BrowseFilesResponse browse_files(void) {
+BrowseFilesResponse browse_files(int order, int limit, ResultCursor cursor) {
     BrowseFilesRequest req;
     BrowseFilesResponse resp;
 
@@ -130,17 +512,16 @@ BrowseFilesResponse browse_files(void) {
     req.header.request_id = generate_request_id();
     strcpy(req.email, current_email);
     strcpy(req.access_token, current_token);
+    req.order = order;
+    req.limit = limit;
+    req.cursor = cursor;
 
     printf("[DEBUG] Sending BROWSE request (request_id: %u)\n",
            req.header.request_id);
 
-    if (send(server_sock, &req, sizeof(req), 0) < 0) {
-        perror("Send browse request failed");
-        return resp;
-    }
-
-    if (recv_full(server_sock, &resp, sizeof(resp)) <= 0) {
-        perror("Receive browse response failed");
+    if (!cs_call(&req, sizeof(req), &resp, sizeof(resp))) {
+        printf("[ERROR] BROWSE request failed\n");
+        resp.count = 0;
         return resp;
     }
 
@@ -157,8 +538,125 @@ BrowseFilesResponse browse_files(void) {
     return resp;
 }
 
+BrowseChangesResponse browse_changes(uint64_t since, int limit) {
+    BrowseChangesRequest req;
+    BrowseChangesResponse resp;
+
+    memset(&req, 0, sizeof(req));
+    memset(&resp, 0, sizeof(resp));
+
+    req.header.command = CMD_BROWSE_CHANGES;
+    req.header.request_id = generate_request_id();
+    strcpy(req.email, current_email);
+    strcpy(req.access_token, current_token);
+    req.since = since;
+    req.limit = limit;
+
+    printf("[DEBUG] Sending BROWSE_CHANGES request (request_id: %u, since: %llu)\n",
+           req.header.request_id, (unsigned long long)since);
+
+    if (!cs_call(&req, sizeof(req), &resp, sizeof(resp))) {
+        printf("[ERROR] BROWSE_CHANGES request failed\n");
+        resp.status = RESP_FAIL;
+        resp.count = 0;
+        return resp;
+    }
+
+    printf("[DEBUG] %s: %d change(s)\n", resp.full ? "Full listing" : "Catalog changes", resp.count);
+    return resp;
+}
+
+static void catalog_remove(const char* filehash) {
+    for (int i = 0; i < catalog_count; i++) {
+        if (strcmp(catalog_files[i].filehash, filehash) == 0) {
+            memmove(&catalog_files[i], &catalog_files[i + 1],
+                    (catalog_count - i - 1) * sizeof(SearchFileInfo));
+            catalog_count--;
+            return;
+        }
+    }
+}
+
+// Thêm file vào đầu (at_front) hoặc cuối bản sao
+static int catalog_insert(const SearchFileInfo* file, int at_front) {
+    if (catalog_count == catalog_cap) {
+        int cap = catalog_cap ? catalog_cap * 2 : 128;
+        SearchFileInfo* grown = (SearchFileInfo*)realloc(catalog_files, cap * sizeof(SearchFileInfo));
+        if (!grown) {
+            perror("Không đủ bộ nhớ cho danh sách file");
+            return 0;
+        }
+        catalog_files = grown;
+        catalog_cap = cap;
+    }
+    if (at_front) {
+        memmove(&catalog_files[1], &catalog_files[0], catalog_count * sizeof(SearchFileInfo));
+        catalog_files[0] = *file;
+    } else {
+        catalog_files[catalog_count] = *file;
+    }
+    catalog_count++;
+    return 1;
+}
+
+// Tải lại toàn bộ: trang đầu có sẵn trong resp, các trang sau qua BROWSE
+static int catalog_reload(const BrowseChangesResponse* resp) {
+    catalog_count = 0;
+    for (int i = 0; i < resp->count; i++) {
+        if (!catalog_insert(&resp->changes[i].file, 0)) return 0;
+    }
+
+    ResultCursor cursor = resp->next_cursor;
+    while (cursor.key != 0 || cursor.id != 0) {
+        BrowseFilesResponse page = browse_files(BROWSE_RECENT, 0, cursor);
+        if (page.status != RESP_SUCCESS) {
+            return page.status == RESP_NOT_FOUND;  // các file còn lại vừa bị gỡ
+        }
+        for (int i = 0; i < page.count; i++) {
+            if (!catalog_insert(&page.files[i], 0)) return 0;
+        }
+        cursor = page.next_cursor;
+    }
+    return 1;
+}
+
+int sync_catalog(void) {
+    BrowseChangesResponse resp;
+    do {
+        resp = browse_changes(catalog_seen, 0);
+        if (resp.status != RESP_SUCCESS) {
+            return 0;
+        }
+
+        if (resp.full) {
+            if (!catalog_reload(&resp)) {
+                catalog_seen = 0;  // bản sao dở dang, lần sau tải lại
+                return 0;
+            }
+        } else {
+            // Áp dụng theo thứ tự; file được thêm hay thay đều là mới nhất
+            for (int i = 0; i < resp.count; i++) {
+                const CatalogChange* change = &resp.changes[i];
+                catalog_remove(change->file.filehash);
+                if (!change->removed && !catalog_insert(&change->file, 1)) {
+                    catalog_seen = 0;
+                    return 0;
+                }
+            }
+        }
+        catalog_seen = resp.catalog_version;
+    } while (resp.more);
+
+    return 1;
+}
+
+const SearchFileInfo* local_catalog(int* count) {
+    *count = catalog_count;
+    return catalog_files;
+}
+
 // Tìm kiếm file
-SearchResponse search_file(const char* keyword) {
+SearchResponse search_file(const char* keyword, ResultCursor cursor) {
     SearchRequest req;
     SearchResponse resp;
     
@@ -170,22 +668,13 @@ SearchResponse search_file(const char* keyword) {
     strcpy(req.email, current_email);
     strcpy(req.access_token, current_token);
     strcpy(req.keyword, keyword);
+    req.cursor = cursor;
     
     printf("[DEBUG] Sending SEARCH request (request_id: %u)\n", req.header.request_id);
     printf("        Keyword: %s\n", keyword);
     
-    if (send(server_sock, &req, sizeof(SearchRequest), 0) < 0) {
-        perror("Send search request failed");
-        resp.count = 0;
-        return resp;
-    }
-    
-    // Set receive timeout
-    struct timeval tv = {10, 0}; // 10 seconds timeout
-    setsockopt(server_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    
-    if (recv_full(server_sock, &resp, sizeof(SearchResponse)) <= 0) {
-        perror("Receive search response failed");
+    if (!cs_call(&req, sizeof(SearchRequest), &resp, sizeof(SearchResponse))) {
+        printf("[ERROR] SEARCH request failed\n");
         resp.count = 0;
         return resp;
     }
@@ -202,13 +691,12 @@ SearchResponse search_file(const char* keyword) {
     return resp;
 }
 
-// Tìm peers có file hash cụ thể
-FindResponse find_peers_for_file(const char* filehash) {
+// Gửi FIND mà không chờ; resp được điền khi phản hồi về
+int find_peers_async(CsCall* call, const char* filehash, FindResponse* resp) {
     FindRequest req;
-    FindResponse resp;
     
     memset(&req, 0, sizeof(FindRequest));
-    memset(&resp, 0, sizeof(FindResponse));
+    memset(resp, 0, sizeof(FindResponse));
     
     req.header.command = CMD_FIND;
     req.header.request_id = generate_request_id();
@@ -219,18 +707,16 @@ FindResponse find_peers_for_file(const char* filehash) {
     printf("[DEBUG] Sending FIND request (request_id: %u)\n", req.header.request_id);
     printf("        Filehash: %.16s...\n", filehash);
     
-    if (send(server_sock, &req, sizeof(FindRequest), 0) < 0) {
-        perror("Send find request failed");
-        resp.count = 0;
-        return resp;
-    }
-    
-    // Set receive timeout
-    struct timeval tv = {10, 0}; // 10 seconds timeout
-    setsockopt(server_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return cs_call_start(call, &req, sizeof(FindRequest), resp, sizeof(FindResponse));
+}
+
+// Tìm peers có file hash cụ thể
+FindResponse find_peers_for_file(const char* filehash) {
+    FindResponse resp;
+    CsCall call;
     
-    if (recv_full(server_sock, &resp, sizeof(FindResponse)) <= 0) {
-        perror("Receive find response failed");
+    if (!find_peers_async(&call, filehash, &resp) || !cs_call_wait(&call)) {
+        printf("[ERROR] FIND request failed\n");
         resp.count = 0;
         return resp;
     }
@@ -246,10 +732,36 @@ FindResponse find_peers_for_file(const char* filehash) {
     return resp;
 }
 
-// Công bố file với hash và chunk_size
-void publish_file(const char* filename) {
+// Tìm peers cho nhiều hash trong một lượt: mọi request cùng bay,
+// out[i] ứng với filehashes[i]. Trả về số hash nhận được phản hồi.
+int find_peers_batch(const char* filehashes[], int count, FindResponse* out) {
+    CsCall* calls = (CsCall*)calloc(count, sizeof(CsCall));
+    if (!calls) return 0;
+    
+    int started = 0;
+    for (; started < count; started++) {
+        if (!find_peers_async(&calls[started], filehashes[started], &out[started])) {
+            break;
+        }
+    }
+    
+    int answered = 0;
+    for (int i = 0; i < count; i++) {
+        if (i < started && cs_call_wait(&calls[i])) {
+            answered++;
+        } else {
+            out[i].count = 0;
+        }
+    }
+    
+    free(calls);
+    printf("[DEBUG] FIND batch: %d/%d answered\n", answered, count);
+    return answered;
+}
+
+// Gửi PUBLISH mà không chờ (hash được tính trước khi gửi)
+int publish_file_async(CsCall* call, const char* filename, PublishResponse* resp) {
     PublishRequest req;
-    PublishResponse resp;
     char filepath[MAX_FILEPATH];
     struct stat st;
     
@@ -257,7 +769,7 @@ void publish_file(const char* filename) {
     
     if (stat(filepath, &st) != 0) {
         printf("File không tồn tại!\n");
-        return;
+        return 0;
     }
     
     // Tính hash
@@ -267,12 +779,13 @@ void publish_file(const char* filename) {
     
     if (filehash[0] == '\0') {
         printf("Không thể tính hash!\n");
-        return;
+        return 0;
     }
     
     printf("DEBUG CLIENT: Calculated hash: %s\n", filehash);
     
     memset(&req, 0, sizeof(PublishRequest));
+    memset(resp, 0, sizeof(PublishResponse));
     
     req.header.command = CMD_PUBLISH;
     req.header.request_id = generate_request_id();
@@ -289,13 +802,19 @@ void publish_file(const char* filename) {
     printf("        Filename: %s, Size: %ld bytes\n", filename, st.st_size);
     printf("        Hash: %.16s...\n", filehash);
     
-    if (send(server_sock, &req, sizeof(PublishRequest), 0) < 0) {
-        perror("Send publish request failed");
+    return cs_call_start(call, &req, sizeof(PublishRequest), resp, sizeof(PublishResponse));
+}
+
+// Công bố file với hash và chunk_size
+void publish_file(const char* filename) {
+    PublishResponse resp;
+    CsCall call;
+    
+    if (!publish_file_async(&call, filename, &resp)) {
         return;
     }
-    
-    if (recv_full(server_sock, &resp, sizeof(PublishResponse)) <= 0) {
-        perror("Receive publish response failed");
+    if (!cs_call_wait(&call)) {
+        printf("[ERROR] PUBLISH request failed\n");
         return;
     }
     
@@ -303,13 +822,43 @@ void publish_file(const char* filename) {
     
     if (resp.status == RESP_SUCCESS) {
         printf("Công bố file: %s\n", filename);
-        printf("  Hash: %s\n", filehash);
-        printf("  Size: %ld bytes\n", st.st_size);
     } else {
         printf("Công bố file thất bại! (Status: %d)\n", resp.status);
     }
 }
 
+// Công bố nhiều file: gửi hết rồi mới chờ, nên chỉ tốn khoảng một
+// round trip thay vì một cho mỗi file. Trả về số file công bố thành công.
+int publish_files(const char* filenames[], int count) {
+    CsCall* calls = (CsCall*)calloc(count, sizeof(CsCall));
+    PublishResponse* resps = (PublishResponse*)calloc(count, sizeof(PublishResponse));
+    if (!calls || !resps) {
+        free(calls);
+        free(resps);
+        return 0;
+    }
+    
+    int* started = (int*)calloc(count, sizeof(int));
+    for (int i = 0; started && i < count; i++) {
+        started[i] = publish_file_async(&calls[i], filenames[i], &resps[i]);
+    }
+    
+    int published = 0;
+    for (int i = 0; started && i < count; i++) {
+        if (started[i] && cs_call_wait(&calls[i]) && resps[i].status == RESP_SUCCESS) {
+            published++;
+        } else {
+            printf("Công bố file thất bại: %s\n", filenames[i]);
+        }
+    }
+    
+    free(started);
+    free(calls);
+    free(resps);
+    printf("Đã công bố %d/%d file.\n", published, count);
+    return published;
+}
+
 // Hủy công bố
 void unpublish_file(const char* filename) {
     UnpublishRequest req;
@@ -337,13 +886,8 @@ void unpublish_file(const char* filename) {
     printf("[DEBUG] Sending UNPUBLISH request (request_id: %u)\n", req.header.request_id);
     printf("        Filehash: %.16s...\n", filehash);
     
-    if (send(server_sock, &req, sizeof(UnpublishRequest), 0) < 0) {
-        perror("Send unpublish request failed");
-        return;
-    }
-    
-    if (recv_full(server_sock, &resp, sizeof(UnpublishResponse)) <= 0) {
-        perror("Receive unpublish response failed");
+    if (!cs_call(&req, sizeof(UnpublishRequest), &resp, sizeof(UnpublishResponse))) {
+        printf("[ERROR] UNPUBLISH request failed\n");
         return;
     }
     
@@ -360,6 +904,33 @@ void unpublish_file(const char* filename) {
     }
 }
 
+int subscribe(int watch, const char* target, int remove) {
+    SubscribeRequest req;
+    SubscribeResponse resp;
+    
+    memset(&req, 0, sizeof(SubscribeRequest));
+    
+    req.header.command = CMD_SUBSCRIBE;
+    req.header.request_id = generate_request_id();
+    strcpy(req.email, current_email);
+    strcpy(req.access_token, current_token);
+    req.watch = watch;
+    req.remove = remove;
+    strncpy(req.target, target, MAX_FILENAME - 1);
+    
+    printf("[DEBUG] Sending SUBSCRIBE request (request_id: %u)\n", req.header.request_id);
+    printf("        %s %s: %s\n", remove ? "Remove" : "Add",
+           watch == WATCH_FILEHASH ? "filehash" : "keyword", req.target);
+    
+    if (!cs_call(&req, sizeof(SubscribeRequest), &resp, sizeof(SubscribeResponse))) {
+        printf("[ERROR] SUBSCRIBE request failed\n");
+        return 0;
+    }
+    
+    printf("[DEBUG] Received SUBSCRIBE response (status: %d)\n", resp.status);
+    return resp.status == RESP_SUCCESS;
+}
+
 // Đăng xuất
 void logout_user(void) {
     LogoutRequest req;
@@ -367,6 +938,8 @@ void logout_user(void) {
     
     memset(&req, 0, sizeof(LogoutRequest));
     
+    stop_heartbeat();
+    
     req.header.command = CMD_LOGOUT;
     req.header.request_id = generate_request_id();
     strcpy(req.email, current_email);
@@ -374,13 +947,8 @@ void logout_user(void) {
     
     printf("[DEBUG] Sending LOGOUT request (request_id: %u)\n", req.header.request_id);
     
-    if (send(server_sock, &req, sizeof(LogoutRequest), 0) < 0) {
-        perror("Send logout request failed");
-        return;
-    }
-    
-    if (recv_full(server_sock, &resp, sizeof(LogoutResponse)) <= 0) {
-        perror("Receive logout response failed");
+    if (!cs_call(&req, sizeof(LogoutRequest), &resp, sizeof(LogoutResponse))) {
+        printf("[ERROR] LOGOUT request failed\n");
         return;
     }
     
@@ -392,8 +960,9 @@ void logout_user(void) {
     memset(current_username, 0, sizeof(current_username));
 }
 
-// Báo cáo trạng thái download
-void report_download_status(const char* filehash, int success) {
+// Báo cáo trạng thái download; server dùng nó để xếp hạng peer trong FIND
+void report_download_status(const char* filehash, int success, const PeerInfo* peer,
+                            long bytes, int elapsed_ms) {
     DownloadStatusRequest req;
     DownloadStatusResponse resp;
     
@@ -405,17 +974,15 @@ void report_download_status(const char* filehash, int success) {
     strcpy(req.access_token, current_token);
     strcpy(req.filehash, filehash);
     req.download_success = success;
+    req.peer = *peer;
+    req.bytes = bytes;
+    req.elapsed_ms = elapsed_ms;
     
     printf("[DEBUG] Sending DOWNLOAD_STATUS request (request_id: %u)\n", req.header.request_id);
     printf("        Status: %s\n", success ? "SUCCESS" : "FAILED");
     
-    if (send(server_sock, &req, sizeof(DownloadStatusRequest), 0) < 0) {
-        perror("Send download status request failed");
-        return;
-    }
-    
-    if (recv_full(server_sock, &resp, sizeof(DownloadStatusResponse)) <= 0) {
-        perror("Receive download status response failed");
+    if (!cs_call(&req, sizeof(DownloadStatusRequest), &resp, sizeof(DownloadStatusResponse))) {
+        printf("[ERROR] DOWNLOAD STATUS request failed\n");
         return;
     }
     
@@ -3,16 +3,59 @@
 
 #include "../protocol.h"
 
+#define CS_CALL_TIMEOUT 10  // giây chờ một phản hồi từ server
+
+#define CS_CALL_PENDING 0
+#define CS_CALL_DONE    1
+#define CS_CALL_FAILED  2
+
+// Một request đang chờ phản hồi. Phản hồi được ghép theo request_id nên
+// nhiều request có thể cùng bay trên một kết nối và về theo thứ tự bất kỳ.
+// Server chạy các request đang bay song song; LOGOUT chờ tất cả xong trước.
+typedef struct CsCall {
+    uint32_t request_id;
+    void* resp;
+    size_t resp_size;
+    int state;
+    struct CsCall* next;
+} CsCall;
+
 // Hàm Client-Server Protocol
 int connect_to_server(const char* server_ip);
 int register_user(const char* email, const char* username, const char* password);
 int login_user(const char* email, const char* password);
-SearchResponse search_file(const char* keyword);
+// cursor: next_cursor của trang trước, toàn 0 cho trang đầu
+SearchResponse search_file(const char* keyword, ResultCursor cursor);
 FindResponse find_peers_for_file(const char* filehash);
 void publish_file(const char* filename);
 void unpublish_file(const char* filename);
 void logout_user(void);
-void report_download_status(const char* filehash, int success);
-BrowseFilesResponse browse_files(void);
+void report_download_status(const char* filehash, int success, const PeerInfo* peer,
+                            long bytes, int elapsed_ms);
+// order: BROWSE_RECENT hoặc BROWSE_POPULAR; limit 0 = tối đa
+BrowseFilesResponse browse_files(int order, int limit, ResultCursor cursor);
+// Các thay đổi catalog kể từ phiên bản since (xem BrowseChangesRequest)
+BrowseChangesResponse browse_changes(uint64_t since, int limit);
+// Cập nhật bản sao danh sách file (mới công bố trước) chỉ với những gì đã
+// đổi từ lần trước; lần đầu hoặc khi vắng quá lâu thì tải lại toàn bộ.
+// Trả về 0 nếu lỗi; bản sao có thể chưa đủ và được tải lại lần sau.
+int sync_catalog(void);
+// Bản sao hiện tại; hợp lệ đến lần sync_catalog tiếp theo
+const SearchFileInfo* local_catalog(int* count);
+// Nhờ server báo khi có file mới khớp từ khóa (WATCH_KEYWORD) hoặc khi số
+// peer chia sẻ một filehash đổi (WATCH_FILEHASH); remove = 1 để hủy.
+// Thông báo được in ra ngay khi tới, đến khi ngắt kết nối. 1 = thành công.
+int subscribe(int watch, const char* target, int remove);
+
+// Gọi bất đồng bộ: *_async gửi request và trả về ngay (1 = đã gửi),
+// cs_call_wait chờ phản hồi của call đó (1 = đã nhận, 0 = lỗi/timeout).
+int cs_call_start(CsCall* call, const void* req, size_t req_size, void* resp, size_t resp_size);
+int cs_call_wait(CsCall* call);
+int find_peers_async(CsCall* call, const char* filehash, FindResponse* resp);
+int publish_file_async(CsCall* call, const char* filename, PublishResponse* resp);
+
+// Pipelined batches
+int find_peers_batch(const char* filehashes[], int count, FindResponse* out);
+int publish_files(const char* filenames[], int count);
 
 #endif
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "client_p2p_protocol.h"
 #include "client_utils.h"
 #include "client_cs_protocol.h"
@@ -11,6 +12,7 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <time.h>
 
 /* =========================SOCKET UTILS========================= */
 
@@ -149,7 +151,10 @@ int download_file_chunked(const char* filehash, const char* filename,
     char* bitmap = calloc(total_chunks, 1);
     char* file_data = malloc(file_size);
     int downloaded = 0;
+    long received = 0;
     int success = 0; 
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
 
     // Kết nối
     int sock = connect_to_peer_with_retry(target_peer.ip, target_peer.port);
@@ -202,6 +207,7 @@ int download_file_chunked(const char* filehash, const char* filename,
 
                         bitmap[i] = 1; 
                         downloaded++;
+                        received += current_chunk_size;
                         
                         printf("\r[P2P] Dang tai: %d/%d chunks...", downloaded, total_chunks);
                         fflush(stdout);
@@ -216,6 +222,10 @@ int download_file_chunked(const char* filehash, const char* filename,
         printf("Khong the ket noi den Peer nay.\n");
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    int elapsed_ms = (int)((finished.tv_sec - started.tv_sec) * 1000 +
+                           (finished.tv_nsec - started.tv_nsec) / 1000000);
+
     // 4. Kiểm tra kết quả và ghi file
     // BÁO CÁO 1 LẦN DUY NHẤT TẠI ĐÂY
     if (downloaded == total_chunks) {
@@ -226,15 +236,15 @@ int download_file_chunked(const char* filehash, const char* filename,
             fwrite(file_data, 1, file_size, fp);
             fclose(fp);
             printf("Download HOAN TAT! File luu tai: %s\n", path);
-            report_download_status(filehash, 1); // <--- Báo thành công
+            report_download_status(filehash, 1, &target_peer, received, elapsed_ms); // <--- Báo thành công
             success = 1;
         } else {
             printf("Loi ghi file xuong dia cung.\n");
-            report_download_status(filehash, 0); // <--- Lỗi ghi file cũng tính là thất bại
+            report_download_status(filehash, 0, &target_peer, received, elapsed_ms); // <--- Lỗi ghi file cũng tính là thất bại
         }
     } else {
         printf("Download THAT BAI (Tai duoc %d/%d chunks).\n", downloaded, total_chunks);
-        report_download_status(filehash, 0); // <--- Báo thất bại
+        report_download_status(filehash, 0, &target_peer, received, elapsed_ms); // <--- Báo thất bại
     }
 
     free(bitmap);
@@ -350,6 +360,7 @@ void* handle_peer_download(void* arg) {
     printf("[P2P] Sent Bitmap (%d chunks)\n", total_chunks);
 
     /* ---- SEND CHUNKS LOOP ---- */
+    __atomic_add_fetch(&active_uploads, 1, __ATOMIC_RELAXED);
     while (1) {
         MessageHeader chunk_req_hdr;
         
@@ -401,6 +412,7 @@ void* handle_peer_download(void* arg) {
 
         free(buf);
     }
+    __atomic_sub_fetch(&active_uploads, 1, __ATOMIC_RELAXED);
 
     fclose(fp);
     close(sock);
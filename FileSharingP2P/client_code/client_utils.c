@@ -17,6 +17,7 @@ char current_token[64];
 char shared_dir[64] = "./files_to_share/";
 int server_sock = -1;
 int p2p_listening_port = 0;
+int active_uploads = 0;
 char client_ip[MAX_IP];
 
 // Tính SHA256 hash của file
@@ -12,6 +12,7 @@ extern char current_token[64];  // Token lưu sau login
 extern char shared_dir[];
 extern int server_sock;
 extern int p2p_listening_port;
+extern int active_uploads;  // peer đang tải từ client này; báo cho server qua HEARTBEAT
 extern char client_ip[MAX_IP];
 
 // Hàm tiện ích
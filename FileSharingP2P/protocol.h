@@ -2,6 +2,7 @@
 #define PROTOCOL_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 // Force packed structs for all compilers
 #pragma pack(push, 1)
@@ -17,6 +18,8 @@
 #define BUFFER_SIZE 4096
 #define MAX_BITMAP_SIZE 10000
 #define SERVER_PORT 18888
+#define PEER_LEASE_SECONDS 30  // a peer silent for this long is left out of FIND
+#define HEARTBEAT_INTERVAL 10  // seconds between a client's HEARTBEATs
 
 // Command codes
 typedef enum {
@@ -28,7 +31,12 @@ typedef enum {
     CMD_UNPUBLISH = 6,
     CMD_LOGOUT = 7,
     CMD_DOWNLOAD_STATUS = 8,
-    CMD_BROWSE_FILES = 9       
+    CMD_BROWSE_FILES = 9,
+    CMD_HEARTBEAT = 10,
+    CMD_HELLO = 11,
+    CMD_BROWSE_CHANGES = 12,
+    CMD_SUBSCRIBE = 13,
+    CMD_NOTIFY = 14   // pushed by the tracker, never requested
 } CommandCode;
 
 // Response codes
@@ -72,6 +80,14 @@ typedef struct {
     uint32_t request_id;
 } MessageHeader;
 
+// Where a paged SEARCH, BROWSE or FIND left off. Opaque to clients: send
+// zeros for the first page and the previous reply's next_cursor after
+// that. A reply with a zero next_cursor is the last page.
+typedef struct {
+    uint64_t key;
+    uint64_t id;
+} ResultCursor;
+
 // --- REGISTER ---
 typedef struct {
     MessageHeader header;
@@ -106,6 +122,8 @@ typedef struct {
     char email[MAX_EMAIL];
     char access_token[64];
     char keyword[MAX_FILENAME];
+    ResultCursor cursor;
+    int limit;  // most files wanted; 0 = as many as the response holds
 } SearchRequest;
 
 typedef struct {
@@ -113,36 +131,80 @@ typedef struct {
     char filehash[MAX_HASH];
     long file_size;
     int chunk_size;
+    float popularity;    // downloads reported lately, decayed over time
+    float success_rate;  // share of those downloads that completed
 } SearchFileInfo;
 
 typedef struct {
     MessageHeader header;
     int status;  
     int count;
+    ResultCursor next_cursor;
     SearchFileInfo files[100];
 } SearchResponse;
 
 
 // --- BROWSE FILES ---
+typedef enum {
+    BROWSE_RECENT = 0,   // newest publications first
+    BROWSE_POPULAR = 1   // most downloaded lately first, refreshed at least once a
+                         // minute; files nobody downloaded are left out
+} BrowseOrder;
+
 typedef struct {
     MessageHeader header;
     char email[MAX_EMAIL];
     char access_token[64];
+    int order;  // BrowseOrder
+    int limit;  // most files wanted; 0 = as many as the response holds
+    ResultCursor cursor;
 } BrowseFilesRequest;
 
 typedef struct {
     MessageHeader header;
     int status;      
     int count;
+    ResultCursor next_cursor;
     SearchFileInfo files[100];
 } BrowseFilesResponse;
 
+// --- BROWSE CHANGES ---
+// Keeps a client's copy of the BROWSE_RECENT listing up to date without
+// downloading it again. The tracker remembers the latest catalog changes;
+// a client that has been away for longer gets the listing from scratch.
+typedef struct {
+    MessageHeader header;
+    char email[MAX_EMAIL];
+    char access_token[64];
+    uint64_t since;  // catalog_version of the client's copy; 0 = no copy yet
+    int limit;       // most changes wanted; 0 = as many as the response holds
+} BrowseChangesRequest;
+
+typedef struct {
+    int removed;          // 1 = the file left the catalog; only filehash is set
+    SearchFileInfo file;  // added or replaced otherwise; popularity only in full listings
+} CatalogChange;
+
+typedef struct {
+    MessageHeader header;
+    int status;
+    int full;                  // since is too old: drop the copy, changes hold the first
+                               // BROWSE_RECENT page and next_cursor pages the rest with BROWSE
+    int more;                  // more changes follow catalog_version; ask again right away
+    uint64_t catalog_version;  // send as since next time
+    ResultCursor next_cursor;  // full listings only
+    int count;
+    CatalogChange changes[100];  // oldest first; apply in order, by filehash
+} BrowseChangesResponse;
+
 // --- FIND PEERS ---
 typedef struct {
     MessageHeader header;
     char email[MAX_EMAIL];
     char access_token[64];
     char filehash[MAX_HASH];
+    ResultCursor cursor;  // later pages keep the first page's ranking
+    int limit;            // most peers wanted; 0 = as many as the response holds
 } FindRequest;
 
 typedef struct {
@@ -154,6 +216,7 @@ typedef struct {
     MessageHeader header;
     int status;  
     int count;
+    ResultCursor next_cursor;
     PeerInfo peers[50];
 } FindResponse;
 
@@ -207,6 +270,9 @@ typedef struct {
     char access_token[64];
     char filehash[MAX_HASH];
     int download_success;  // 1 = success, 0 = failed
+    PeerInfo peer;         // the seeder the file was fetched from
+    int64_t bytes;         // received from that peer
+    int32_t elapsed_ms;    // connect to last byte
 } DownloadStatusRequest;
 
 typedef struct {
@@ -214,6 +280,81 @@ typedef struct {
     int status;  
 } DownloadStatusResponse;
 
+// --- HEARTBEAT ---
+// Renews the sender's peer lease. A logged-in peer that stops sending
+// them is dropped from the tracker's peer lists once the lease runs out.
+typedef struct {
+    MessageHeader header;
+    char email[MAX_EMAIL];
+    char access_token[64];
+    int port;  // P2P listening port, as in LOGIN
+    int active_uploads;  // peers currently downloading from the sender
+} HeartbeatRequest;
+
+typedef struct {
+    MessageHeader header;
+    int status;
+    int lease_seconds;  // how long this renewal keeps the peer listed
+} HeartbeatResponse;
+
+// --- HELLO ---
+// Picks the framing for the rest of the connection (see wire.h). Sent
+// as a fixed struct before anything else; the reply is one too, and
+// both sides switch to the agreed version right after it.
+typedef struct {
+    MessageHeader header;
+    uint32_t max_version;  // newest framing the client speaks
+} HelloRequest;
+
+typedef struct {
+    MessageHeader header;
+    int status;
+    uint32_t version;  // framing used from the next message on
+} HelloResponse;
+
+// --- SUBSCRIBE ---
+// Asks the tracker to push a NotifyMessage on this connection when a file
+// matching the watch is published, instead of polling SEARCH or FIND.
+// Subscriptions last until they are removed or the connection closes.
+typedef enum {
+    WATCH_KEYWORD = 0,   // files published with a name containing target, as SEARCH
+    WATCH_FILEHASH = 1   // seeders of the file target joining or leaving
+} WatchType;
+
+#define MAX_SUBSCRIPTIONS 32  // per connection
+
+typedef struct {
+    MessageHeader header;
+    char email[MAX_EMAIL];
+    char access_token[64];
+    int watch;   // WatchType
+    int remove;  // 1 = drop this subscription instead
+    char target[MAX_FILENAME];
+} SubscribeRequest;
+
+typedef struct {
+    MessageHeader header;
+    int status;  // RESP_FAIL once MAX_SUBSCRIPTIONS are held
+} SubscribeResponse;
+
+// --- NOTIFY ---
+// Pushed with request_id 0, at most once per connection and event however
+// many of its subscriptions match.
+// A tracker that can't deliver one closes the connection instead, so a
+// client that reconnects has to subscribe again and catch up with SEARCH
+// or FIND.
+typedef enum {
+    NOTIFY_PUBLISHED = 0,  // file entered the catalog under this name
+    NOTIFY_SEEDERS = 1     // the number of peers sharing file changed
+} NotifyEvent;
+
+typedef struct {
+    MessageHeader header;
+    int event;    // NotifyEvent
+    int seeders;  // peers sharing the file now; 0 = it left the catalog
+    SearchFileInfo file;  // popularity is not filled in
+} NotifyMessage;
+
 // ============================================================================
 // P2P PROTOCOL STRUCTURES
 // ============================================================================
@@ -262,4 +403,48 @@ static inline uint32_t generate_request_id(void) {
     return __sync_add_and_fetch(&counter, 1);
 }
 
-#endif
\ No newline at end of file
+// Size of the fixed request struct that follows a given command code.
+// Returns 0 for unknown commands.
+static inline size_t request_size_for_command(int command) {
+    switch (command) {
+        case CMD_REGISTER: return sizeof(RegisterRequest);
+        case CMD_LOGIN: return sizeof(LoginRequest);
+        case CMD_SEARCH: return sizeof(SearchRequest);
+        case CMD_FIND: return sizeof(FindRequest);
+        case CMD_PUBLISH: return sizeof(PublishRequest);
+        case CMD_UNPUBLISH: return sizeof(UnpublishRequest);
+        case CMD_LOGOUT: return sizeof(LogoutRequest);
+        case CMD_DOWNLOAD_STATUS: return sizeof(DownloadStatusRequest);
+        case CMD_BROWSE_FILES: return sizeof(BrowseFilesRequest);
+        case CMD_HEARTBEAT: return sizeof(HeartbeatRequest);
+        case CMD_HELLO: return sizeof(HelloRequest);
+        case CMD_BROWSE_CHANGES: return sizeof(BrowseChangesRequest);
+        case CMD_SUBSCRIBE: return sizeof(SubscribeRequest);
+        default: return 0;
+    }
+}
+
+// Size of the response struct the server sends back for a command.
+// Responses echo the request's command code, so this frames replies
+// that arrive out of order. Returns 0 for unknown commands.
+static inline size_t response_size_for_command(int command) {
+    switch (command) {
+        case CMD_REGISTER: return sizeof(RegisterResponse);
+        case CMD_LOGIN: return sizeof(LoginResponse);
+        case CMD_SEARCH: return sizeof(SearchResponse);
+        case CMD_FIND: return sizeof(FindResponse);
+        case CMD_PUBLISH: return sizeof(PublishResponse);
+        case CMD_UNPUBLISH: return sizeof(UnpublishResponse);
+        case CMD_LOGOUT: return sizeof(LogoutResponse);
+        case CMD_DOWNLOAD_STATUS: return sizeof(DownloadStatusResponse);
+        case CMD_BROWSE_FILES: return sizeof(BrowseFilesResponse);
+        case CMD_HEARTBEAT: return sizeof(HeartbeatResponse);
+        case CMD_HELLO: return sizeof(HelloResponse);
+        case CMD_BROWSE_CHANGES: return sizeof(BrowseChangesResponse);
+        case CMD_SUBSCRIBE: return sizeof(SubscribeResponse);
+        case CMD_NOTIFY: return sizeof(NotifyMessage);
+        default: return 0;
+    }
+}
+
+#endif
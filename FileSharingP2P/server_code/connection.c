@@ -0,0 +1,492 @@
+#include "connection.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+
+Connection* conn_create(int fd, const struct sockaddr_in* addr) {
+    Connection* conn = (Connection*)calloc(1, sizeof(Connection));
+    if (!conn) return NULL;
+
+    conn->rx = (char*)malloc(RX_BUFFER_SIZE);
+    if (!conn->rx) {
+        free(conn);
+        return NULL;
+    }
+    conn->rx_cap = RX_BUFFER_SIZE;
+
+    conn->fd = fd;
+    conn->refcount = 1;
+    conn->wire_version = WIRE_LEGACY;
+
+    // Replies are queued whole and v2 frames are often smaller than a
+    // segment: don't let Nagle hold them back waiting for a delayed ACK
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    inet_ntop(AF_INET, &addr->sin_addr, conn->client_ip, INET_ADDRSTRLEN);
+    conn->client_port = ntohs(addr->sin_port);
+    conn->last_active = time(NULL);
+    return conn;
+}
+
+void conn_retain(Connection* conn) {
+    __atomic_add_fetch(&conn->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void conn_release(Connection* conn) {
+    if (__atomic_sub_fetch(&conn->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(conn->rx);
+        free(conn->tx);
+        free(conn->tx_inflight);
+        free(conn);
+    }
+}
+
+void conn_close(Connection* conn) {
+    conn->closed = 1;
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+int conn_has_pending_output(const Connection* conn) {
+    return conn->tx_off < conn->tx_len;
+}
+
+// Append to a growable byte buffer
+static int buffer_append(char** buf, size_t* len, size_t* cap, const void* data, size_t size) {
+    if (*len + size > *cap) {
+        size_t new_cap = *cap ? *cap : BUFFER_SIZE;
+        while (new_cap < *len + size) {
+            new_cap *= 2;
+        }
+        char* grown = (char*)realloc(*buf, new_cap);
+        if (!grown) {
+            perror("Failed to grow buffer");
+            return -1;
+        }
+        *buf = grown;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, size);
+    *len += size;
+    return 0;
+}
+
+int conn_send(Connection* conn, const void* data, size_t len) {
+    // Reclaim the already-sent prefix before growing
+    if (conn->tx_off > 0) {
+        memmove(conn->tx, conn->tx + conn->tx_off, conn->tx_len - conn->tx_off);
+        conn->tx_len -= conn->tx_off;
+        conn->tx_off = 0;
+    }
+    return buffer_append(&conn->tx, &conn->tx_len, &conn->tx_cap, data, len);
+}
+
+void conn_close_after_flush(Connection* conn) {
+    conn->close_after_flush = 1;
+}
+
+// Output not yet taken by the socket, including an io_uring batch in flight
+static size_t pending_output(const Connection* conn) {
+    return (conn->tx_len - conn->tx_off) + (conn->tx_inflight_len - conn->tx_inflight_off);
+}
+
+int conn_can_dispatch(const Connection* conn) {
+    size_t pending = pending_output(conn);
+    return !conn->close_after_flush && !conn->stalled &&
+           conn->in_flight < MAX_REQUESTS_IN_FLIGHT &&
+           !(conn->barrier && conn->in_flight > 0) &&
+           pending <= TX_HIGH_WATERMARK;
+}
+
+int conn_flush(Connection* conn) {
+    while (conn->tx_off < conn->tx_len) {
+        ssize_t sent = send(conn->fd, conn->tx + conn->tx_off,
+                            conn->tx_len - conn->tx_off, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        conn->tx_off += sent;
+    }
+
+    conn->tx_off = 0;
+    conn->tx_len = 0;
+
+    // Don't keep a large response buffer around for idle connections
+    if (conn->tx_cap > TX_HIGH_WATERMARK) {
+        free(conn->tx);
+        conn->tx = NULL;
+        conn->tx_cap = 0;
+    }
+    return 0;
+}
+
+// Answer a HELLO on the loop thread. It is a barrier like LOGOUT, so the
+// framing changes only between two replies. Returns 0 when it has to
+// wait for in-flight requests.
+static int conn_hello(Connection* conn, const HelloRequest* req) {
+    conn->barrier = 1;
+    if (conn->in_flight > 0) {
+        return 0;
+    }
+
+    uint32_t version = req->max_version;
+    if (version < WIRE_LEGACY) version = WIRE_LEGACY;
+    if (version > WIRE_VERSION_MAX) version = WIRE_VERSION_MAX;
+
+    HelloResponse resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.header.command = CMD_HELLO;
+    resp.header.request_id = req->header.request_id;
+    resp.status = RESP_SUCCESS;
+    resp.version = version;
+    if (conn_send(conn, &resp, sizeof(resp)) < 0) {
+        conn_close_after_flush(conn);  // the client would wait for it forever
+        return 1;
+    }
+
+    conn->wire_version = (int)version;
+    conn->barrier = 0;
+    return 1;
+}
+
+// Dispatch every complete request sitting in rx. Returns -1 on protocol error.
+static int conn_dispatch(Connection* conn, RequestHandler handler) {
+    size_t off = 0;
+    // Decoded v2 requests, laid out like the legacy structs
+    union {
+        MessageHeader header;
+        char bytes[MAX_REQUEST_SIZE];
+    } decoded;
+
+    while (off < conn->rx_len) {
+        if (conn->close_after_flush) {
+            // Nothing after LOGOUT is processed
+            off = conn->rx_len;
+            break;
+        }
+        if (!conn_can_dispatch(conn)) {
+            conn->rx_paused = 1;
+            break;
+        }
+
+        const MessageHeader* header;
+        size_t size;      // of the request struct
+        size_t consumed;  // bytes it took in rx
+        if (conn->wire_version == WIRE_V2) {
+            size_t body_len;
+            int prefix = wire_frame_prefix((const unsigned char*)conn->rx + off,
+                                           conn->rx_len - off, &body_len);
+            if (prefix < 0 || body_len > MAX_REQUEST_SIZE) {
+                printf("[ERROR] Invalid frame length\n");
+                return -1;
+            }
+            if (prefix == 0 || conn->rx_len - off - prefix < body_len) {
+                break;  // wait for the rest of the frame
+            }
+
+            size = wire_decode((const unsigned char*)conn->rx + off + prefix, body_len, 0,
+                               &decoded, sizeof(decoded));
+            if (size == 0) {
+                printf("[ERROR] Malformed frame\n");
+                return -1;
+            }
+            header = &decoded.header;
+            consumed = prefix + body_len;
+        } else {
+            if (conn->rx_len - off < sizeof(MessageHeader)) {
+                break;
+            }
+            header = (const MessageHeader*)(conn->rx + off);
+            size = request_size_for_command(header->command);
+            if (size == 0) {
+                printf("[ERROR] Unknown command: %d\n", header->command);
+                return -1;
+            }
+            if (conn->rx_len - off < size) {
+                break;  // wait for the rest of the body
+            }
+            consumed = size;
+
+            if (header->command == CMD_HELLO) {
+                if (!conn_hello(conn, (const HelloRequest*)header)) {
+                    conn->rx_paused = 1;
+                    break;
+                }
+                off += consumed;
+                continue;
+            }
+        }
+
+        // Pipelined requests run concurrently and may complete out of order.
+        // LOGOUT is the exception: it runs alone, after everything before it.
+        if (header->command == CMD_LOGOUT) {
+            conn->barrier = 1;
+            if (conn->in_flight > 0) {
+                conn->rx_paused = 1;
+                break;
+            }
+        }
+
+        if (handler(conn, header, size) < 0) {
+            conn->stalled = 1;
+            conn->rx_paused = 1;
+            break;
+        }
+        conn->in_flight++;
+        off += consumed;
+    }
+
+    if (off > 0) {
+        memmove(conn->rx, conn->rx + off, conn->rx_len - off);
+        conn->rx_len -= off;
+    }
+    return 0;
+}
+
+int conn_on_readable(Connection* conn, RequestHandler handler) {
+    conn->rx_paused = 0;
+
+    while (1) {
+        if (conn_dispatch(conn, handler) < 0) {
+            return -1;
+        }
+        if (conn->rx_paused || conn->close_after_flush) {
+            return 0;
+        }
+        if (conn->rx_len == conn->rx_cap) {
+            conn->rx_paused = 1;
+            return 0;
+        }
+
+        ssize_t bytes = recv(conn->fd, conn->rx + conn->rx_len,
+                             conn->rx_cap - conn->rx_len, 0);
+        if (bytes > 0) {
+            conn->rx_len += bytes;
+            conn->last_active = time(NULL);
+            continue;
+        }
+        if (bytes == 0) {
+            printf("[INFO] Client disconnected gracefully.\n");
+            return -1;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+
+        printf("[ERROR] recv failed: %s\n", strerror(errno));
+        return -1;
+    }
+}
+
+int conn_feed(Connection* conn, const char* data, size_t len, RequestHandler handler) {
+    if (buffer_append(&conn->rx, &conn->rx_len, &conn->rx_cap, data, len) < 0) {
+        return -1;
+    }
+    conn->last_active = time(NULL);
+    return conn_resume(conn, handler);
+}
+
+int conn_resume(Connection* conn, RequestHandler handler) {
+    conn->rx_paused = 0;
+    return conn_dispatch(conn, handler);
+}
+
+int conn_complete(Connection* conn, Request* req) {
+    if (__atomic_load_n(&conn->push_lost, __ATOMIC_RELAXED)) {
+        conn_close_after_flush(conn);
+    }
+    if (req->push) {
+        if (conn->closed || conn->close_after_flush) {
+            return 0;  // it ends before this message anyway
+        }
+        // Subscribers can't see a gap, so a notification that can't be
+        // queued ends the connection; they resubscribe when they're back
+        if (pending_output(conn) > TX_HIGH_WATERMARK) {
+            conn_close_after_flush(conn);
+            return 1;
+        }
+
+        // Framed here, on the loop, in the version in force from now on
+        req->wire_version = conn->wire_version;
+        request_reply(req, req->msg, req->msg_len);
+        request_encode_reply(req);
+        if (req->reply_len == 0 || conn_send(conn, req->reply, req->reply_len) < 0) {
+            conn_close_after_flush(conn);
+        }
+        return 1;
+    }
+    conn->in_flight--;
+
+    if (req->login_email[0] != '\0') {
+        strncpy(conn->current_email, req->login_email, MAX_EMAIL - 1);
+    }
+    if (conn->closed) {
+        return 0;
+    }
+
+    if (req->reply_len > 0 && conn_send(conn, req->reply, req->reply_len) < 0) {
+        // The client would wait for this reply forever; end the connection
+        // once what is already queued has gone out
+        printf("[ERROR] Cannot queue reply\n");
+        conn_close_after_flush(conn);
+    }
+    if (req->close_after_reply) {
+        conn_close_after_flush(conn);
+    }
+    return 1;
+}
+
+// ----------------------------------------------------------------
+//                      IDLE LIST (LRU by activity)
+// ----------------------------------------------------------------
+
+void conn_list_append(ConnList* list, Connection* conn) {
+    conn->idle_prev = list->tail;
+    conn->idle_next = NULL;
+    if (list->tail) list->tail->idle_next = conn;
+    else list->head = conn;
+    list->tail = conn;
+    list->count++;
+}
+
+void conn_list_unlink(ConnList* list, Connection* conn) {
+    if (conn->idle_prev) conn->idle_prev->idle_next = conn->idle_next;
+    else list->head = conn->idle_next;
+    if (conn->idle_next) conn->idle_next->idle_prev = conn->idle_prev;
+    else list->tail = conn->idle_prev;
+    conn->idle_prev = conn->idle_next = NULL;
+    list->count--;
+}
+
+void conn_list_touch(ConnList* list, Connection* conn) {
+    if (list->tail != conn) {
+        conn_list_unlink(list, conn);
+        conn_list_append(list, conn);
+    }
+}
+
+// ----------------------------------------------------------------
+//                              REQUESTS
+// ----------------------------------------------------------------
+
+Request* request_create(Connection* conn, const MessageHeader* msg, size_t size) {
+    if (size > MAX_REQUEST_SIZE) return NULL;
+
+    Request* req = (Request*)calloc(1, sizeof(Request));
+    if (!req) return NULL;
+
+    conn_retain(conn);
+    req->conn = conn;
+    memcpy(req->msg, msg, size);
+    req->msg_len = size;
+    req->wire_version = conn->wire_version;
+    return req;
+}
+
+void request_reply(Request* req, const void* data, size_t len) {
+    if (req->reply_lost) return;
+    if (buffer_append(&req->reply, &req->reply_len, &req->reply_cap, data, len) < 0) {
+        // Half a reply would desync the stream: send none and hang up
+        req->reply_lost = 1;
+        req->reply_len = 0;
+        req->close_after_reply = 1;
+    }
+}
+
+void request_encode_reply(Request* req) {
+    if (req->wire_version != WIRE_V2 || req->reply_len == 0) return;
+
+    // Varints and length-prefixed strings outgrow their fixed fields by at
+    // most two bytes each, which never adds up to a quarter of the struct
+    size_t cap = req->reply_len + req->reply_len / 4 + 64;
+    unsigned char* frame = (unsigned char*)malloc(cap);
+    size_t len = frame ? wire_encode(req->reply, req->reply_len, 1, frame, cap) : 0;
+    if (len == 0) {
+        printf("[ERROR] Cannot encode reply\n");
+        free(frame);
+        req->reply_len = 0;
+        req->close_after_reply = 1;
+        return;
+    }
+    free(req->reply);
+    req->reply = (char*)frame;
+    req->reply_len = len;
+    req->reply_cap = cap;
+}
+
+void conn_push(Connection* conn, const void* msg, size_t len) {
+    Request* req = len <= MAX_REQUEST_SIZE ? (Request*)calloc(1, sizeof(Request)) : NULL;
+    if (!req) {
+        // Closed by the loop at its next completion for this connection
+        __atomic_store_n(&conn->push_lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Left unframed: a HELLO may change wire_version before the loop sends it
+    conn_retain(conn);
+    req->conn = conn;
+    req->push = 1;
+    memcpy(req->msg, msg, len);
+    req->msg_len = len;
+    mailbox_post(conn->mailbox, req);
+}
+
+void request_free(Request* req) {
+    if (!req) return;
+    conn_release(req->conn);
+    free(req->reply);
+    free(req);
+}
+
+// ----------------------------------------------------------------
+//                              MAILBOX
+// ----------------------------------------------------------------
+
+int mailbox_init(Mailbox* mailbox) {
+    pthread_mutex_init(&mailbox->lock, NULL);
+    mailbox->head = mailbox->tail = NULL;
+    mailbox->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mailbox->wake_fd < 0) {
+        perror("eventfd failed");
+        pthread_mutex_destroy(&mailbox->lock);
+        return -1;
+    }
+    return 0;
+}
+
+void mailbox_destroy(Mailbox* mailbox) {
+    close(mailbox->wake_fd);
+    pthread_mutex_destroy(&mailbox->lock);
+}
+
+void mailbox_post(Mailbox* mailbox, Request* req) {
+    req->next = NULL;
+
+    pthread_mutex_lock(&mailbox->lock);
+    if (mailbox->tail) mailbox->tail->next = req;
+    else mailbox->head = req;
+    mailbox->tail = req;
+    pthread_mutex_unlock(&mailbox->lock);
+
+    uint64_t one = 1;
+    if (write(mailbox->wake_fd, &one, sizeof(one)) < 0) {
+        perror("eventfd write");
+    }
+}
+
+Request* mailbox_take(Mailbox* mailbox) {
+    pthread_mutex_lock(&mailbox->lock);
+    Request* req = mailbox->head;
+    mailbox->head = mailbox->tail = NULL;
+    pthread_mutex_unlock(&mailbox->lock);
+    return req;
+}
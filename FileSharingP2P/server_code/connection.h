@@ -0,0 +1,173 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "../protocol.h"
+#include "../wire.h"
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define RX_BUFFER_SIZE 2048            // room for several pipelined requests
+#define RX_SPILL_LIMIT (64 * 1024)      // io_uring: stop receiving above this much parked input
+#define TX_HIGH_WATERMARK (1024 * 1024) // stop parsing input above this much pending output
+#define MAX_REQUESTS_IN_FLIGHT 64       // pipelined requests handed to workers per connection
+#define MAX_REQUEST_SIZE 1024           // largest fixed request struct fits comfortably
+
+struct Request;
+struct Subscription;
+
+// Where workers post finished requests for the loop owning the connection.
+// wake_fd is an eventfd the loop watches.
+typedef struct Mailbox {
+    int wake_fd;
+    pthread_mutex_t lock;
+    struct Request* head;
+    struct Request* tail;
+} Mailbox;
+
+// Per-client state for a non-blocking tracker connection
+typedef struct Connection {
+    int fd;
+    int closed;              // set once the owning loop has closed it
+    int refcount;            // loop + one per request held by a worker (atomic)
+    void* loop;              // owning loop (epoll or io_uring backend)
+    Mailbox* mailbox;
+    char client_ip[INET_ADDRSTRLEN];
+    int client_port;
+    char current_email[MAX_EMAIL];  // email logged in on this connection
+    int wire_version;        // WIRE_LEGACY until a HELLO agrees on another framing
+
+    // Read state machine: bytes are buffered until a full request arrives
+    char* rx;
+    size_t rx_len;
+    size_t rx_cap;
+    int rx_paused;   // stopped before EAGAIN; resume once dispatch is possible
+    int stalled;     // worker pool was saturated; retried by the loop
+    int in_flight;   // requests currently with workers
+    int barrier;     // LOGOUT or HELLO seen: it waits for in-flight requests, later ones wait for it
+
+    // Pending output
+    char* tx;
+    size_t tx_len;
+    size_t tx_off;
+    size_t tx_cap;
+    int close_after_flush;
+
+    // io_uring backend: the batch currently owned by the kernel
+    char* tx_inflight;
+    size_t tx_inflight_len;
+    size_t tx_inflight_off;
+    int uring_ops;           // submitted operations not yet completed
+    int recv_armed;
+    int dirty;               // queued for the end-of-batch pump
+    struct Connection* dirty_next;
+
+    // Pushed notifications (subscriptions.c), guarded by the registry lock
+    struct Subscription* subscriptions;
+    int subscription_count;  // -1 once the connection closed: no new ones
+    uint64_t notify_stamp;   // last event queued, so each goes out once
+    int push_lost;           // conn_push couldn't queue one (atomic, any thread)
+
+    time_t last_active;
+    struct Connection* idle_prev;
+    struct Connection* idle_next;
+    struct Connection* stall_next;
+    int in_stall_list;
+} Connection;
+
+// Connections ordered by last activity, oldest first
+typedef struct {
+    Connection* head;
+    Connection* tail;
+    int count;
+} ConnList;
+
+// A decoded request on its way from an event loop to a worker and back.
+// Workers never touch the connection's buffers: the reply and any
+// connection state changes travel back with the request.
+typedef struct Request {
+    Connection* conn;
+    char msg[MAX_REQUEST_SIZE];
+    size_t msg_len;
+    int wire_version;  // framing the reply goes out in
+
+    char* reply;
+    size_t reply_len;
+    size_t reply_cap;
+    char login_email[MAX_EMAIL];  // bind this email to the connection
+    int close_after_reply;
+    int reply_lost;  // request_reply ran out of memory
+    int push;  // unsolicited struct from conn_push in msg, framed by the loop
+
+    struct Request* next;
+} Request;
+
+// Hand a complete request to the application. Returns -1 when it can't be
+// accepted right now; the bytes stay buffered and dispatch is retried.
+typedef int (*RequestHandler)(Connection* conn, const MessageHeader* msg, size_t size);
+
+Connection* conn_create(int fd, const struct sockaddr_in* addr);
+void conn_retain(Connection* conn);
+void conn_release(Connection* conn);
+
+// Close the socket; the struct lives on until the last reference is dropped
+void conn_close(Connection* conn);
+
+// Drain the socket (edge-triggered) and dispatch every complete request.
+// Returns -1 when the connection should be closed.
+int conn_on_readable(Connection* conn, RequestHandler handler);
+
+// Append received bytes and dispatch every complete request (io_uring path).
+// Returns -1 on a protocol error.
+int conn_feed(Connection* conn, const char* data, size_t len, RequestHandler handler);
+
+// Dispatch requests left buffered while the connection was paused
+int conn_resume(Connection* conn, RequestHandler handler);
+
+// Write as much pending output as the socket accepts. Returns -1 on error.
+int conn_flush(Connection* conn);
+
+// Queue output. Returns -1 (and queues nothing) if the buffer can't grow.
+int conn_send(Connection* conn, const void* data, size_t len);
+void conn_close_after_flush(Connection* conn);
+int conn_has_pending_output(const Connection* conn);
+
+// True when another request may be dispatched on this connection
+int conn_can_dispatch(const Connection* conn);
+
+// Apply a finished request to its connection. Returns 0 if the connection
+// was already closed and the reply was dropped. A reply that can't be
+// queued closes the connection once its pending output is flushed.
+int conn_complete(Connection* conn, Request* req);
+
+// Queue an unsolicited message (a fixed reply struct) for the client.
+// Safe from any thread while the caller holds a reference to conn. A push
+// is never dropped silently: when it can't be queued, because the client
+// is not reading its output or memory ran out, the connection closes once
+// what is already queued has been flushed.
+void conn_push(Connection* conn, const void* msg, size_t len);
+
+void conn_list_append(ConnList* list, Connection* conn);
+void conn_list_unlink(ConnList* list, Connection* conn);
+void conn_list_touch(ConnList* list, Connection* conn);
+
+Request* request_create(Connection* conn, const MessageHeader* msg, size_t size);
+// Append to the reply. If that fails the whole reply is dropped and the
+// connection closes instead.
+void request_reply(Request* req, const void* data, size_t len);
+
+// Convert the fixed reply struct to the request's framing. Called once
+// the handler is done; a no-op for WIRE_LEGACY.
+void request_encode_reply(Request* req);
+void request_free(Request* req);
+
+int mailbox_init(Mailbox* mailbox);
+void mailbox_destroy(Mailbox* mailbox);  // nothing may be posted any more
+void mailbox_post(Mailbox* mailbox, Request* req);
+
+// Detach every posted request, oldest first
+Request* mailbox_take(Mailbox* mailbox);
+
+#endif
@@ -1,25 +1,111 @@
+#define _GNU_SOURCE
 #include "data_manager.h"
+#include "user_table.h"
+#include "session_table.h"
+#include "file_index.h"
+#include "search_index.h"
+#include "epoch.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "slab.h"
+#include "hash.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
 
 // Định nghĩa file lưu trữ
-#define USER_FILE "users.txt"
+#define SNAPSHOT_FILE "tracker.snap"        // snapshot nhị phân, được mmap khi khởi động
+#define USER_FILE "users.txt"               // users.txt và shared_files.txt chỉ dùng để nhập/xuất
 #define FILES_FILE "shared_files.txt"
 #define CONNECTED_USERS_FILE "connected_users.txt"
+#define WAL_FILE "tracker.wal"              // các thay đổi kể từ snapshot gần nhất
+#define WAL_OLD_FILE "tracker.wal.old"      // log đang được gộp vào snapshot
+#define WAL_COMPACT_BYTES (16 * 1024 * 1024) // gộp log vào snapshot khi vượt ngưỡng này
 #define SESSION_TIMEOUT 3600  // 1 giờ
+#define EXPECTED_USERS 1024    // kích thước ban đầu của bảng user, tự tăng khi cần
+#define EXPECTED_FILES 1024    // số filehash dự kiến ban đầu cho chỉ mục file
+#define EXPECTED_CONNECTED 256 // số bucket ban đầu cho người dùng đang kết nối
+#define PEER_STATS_ALPHA 0.25f // trọng số của lần tải mới nhất trong thống kê peer
+#define PEER_MIN_SUCCESS 0.05f // peer hay lỗi vẫn thỉnh thoảng được chọn để có dịp hồi phục
+#define MAX_SITES 64           // số prefix --site tối đa
+#define POPULARITY_ONE 256             // một lượt tải trong bộ đếm độ phổ biến
+#define POPULARITY_DECAY_SECONDS 60    // mỗi phút bộ đếm mất 1/2^POPULARITY_DECAY_SHIFT,
+#define POPULARITY_DECAY_SHIFT 6       // tức còn một nửa sau khoảng 44 phút
+#define BROWSE_CACHE_SLOTS 16          // số trang BROWSE đã mã hóa được giữ lại
+#define CHANGE_LOG_SIZE 4096           // số thay đổi catalog gần nhất còn trả được cho BROWSE_CHANGES
+#define CATALOG_VERSION_TIME_SHIFT 20  // lúc khởi động catalog_version = thời điểm << shift
 
 // Định nghĩa các biến global
-User* users = NULL;
+static UserTable* user_table = NULL;
+// Catalog: người đọc duyệt không khóa trong một epoch, người ghi tuần tự hóa bằng files_mutex
 SharedFile* files = NULL;
-Session* sessions = NULL;
-ConnectedUser* connected_users = NULL;
+static FileIndex* file_index = NULL;      // SHA-256 -> bản ghi nội dung
+static SearchIndex* search_index = NULL;  // trigram -> file
+static SessionTable* session_table = NULL;
+// Bản ghi catalog và người dùng đang kết nối được cấp từ slab, không malloc từng cái.
+// Bản ghi catalog dài theo tên file nên mỗi lớp kích thước có một slab riêng.
+#define FILE_SLAB_STEP 32
+#define FILE_SLAB_CLASSES ((sizeof(SharedFile) + MAX_FILENAME - 1) / FILE_SLAB_STEP + 1)
+static Slab* file_slabs[FILE_SLAB_CLASSES];
+static Slab* connected_slab = NULL;
+// Người dùng đang kết nối: bảng băm theo user id, bảo vệ bởi connected_users_mutex
+static ConnectedUser** connected_buckets = NULL;
+static size_t connected_mask = 0;
+static size_t connected_count = 0;
+static TimerWheel* lease_wheel = NULL;  // mỗi giây một tick; gỡ peer hết lease
+// Trang BROWSE dựng sẵn, ánh xạ trực tiếp theo (order, limit). Trang còn
+// dùng được khi cả hai phiên bản dưới đây chưa đổi kể từ lúc dựng.
+static uint64_t catalog_version = 0;        // tăng khi bản ghi catalog được thêm/thay/xóa
+static uint64_t popularity_generation = 0;  // tăng mỗi lần độ phổ biến được làm mờ
+static BrowsePage* browse_cache[BROWSE_CACHE_SLOTS];
+// Nhật ký thay đổi catalog cho BROWSE_CHANGES: mỗi lần catalog_version tăng
+// lên v có đúng một mục, nằm ở ô v % CHANGE_LOG_SIZE. Người ghi (đã giữ
+// files_mutex) ghi mục và tăng phiên bản trong khóa ghi; người đọc chép
+// các mục trong khóa đọc.
+typedef struct {
+    int removed;
+    unsigned char hash[FILE_HASH_BYTES];
+    long file_size;
+    int chunk_size;
+    char filename[MAX_FILENAME];
+} CatalogLogEntry;
+static CatalogLogEntry change_log[CHANGE_LOG_SIZE];
+static uint64_t change_log_floor = 0;  // phiên bản cũ nhất mà client còn hỏi thay đổi được
+static pthread_rwlock_t change_log_lock = PTHREAD_RWLOCK_INITIALIZER;
+static CatalogListener catalog_listener = NULL;  // đặt lúc khởi động
+// Các site mạng (prefix CIDR) dùng để xếp peer gần requester lên trước.
+// Chỉ được ghi lúc khởi động, trước khi có luồng nào đọc.
+typedef struct {
+    uint32_t network;
+    uint32_t mask;
+} SitePrefix;
+static SitePrefix sites[MAX_SITES];
+static int site_count = 0;
+static int site_only = 0;
 pthread_mutex_t users_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t files_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t connected_users_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// tracker.snap là snapshot; mọi thay đổi sau đó nằm trong WAL
+static Wal* wal = NULL;
+static pthread_mutex_t compact_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int connected_users_dirty = 0;  // connected_users.txt được ghi định kỳ
+static pid_t bgsave_pid = 0;           // tiến trình con đang ghi snapshot; chỉ luồng bảo trì dùng
+static struct timespec bgsave_start;
+
+// Loại bản ghi WAL
+enum {
+    WAL_ADD_USER = 1,   // email, username, password
+    WAL_PUBLISH = 2,    // filename, filehash, email, file_size, chunk_size
+    WAL_UNPUBLISH = 3   // filehash, email
+};
+
 void ensure_data_files_exist() {
     FILE* fp;
 
@@ -46,52 +132,227 @@ void ensure_data_files_exist() {
     }
 }
 
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Filehash hex (64 ký tự) -> SHA-256 nhị phân; trả về 0 nếu không hợp lệ
+static int parse_filehash(const char* filehash, unsigned char* hash) {
+    for (int i = 0; i < FILE_HASH_BYTES; i++) {
+        int hi = hex_value(filehash[2 * i]);
+        if (hi < 0) return 0;
+        int lo = hex_value(filehash[2 * i + 1]);
+        if (lo < 0) return 0;
+        hash[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return filehash[2 * FILE_HASH_BYTES] == '\0';
+}
+
+// SHA-256 nhị phân -> filehash hex; out cần MAX_HASH byte
+static void format_filehash(const unsigned char* hash, char* out) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < FILE_HASH_BYTES; i++) {
+        out[2 * i] = digits[hash[i] >> 4];
+        out[2 * i + 1] = digits[hash[i] & 0xF];
+    }
+    out[2 * FILE_HASH_BYTES] = '\0';
+}
+
 // ----------------------------------------------------------------
 //                          CHỨC NĂNG LƯU DỮ LIỆU
 // ----------------------------------------------------------------
 
-void save_users() {
+typedef struct {
+    unsigned char data[WAL_MAX_PAYLOAD];
+    size_t len;
+} WalRecord;
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    int ok;
+} WalReader;
+
+// Chuỗi được ghi dạng uint16 độ dài + nội dung
+static void record_put_str(WalRecord* r, const char* str) {
+    size_t n = strlen(str);
+    r->data[r->len++] = n & 0xFF;
+    r->data[r->len++] = (n >> 8) & 0xFF;
+    memcpy(r->data + r->len, str, n);
+    r->len += n;
+}
+
+static void record_put_i64(WalRecord* r, int64_t v) {
+    for (int i = 0; i < 8; i++) {
+        r->data[r->len++] = ((uint64_t)v >> (8 * i)) & 0xFF;
+    }
+}
+
+static void record_get_str(WalReader* r, char* out, size_t size) {
+    if (!r->ok || r->end - r->p < 2) {
+        r->ok = 0;
+        return;
+    }
+    size_t n = r->p[0] | (r->p[1] << 8);
+    r->p += 2;
+    if (n >= size || (size_t)(r->end - r->p) < n) {
+        r->ok = 0;
+        return;
+    }
+    memcpy(out, r->p, n);
+    out[n] = '\0';
+    r->p += n;
+}
+
+static int64_t record_get_i64(WalReader* r) {
+    if (!r->ok || r->end - r->p < 8) {
+        r->ok = 0;
+        return 0;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)r->p[i] << (8 * i);
+    }
+    r->p += 8;
+    return (int64_t)v;
+}
+
+// Xếp bản ghi vào WAL; trả về ticket cho commit_mutation (0 nếu lỗi)
+static uint64_t log_mutation(const WalRecord* record, uint8_t type) {
+    uint64_t ticket = wal ? wal_append(wal, type, record->data, record->len) : 0;
+    if (wal && ticket == 0) {
+        fprintf(stderr, "[WAL] Failed to log mutation %d; it is kept in memory only\n", type);
+    }
+    return ticket;
+}
+
+// Chờ bản ghi bền vững nếu chính sách fsync yêu cầu. Gọi sau khi nhả khóa
+// dữ liệu để các yêu cầu đồng thời dùng chung một lần fsync.
+static void commit_mutation(uint64_t ticket) {
+    if (ticket && wal_commit(wal, ticket) < 0) {
+        fprintf(stderr, "[WAL] A logged mutation could not be made durable\n");
+    }
+}
+
+// Ghi vào file tạm rồi rename, nên snapshot cũ còn nguyên nếu bị crash giữa chừng
+static FILE* snapshot_begin(const char* path, char* tmp_path, size_t size) {
+    snprintf(tmp_path, size, "%s.tmp", path);
+    FILE* fp = fopen(tmp_path, "w");
+    if (!fp) {
+        perror("Failed to open snapshot");
+    }
+    return fp;
+}
+
+static int snapshot_commit(FILE* fp, const char* tmp_path, const char* path) {
+    int ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp_path, path) < 0) {
+        perror("Failed to write snapshot");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static void write_user_line(const UserRecord* user, void* ctx) {
+    fprintf((FILE*)ctx, "%s|%s|%s\n", user->email, user->username, user->password);
+}
+
+int save_users() {
+    char tmp_path[64];
     pthread_mutex_lock(&users_mutex);
-    FILE* fp = fopen(USER_FILE, "w");
+    FILE* fp = snapshot_begin(USER_FILE, tmp_path, sizeof(tmp_path));
     if (!fp) {
-        perror("Lỗi khi mở users.txt để ghi");
         pthread_mutex_unlock(&users_mutex);
-        return;
+        return -1;
     }
 
     fprintf(fp, "email|username|password\n");
+    user_table_foreach(user_table, write_user_line, fp);
 
-    User* current = users;
-    while (current) {
-        fprintf(fp, "%s|%s|%s\n", current->email, current->username, current->password);
-        current = current->next;
-    }
-
-    fclose(fp);
+    int rc = snapshot_commit(fp, tmp_path, USER_FILE);
     pthread_mutex_unlock(&users_mutex);
+    return rc;
 }
 
-void save_shared_files() {
-    FILE* fp = fopen(FILES_FILE, "w");
-    if (!fp) return;
-    
-    pthread_mutex_lock(&files_mutex);
+int save_shared_files() {
+    char tmp_path[64];
+    FILE* fp = snapshot_begin(FILES_FILE, tmp_path, sizeof(tmp_path));
+    if (!fp) {
+        return -1;
+    }
     
     fprintf(fp, "filename|filehash|email|filesize|chunksize\n");
     
-    SharedFile* current = files;
+    // Đọc catalog không khóa: publish/unpublish không phải chờ việc ghi file
+    epoch_enter();
+    SharedFile* current = __atomic_load_n(&files, __ATOMIC_ACQUIRE);
     while (current) {
-        fprintf(fp, "%s|%s|%s|%ld|%d\n", 
-                current->filename, 
-                current->filehash, 
-                current->owner_email,
-                current->file_size,
-                current->chunk_size);
-        current = current->next;
+        char filehash[MAX_HASH];
+        format_filehash(current->hash, filehash);
+        const OwnerSet* owners = __atomic_load_n(&current->owners, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < owners->count; i++) {
+            char email[MAX_EMAIL];
+            if (!user_table_email(user_table, owners->ids[i], email)) continue;
+            fprintf(fp, "%s|%s|%s|%ld|%d\n", 
+                    current->filename, 
+                    filehash, 
+                    email,
+                    current->file_size,
+                    current->chunk_size);
+        }
+        current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE);
     }
-    pthread_mutex_unlock(&files_mutex);
+    epoch_exit();
     
-    fclose(fp);
+    return snapshot_commit(fp, tmp_path, FILES_FILE);
+}
+
+static void write_user_record(const UserRecord* user, void* ctx) {
+    snapshot_write_user((SnapshotWriter*)ctx, user->email, user->username, user->password);
+}
+
+static void write_session_record(const char* token, const char* email, time_t expires_at, void* ctx) {
+    snapshot_write_session((SnapshotWriter*)ctx, token, email, expires_at);
+}
+
+// Ghi toàn bộ user, catalog và phiên đăng nhập vào snapshot nhị phân
+static int save_snapshot(void) {
+    SnapshotWriter* writer = snapshot_writer_open(SNAPSHOT_FILE);
+    if (!writer) {
+        return -1;
+    }
+
+    user_table_foreach(user_table, write_user_record, writer);
+
+    // Catalog được ghi từ mới đến cũ, giống thứ tự duyệt; mỗi owner một
+    // bản ghi, liền nhau và theo thứ tự ngược vì lúc nạp sẽ đọc từ cuối lên
+    epoch_enter();
+    SharedFile* current = __atomic_load_n(&files, __ATOMIC_ACQUIRE);
+    while (current) {
+        char filehash[MAX_HASH];
+        format_filehash(current->hash, filehash);
+        const OwnerSet* owners = __atomic_load_n(&current->owners, __ATOMIC_ACQUIRE);
+        for (int i = owners->count; i-- > 0;) {
+            char email[MAX_EMAIL];
+            if (!user_table_email(user_table, owners->ids[i], email)) continue;
+            snapshot_write_file(writer, current->filename, filehash, email,
+                                current->file_size, current->chunk_size);
+        }
+        current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE);
+    }
+    epoch_exit();
+
+    session_table_foreach(session_table, write_session_record, writer);
+    return snapshot_writer_commit(writer);
+}
+
+int export_text_data(void) {
+    return (save_users() == 0 && save_shared_files() == 0) ? 0 : -1;
 }
 
 void save_connected_users() {
@@ -105,14 +366,14 @@ void save_connected_users() {
     
     fprintf(fp, "email|ip|port|connecttime\n");  
     
-    ConnectedUser* current = connected_users;
-    while (current) {
-        fprintf(fp, "%s|%s|%d|%ld\n", 
-               current->email, 
-               current->ip, 
-               current->port, 
-               current->connect_time);
-        current = current->next;
+    for (size_t b = 0; b <= connected_mask; b++) {
+        for (ConnectedUser* current = connected_buckets[b]; current; current = current->next) {
+            fprintf(fp, "%s|%s|%d|%ld\n", 
+                   current->email, 
+                   current->ip, 
+                   current->port, 
+                   current->connect_time);
+        }
     }
     pthread_mutex_unlock(&connected_users_mutex);
     fclose(fp);
@@ -148,12 +409,7 @@ void load_users() {
         char* password = strtok(NULL, "|");
 
         if (email && username && password) {
-            User* new_user = (User*)malloc(sizeof(User));
-            strcpy(new_user->email, email);
-            strcpy(new_user->username, username);
-            strcpy(new_user->password, password);
-            new_user->next = users;
-            users = new_user;
+            user_table_insert(user_table, email, username, password);
         }
     }
 
@@ -161,6 +417,205 @@ void load_users() {
     pthread_mutex_unlock(&users_mutex);
 }
 
+// Người ghi của danh sách catalog. Người đọc có thể vẫn đứng trên một nút
+// đã gỡ, nên next của nút đó được giữ nguyên cho đến khi nó được giải phóng.
+static void catalog_push_front(SharedFile* file) {
+    file->prev = NULL;
+    file->next = files;
+    if (files) files->prev = file;
+    __atomic_store_n(&files, file, __ATOMIC_RELEASE);
+}
+
+static void catalog_unlink(SharedFile* file) {
+    if (file->prev) {
+        __atomic_store_n(&file->prev->next, file->next, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&files, file->next, __ATOMIC_RELEASE);
+    }
+    if (file->next) {
+        file->next->prev = file->prev;
+    }
+}
+
+// Ghi thay đổi của file vào nhật ký và tăng catalog_version. Caller giữ files_mutex.
+static void record_catalog_change_locked(const SharedFile* file, int removed) {
+    pthread_rwlock_wrlock(&change_log_lock);
+    uint64_t version = catalog_version + 1;
+    CatalogLogEntry* entry = &change_log[version % CHANGE_LOG_SIZE];
+    entry->removed = removed;
+    memcpy(entry->hash, file->hash, FILE_HASH_BYTES);
+    entry->file_size = file->file_size;
+    entry->chunk_size = file->chunk_size;
+    memcpy(entry->filename, file->filename, strlen(file->filename) + 1);
+    __atomic_store_n(&catalog_version, version, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&change_log_lock);
+}
+
+// Báo một thay đổi cho catalog_listener. Caller giữ files_mutex.
+static void notify_catalog_locked(const SharedFile* file, int event, int seeders) {
+    if (!catalog_listener) return;
+
+    SearchFileInfo info;
+    memset(&info, 0, sizeof(info));
+    strcpy(info.filename, file->filename);
+    format_filehash(file->hash, info.filehash);
+    info.file_size = file->file_size;
+    info.chunk_size = file->chunk_size;
+    catalog_listener(&info, event, seeders);
+}
+
+static Slab* file_slab_for(size_t name_len) {
+    return file_slabs[(sizeof(SharedFile) + name_len) / FILE_SLAB_STEP];
+}
+
+static SharedFile* alloc_shared_file(const char* filename, size_t name_len) {
+    SharedFile* file = (SharedFile*)slab_alloc(file_slab_for(name_len));
+    if (file) {
+        memcpy(file->filename, filename, name_len);
+        file->filename[name_len] = '\0';
+    }
+    return file;
+}
+
+static void free_shared_file(void* ptr) {
+    SharedFile* file = (SharedFile*)ptr;
+    slab_free(file_slab_for(strlen(file->filename)), file);
+}
+
+static int owner_set_contains(const OwnerSet* set, uint32_t id) {
+    for (int i = 0; set && i < set->count; i++) {
+        if (set->ids[i] == id) return 1;
+    }
+    return 0;
+}
+
+// Bản sao của set bỏ remove và thêm add nếu chưa có (0 = không đổi)
+static OwnerSet* owner_set_edit(const OwnerSet* set, uint32_t remove, uint32_t add) {
+    int count = set ? set->count : 0;
+    OwnerSet* copy = (OwnerSet*)malloc(sizeof(OwnerSet) + (count + 1) * sizeof(uint32_t));
+    if (!copy) {
+        perror("Failed to copy file owner set");
+        return NULL;
+    }
+
+    copy->count = 0;
+    for (int i = 0; i < count; i++) {
+        if (set->ids[i] != remove) {
+            copy->ids[copy->count++] = set->ids[i];
+        }
+    }
+    if (add && !owner_set_contains(set, add)) {
+        copy->ids[copy->count++] = add;
+    }
+    return copy;
+}
+
+// Thay tập owner của một bản ghi đang được đọc. Caller giữ files_mutex.
+static int replace_owners_locked(SharedFile* file, uint32_t remove, uint32_t add) {
+    OwnerSet* set = owner_set_edit(file->owners, remove, add);
+    if (!set) return 0;
+    OwnerSet* old = file->owners;
+    __atomic_store_n(&file->owners, set, __ATOMIC_RELEASE);
+    epoch_retire(old);
+    return 1;
+}
+
+// Công bố (filehash, owner). Caller giữ files_mutex.
+// Cùng tên và kích thước thì chỉ thêm owner vào bản ghi sẵn có; khác thì
+// tạo bản ghi mới thay thế, giữ nguyên các owner cũ.
+// Trả về 0 nếu filehash/owner không hợp lệ hoặc thiếu bộ nhớ.
+static int upsert_file_locked(const char* filename, const char* filehash, const char* owner_email,
+                              long file_size, int chunk_size) {
+    unsigned char hash[FILE_HASH_BYTES];
+    uint32_t owner = user_table_id(user_table, owner_email);
+    if (!parse_filehash(filehash, hash) || owner == 0) {
+        return 0;
+    }
+
+    size_t name_len = strnlen(filename, MAX_FILENAME - 1);
+    SharedFile* old = file_index_find(file_index, hash);
+    if (old && strncmp(old->filename, filename, name_len) == 0 && old->filename[name_len] == '\0' &&
+        old->file_size == file_size && old->chunk_size == chunk_size) {
+        if (owner_set_contains(old->owners, owner)) {
+            return 1;
+        }
+        if (!replace_owners_locked(old, 0, owner)) {
+            return 0;
+        }
+        notify_catalog_locked(old, NOTIFY_SEEDERS, old->owners->count);
+        return 1;
+    }
+
+    SharedFile* file = alloc_shared_file(filename, name_len);
+    if (!file) return 0;
+    memcpy(file->hash, hash, FILE_HASH_BYTES);
+    file->file_size = file_size;
+    file->chunk_size = chunk_size;
+    file->owners = owner_set_edit(old ? old->owners : NULL, 0, owner);
+    file->downloads = old ? __atomic_load_n(&old->downloads, __ATOMIC_RELAXED) : 0;
+    file->completed = old ? __atomic_load_n(&old->completed, __ATOMIC_RELAXED) : 0;
+
+    if (!file->owners || !search_index_add(search_index, file)) {
+        free(file->owners);
+        free_shared_file(file);
+        return 0;
+    }
+    if (old) {
+        file_index_replace(file_index, old, file);
+    } else if (!file_index_add(file_index, file)) {
+        search_index_remove(search_index, file);
+        free(file->owners);
+        free_shared_file(file);  // never reachable by readers
+        return 0;
+    }
+
+    int old_seeders = old ? old->owners->count : 0;
+    if (old) {
+        search_index_remove(search_index, old);
+        catalog_unlink(old);
+        epoch_retire(old->owners);
+        epoch_retire_with(old, free_shared_file);
+    }
+    catalog_push_front(file);
+    record_catalog_change_locked(file, 0);
+    notify_catalog_locked(file, NOTIFY_PUBLISHED, file->owners->count);
+    if (file->owners->count != old_seeders) {
+        notify_catalog_locked(file, NOTIFY_SEEDERS, file->owners->count);
+    }
+    return 1;
+}
+
+// Gỡ owner khỏi nội dung filehash; nội dung không còn ai chia sẻ thì bị xóa.
+// Caller giữ files_mutex.
+static int remove_file_locked(const char* filehash, const char* owner_email) {
+    unsigned char hash[FILE_HASH_BYTES];
+    uint32_t owner = user_table_id(user_table, owner_email);
+    if (!parse_filehash(filehash, hash) || owner == 0) {
+        return 0;
+    }
+
+    SharedFile* file = file_index_find(file_index, hash);
+    if (!file || !owner_set_contains(file->owners, owner)) {
+        return 0;
+    }
+    if (file->owners->count > 1) {
+        if (!replace_owners_locked(file, owner, 0)) {
+            return 0;
+        }
+        notify_catalog_locked(file, NOTIFY_SEEDERS, file->owners->count);
+        return 1;
+    }
+
+    file_index_remove(file_index, file);
+    search_index_remove(search_index, file);
+    catalog_unlink(file);
+    record_catalog_change_locked(file, 1);
+    notify_catalog_locked(file, NOTIFY_SEEDERS, 0);
+    epoch_retire(file->owners);
+    epoch_retire_with(file, free_shared_file);
+    return 1;
+}
+
 void load_shared_files() {
     FILE* fp = fopen(FILES_FILE, "r");
     if (!fp) return;
@@ -185,20 +640,7 @@ void load_shared_files() {
         
         if (sscanf(line, "%[^|]|%[^|]|%[^|]|%ld|%d", 
                   filename, filehash, email, &file_size, &chunk_size) == 5) {
-            
-            SharedFile* new_file = (SharedFile*)malloc(sizeof(SharedFile));
-            if (new_file) {
-                strncpy(new_file->filename, filename, MAX_FILENAME - 1);
-                new_file->filename[MAX_FILENAME - 1] = '\0';
-                strncpy(new_file->filehash, filehash, MAX_HASH - 1);
-                new_file->filehash[MAX_HASH - 1] = '\0';
-                strncpy(new_file->owner_email, email, MAX_EMAIL - 1);
-                new_file->owner_email[MAX_EMAIL - 1] = '\0';
-                new_file->file_size = file_size;
-                new_file->chunk_size = chunk_size;
-                new_file->next = files;
-                files = new_file;
-            }
+            upsert_file_locked(filename, filehash, email, file_size, chunk_size);
         }
     }
     
@@ -206,382 +648,624 @@ void load_shared_files() {
     fclose(fp);
 }
 
-void load_data() {
-    load_users();
-    load_shared_files();
-    connected_users = NULL;
-}
-
-// ----------------------------------------------------------------
-//                     QUẢN LÝ NGƯỜI DÙNG ĐANG KẾT NỐI
-// ----------------------------------------------------------------
-
-void add_connected_user(const char* email, const char* ip, int port) {
-    if (!email || !ip) return;
-    
-    // First remove if user already exists (update case)
-    remove_connected_user(email);
-    
-    // Create new connected user
-    ConnectedUser* new_user = (ConnectedUser*)malloc(sizeof(ConnectedUser));
-    if (!new_user) return;
-    
-    strncpy(new_user->email, email, MAX_EMAIL - 1);
-    new_user->email[MAX_EMAIL - 1] = '\0';
-    strncpy(new_user->ip, ip, MAX_IP - 1);
-    new_user->ip[MAX_IP - 1] = '\0';
-    new_user->port = port;
-    new_user->connect_time = time(NULL);
-    
-    // Add to the beginning of the list
-    pthread_mutex_lock(&connected_users_mutex);
-    new_user->next = connected_users;
-    connected_users = new_user;
-    pthread_mutex_unlock(&connected_users_mutex);
-    
-    printf("[INFO] User %s connected from %s:%d\n", email, ip, port);
-    save_connected_users();
-}
+static void load_snapshot_users(const Snapshot* snap) {
+    size_t count = 0;
+    const SnapshotUser* users = snapshot_users(snap, &count);
 
-void remove_connected_user(const char* email) {
-    if (!email) return;
-    
-    pthread_mutex_lock(&connected_users_mutex);
-    
-    ConnectedUser* current = connected_users;
-    ConnectedUser* prev = NULL;
-    
-    while (current) {
-        if (strcmp(current->email, email) == 0) {
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                connected_users = current->next;
-            }
-            printf("[INFO] User %s disconnected\n", email);
-            free(current);
-            break;
+    for (size_t i = 0; i < count; i++) {
+        const SnapshotUser* user = &users[i];
+        // Trường nào không kết thúc bằng '\0' thì bản ghi đã hỏng
+        if (user->email[MAX_EMAIL - 1] || user->username[MAX_USERNAME - 1] ||
+            user->password[MAX_PASSWORD - 1]) {
+            continue;
         }
-        prev = current;
-        current = current->next;
+        user_table_insert(user_table, user->email, user->username, user->password);
     }
-    
-    pthread_mutex_unlock(&connected_users_mutex);
-    save_connected_users();
 }
 
-void cleanup_disconnected_users() {
-    time_t now = time(NULL);
-    pthread_mutex_lock(&connected_users_mutex);
-    
-    ConnectedUser* current = connected_users;
-    ConnectedUser* prev = NULL;
-    
-    while (current) {
-        if (now - current->connect_time > 3600) { // 1 hour timeout
-            printf("[INFO] Cleaning up stale connection for %s (last seen: %lds ago)\n", 
-                  current->email, now - current->connect_time);
-                  
-            ConnectedUser* to_delete = current;
-            if (prev) {
-                prev->next = current->next;
-                current = current->next;
-            } else {
-                connected_users = current->next;
-                current = connected_users;
-            }
-            free(to_delete);
-        } else {
-            prev = current;
-            current = current->next;
+static void load_snapshot_files(const Snapshot* snap) {
+    size_t count = 0;
+    const SnapshotFile* records = snapshot_files(snap, &count);
+
+    // Mỗi lớp kích thước của catalog nằm trong một khối cấp phát duy nhất.
+    // Các owner của cùng một nội dung nằm liền nhau và chỉ tốn một bản ghi.
+    size_t per_class[FILE_SLAB_CLASSES] = {0};
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && strncmp(records[i].filehash, records[i - 1].filehash, MAX_HASH) == 0) continue;
+        per_class[(sizeof(SharedFile) + strnlen(records[i].filename, MAX_FILENAME - 1)) / FILE_SLAB_STEP]++;
+    }
+    for (size_t c = 0; c < FILE_SLAB_CLASSES; c++) {
+        if (per_class[c] && slab_reserve(file_slabs[c], per_class[c]) < 0) {
+            fprintf(stderr, "Không đủ bộ nhớ để nạp sẵn %zu file\n", per_class[c]);
         }
     }
-    
-    pthread_mutex_unlock(&connected_users_mutex);
-}
 
-int is_user_already_connected(const char* email) {
-    if (!email) return 0;
-    
-    pthread_mutex_lock(&connected_users_mutex);
-    
-    ConnectedUser* current = connected_users;
-    while (current) {
-        if (strcmp(current->email, email) == 0) {
-            pthread_mutex_unlock(&connected_users_mutex);
-            return 1;  // User is already connected
+    pthread_mutex_lock(&files_mutex);
+    // Nạp từ cũ đến mới để catalog giữ nguyên thứ tự khi được đẩy vào đầu danh sách
+    for (size_t i = count; i-- > 0;) {
+        const SnapshotFile* file = &records[i];
+        if (file->filename[MAX_FILENAME - 1] || file->filehash[MAX_HASH - 1] ||
+            file->owner_email[MAX_EMAIL - 1]) {
+            continue;
         }
-        current = current->next;
+        upsert_file_locked(file->filename, file->filehash, file->owner_email,
+                           (long)file->file_size, file->chunk_size);
     }
-    
-    pthread_mutex_unlock(&connected_users_mutex);
-    return 0;  // User is not connected
+    pthread_mutex_unlock(&files_mutex);
 }
 
-// ----------------------------------------------------------------
-//                          CHỨC NĂNG LOGIC SERVER
-// ----------------------------------------------------------------
+// Catalog lưu owner theo id, nên bảng user phải được nạp trước
+static void load_snapshot(Snapshot* snap) {
+    load_snapshot_users(snap);
+    load_snapshot_files(snap);
+}
 
-int get_username_by_email(const char* email, char* username_out) {
-    pthread_mutex_lock(&users_mutex);
-    
-    User* current = users;
-    while (current) {
-        if (strcmp(current->email, email) == 0) {
-            strcpy(username_out, current->username);
-            pthread_mutex_unlock(&users_mutex);
-            return 1;
+// Áp dụng lại một bản ghi WAL. Mọi thao tác đều idempotent, nên bản ghi
+// đã nằm trong snapshot có thể được phát lại mà không sai lệch.
+static void replay_record(uint8_t type, const unsigned char* payload, size_t len, void* ctx) {
+    long* applied = (long*)ctx;
+    WalReader r = { payload, payload + len, 1 };
+    char email[MAX_EMAIL], filehash[MAX_HASH];
+
+    switch (type) {
+        case WAL_ADD_USER: {
+            char username[MAX_USERNAME], password[MAX_PASSWORD];
+            record_get_str(&r, email, sizeof(email));
+            record_get_str(&r, username, sizeof(username));
+            record_get_str(&r, password, sizeof(password));
+            if (r.ok) {
+                user_table_insert(user_table, email, username, password);
+            }
+            break;
+        }
+        case WAL_PUBLISH: {
+            char filename[MAX_FILENAME];
+            record_get_str(&r, filename, sizeof(filename));
+            record_get_str(&r, filehash, sizeof(filehash));
+            record_get_str(&r, email, sizeof(email));
+            long file_size = (long)record_get_i64(&r);
+            int chunk_size = (int)record_get_i64(&r);
+            if (r.ok) {
+                pthread_mutex_lock(&files_mutex);
+                upsert_file_locked(filename, filehash, email, file_size, chunk_size);
+                pthread_mutex_unlock(&files_mutex);
+            }
+            break;
         }
-        current = current->next;
+        case WAL_UNPUBLISH:
+            record_get_str(&r, filehash, sizeof(filehash));
+            record_get_str(&r, email, sizeof(email));
+            if (r.ok) {
+                pthread_mutex_lock(&files_mutex);
+                remove_file_locked(filehash, email);
+                pthread_mutex_unlock(&files_mutex);
+            }
+            break;
+        default:
+            r.ok = 0;
+            break;
+    }
+
+    if (r.ok) {
+        (*applied)++;
+    } else {
+        fprintf(stderr, "[WAL] Skipping malformed record of type %d\n", type);
     }
-    
-    pthread_mutex_unlock(&users_mutex);
-    return 0;
 }
 
-int get_file_owner_info(const char* filehash, char* ip, int* port) {
-    char owner_email[MAX_EMAIL] = {0};
-    int found = 0;
-    
-    // First find the file to get owner's email
-    pthread_mutex_lock(&files_mutex);
-    SharedFile* current = files;
-    while (current) {
-        if (strcmp(current->filehash, filehash) == 0) {
-            strncpy(owner_email, current->owner_email, MAX_EMAIL - 1);
-            found = 1;
+// Gộp WAL vào snapshot: chuyển log hiện tại sang WAL_OLD_FILE, ghi snapshot
+// từ bộ nhớ (đã chứa mọi thay đổi trong log đó), rồi xóa log cũ. Thay đổi
+// đến trong lúc gộp đi vào log mới; nếu chúng cũng lọt vào snapshot thì
+// việc phát lại chúng vẫn vô hại. Chạy đồng bộ nên chỉ dùng lúc khởi động;
+// khi đang phục vụ thì dùng background_save().
+static int compact_data(void) {
+    pthread_mutex_lock(&compact_mutex);
+
+    // A previous attempt left an old log behind: finish that one first
+    int pending = access(WAL_OLD_FILE, F_OK) == 0;
+    int rc = 0;
+    for (int pass = pending ? 0 : 1; pass < 2 && rc == 0; pass++) {
+        if (pass == 1 && wal_rotate(wal, WAL_OLD_FILE) < 0) {
+            rc = -1;
             break;
         }
-        current = current->next;
-    }
-    pthread_mutex_unlock(&files_mutex);
-    
-    if (!found) {
-        return 0; // File not found
-    }
-    
-    // Now find the owner in connected users
-    pthread_mutex_lock(&connected_users_mutex);
-    ConnectedUser* user = connected_users;
-    while (user) {
-        if (strcmp(user->email, owner_email) == 0) {
-            strncpy(ip, user->ip, MAX_IP - 1);
-            *port = user->port;
-            pthread_mutex_unlock(&connected_users_mutex);
-            return 1; 
+        rc = save_snapshot();
+        if (rc == 0) {
+            unlink(WAL_OLD_FILE);
         }
-        user = user->next;
     }
-    pthread_mutex_unlock(&connected_users_mutex);
-    
-    return 0; 
+
+    pthread_mutex_unlock(&compact_mutex);
+    return rc;
 }
 
-int add_user(const char* email, const char* username, const char* password) {
-    pthread_mutex_lock(&users_mutex);
-    
-    User* current = users;
-    while (current) {
-        if (strcmp(current->email, email) == 0) {
-            pthread_mutex_unlock(&users_mutex);
-            return 0; 
-        }
-        current = current->next;
+// Ghi snapshot trong tiến trình con (kiểu BGSAVE của Redis): fork() cho con một
+// bản sao tại một thời điểm của toàn bộ dữ liệu, copy-on-write, nên tiến trình
+// cha tiếp tục phục vụ trong lúc con ghi đĩa. Log được xoay đúng lúc fork nên
+// WAL_OLD_FILE chứa chính xác các thay đổi mà snapshot này bao phủ.
+int background_save(void) {
+    if (bgsave_pid > 0) {
+        printf("[BGSAVE] Already in progress (pid %d)\n", (int)bgsave_pid);
+        return 0;
     }
-    
-    User* new_user = (User*)malloc(sizeof(User));
-    strcpy(new_user->email, email);
-    strcpy(new_user->username, username);
-    strcpy(new_user->password, password);
-    new_user->next = users;
-    users = new_user;
-    
-    pthread_mutex_unlock(&users_mutex);
-    save_users();
-    return 1;
-}
 
-int authenticate(const char* email, const char* password) {
-    pthread_mutex_lock(&users_mutex);
-    
-    User* current = users;
-    while (current) {
-        if (strcmp(current->email, email) == 0 &&
-            strcmp(current->password, password) == 0) {
-            pthread_mutex_unlock(&users_mutex);
-            return 1;
-        }
-        current = current->next;
+    pthread_mutex_lock(&compact_mutex);
+    // Lần trước thất bại thì log cũ vẫn còn: snapshot mới bao phủ cả nó
+    int rotate = access(WAL_OLD_FILE, F_OK) != 0;
+
+    // Chặn người ghi trong lúc fork để con nhận dữ liệu nhất quán
+    pthread_mutex_lock(&files_mutex);
+    user_table_fork_prepare(user_table);
+    session_table_fork_prepare(session_table);
+
+    pid_t pid = -1;
+    if (!rotate || wal_rotate(wal, WAL_OLD_FILE) == 0) {
+        pid = fork();
     }
-    
-    pthread_mutex_unlock(&users_mutex);
+    if (pid == 0) {
+        // Con chỉ còn một luồng: không dùng WAL hay khóa nào của các luồng khác
+        user_table_fork_child(user_table);
+        session_table_fork_child(session_table);
+        _exit(save_snapshot() == 0 ? 0 : 1);
+    }
+
+    session_table_fork_parent(session_table);
+    user_table_fork_parent(user_table);
+    pthread_mutex_unlock(&files_mutex);
+    pthread_mutex_unlock(&compact_mutex);
+
+    if (pid < 0) {
+        perror("[BGSAVE] Could not start");
+        return -1;
+    }
+    bgsave_pid = pid;
+    clock_gettime(CLOCK_MONOTONIC, &bgsave_start);
+    printf("[BGSAVE] Started (pid %d)\n", (int)pid);
     return 0;
 }
 
-void publish_file(const char* filename, const char* filehash, const char* owner_email,
-                 long file_size, int chunk_size) {
-    if (!filename || !filehash || !owner_email) {
+// Thu kết quả của tiến trình con khi nó kết thúc
+static void poll_background_save(void) {
+    int status = 0;
+    if (bgsave_pid <= 0 || waitpid(bgsave_pid, &status, WNOHANG) == 0) {
         return;
     }
-    pthread_mutex_lock(&files_mutex);
-    
-    // Check if file already exists with same hash and owner
-    SharedFile* current = files;
-    while (current) {
-        if (strcmp(current->filehash, filehash) == 0 &&
-            strcmp(current->owner_email, owner_email) == 0) {
-            strncpy(current->filename, filename, MAX_FILENAME - 1);
-            current->file_size = file_size;
-            current->chunk_size = chunk_size;
-            pthread_mutex_unlock(&files_mutex);
-            save_shared_files();
-            return;
+    bgsave_pid = 0;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        unlink(WAL_OLD_FILE);
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("[BGSAVE] Snapshot written in %.2fs\n",
+               (end.tv_sec - bgsave_start.tv_sec) + (end.tv_nsec - bgsave_start.tv_nsec) / 1e9);
+    } else {
+        // Log cũ được giữ lại; lần lưu sau sẽ bao phủ nó
+        fprintf(stderr, "[BGSAVE] Snapshot failed; %s kept\n", WAL_OLD_FILE);
+    }
+}
+
+void load_data(const WalOptions* persistence) {
+    session_table = session_table_create(SESSION_TIMEOUT);
+    if (!session_table) {
+        fprintf(stderr, "Không thể tạo bảng phiên đăng nhập\n");
+        exit(1);
+    }
+
+    // Snapshot cho biết số bản ghi, nên các bảng băm được tạo đủ lớn ngay từ đầu
+    Snapshot* snap = snapshot_open(SNAPSHOT_FILE);
+    if (!snap && errno != ENOENT) {
+        fprintf(stderr, "Không đọc được %s; xóa nó để nhập lại từ %s và %s\n",
+                SNAPSHOT_FILE, USER_FILE, FILES_FILE);
+        exit(1);
+    }
+    size_t expected_users = EXPECTED_USERS;
+    size_t expected_files = EXPECTED_FILES;
+    if (snap) {
+        size_t count = 0;
+        snapshot_users(snap, &count);
+        if (count > expected_users) expected_users = count;
+        snapshot_files(snap, &count);
+        if (count > expected_files) expected_files = count;
+    }
+
+    user_table = user_table_create(expected_users);
+    file_index = file_index_create(expected_files);
+    search_index = search_index_create();
+    int slabs_ok = 1;
+    for (size_t c = 0; c < FILE_SLAB_CLASSES; c++) {
+        file_slabs[c] = slab_create((c + 1) * FILE_SLAB_STEP);
+        slabs_ok = slabs_ok && file_slabs[c];
+    }
+    connected_slab = slab_create(sizeof(ConnectedUser));
+    lease_wheel = timer_wheel_create((uint64_t)time(NULL));
+    size_t capacity = hash_capacity_for(EXPECTED_CONNECTED);
+    connected_buckets = (ConnectedUser**)calloc(capacity, sizeof(ConnectedUser*));
+    if (!user_table || !file_index || !search_index || !slabs_ok || !connected_slab ||
+        !lease_wheel || !connected_buckets) {
+        fprintf(stderr, "Không thể tạo chỉ mục file/người dùng\n");
+        exit(1);
+    }
+    connected_mask = capacity - 1;
+
+    // Snapshot trước, sau đó phát lại các thay đổi theo đúng thứ tự.
+    // Chưa có snapshot nhị phân thì nhập từ các file văn bản.
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int imported = snap == NULL;
+    if (snap) {
+        load_snapshot(snap);
+        snapshot_close(snap);
+    } else {
+        load_users();
+        load_shared_files();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    size_t file_count = 0;
+    for (size_t c = 0; c < FILE_SLAB_CLASSES; c++) {
+        file_count += slab_live(file_slabs[c]);
+    }
+    printf("[Snapshot] Loaded %zu user(s) and %zu file(s) from %s in %.2fs\n",
+           user_table_count(user_table), file_count,
+           imported ? "text files" : SNAPSHOT_FILE,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    long applied = 0;
+    if (wal_replay(WAL_OLD_FILE, replay_record, &applied) < 0 ||
+        wal_replay(WAL_FILE, replay_record, &applied) < 0) {
+        perror("Không thể đọc WAL");
+        exit(1);
+    }
+
+    wal = wal_open(WAL_FILE, persistence);
+    if (!wal) {
+        exit(1);
+    }
+    if (applied > 0) {
+        printf("[WAL] Replayed %ld change(s)\n", applied);
+    }
+    if (applied > 0 || imported) {
+        compact_data();
+    }
+
+    // Phiên bản của lần chạy này lớn hơn mọi phiên bản client giữ từ lần
+    // chạy trước, nên họ nhận lại danh sách đầy đủ thay vì thay đổi sai
+    uint64_t base = (uint64_t)time(NULL) << CATALOG_VERSION_TIME_SHIFT;
+    pthread_rwlock_wrlock(&change_log_lock);
+    if (base > catalog_version) {
+        catalog_version = base;
+    }
+    change_log_floor = catalog_version;
+    pthread_rwlock_unlock(&change_log_lock);
+}
+
+// Gọi định kỳ: ghi connected_users.txt khi có thay đổi và gộp WAL khi quá lớn
+void checkpoint_data(void) {
+    if (__atomic_exchange_n(&connected_users_dirty, 0, __ATOMIC_ACQ_REL)) {
+        save_connected_users();
+    }
+    poll_background_save();
+    if (bgsave_pid == 0 && wal_size(wal) >= WAL_COMPACT_BYTES) {
+        printf("[WAL] Compacting %zu byte(s) of log into a snapshot\n", wal_size(wal));
+        background_save();
+    }
+}
+
+// ----------------------------------------------------------------
+//                     QUẢN LÝ NGƯỜI DÙNG ĐANG KẾT NỐI
+// ----------------------------------------------------------------
+
+// Id là chỉ số tuần tự nên được trộn bit trước khi chia bucket
+static size_t connected_hash(uint32_t user_id) {
+    return (size_t)((user_id * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static ConnectedUser** connected_bucket(uint32_t user_id) {
+    return &connected_buckets[connected_hash(user_id) & connected_mask];
+}
+
+// Con trỏ tới liên kết trỏ vào user (hoặc tới NULL cuối chuỗi). Caller giữ connected_users_mutex.
+static ConnectedUser** find_connected_link(uint32_t user_id) {
+    ConnectedUser** link = connected_bucket(user_id);
+    while (*link && (*link)->user_id != user_id) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static void grow_connected_buckets(void) {
+    size_t capacity = (connected_mask + 1) * 2;
+    ConnectedUser** buckets = (ConnectedUser**)calloc(capacity, sizeof(ConnectedUser*));
+    if (!buckets) return;  // chains just get longer
+
+    for (size_t b = 0; b <= connected_mask; b++) {
+        ConnectedUser* user = connected_buckets[b];
+        while (user) {
+            ConnectedUser* next = user->next;
+            ConnectedUser** bucket = &buckets[connected_hash(user->user_id) & (capacity - 1)];
+            user->next = *bucket;
+            *bucket = user;
+            user = next;
         }
-        current = current->next;
     }
-    
-    SharedFile* new_file = (SharedFile*)malloc(sizeof(SharedFile));
-    if (!new_file) {
-        pthread_mutex_unlock(&files_mutex);
-        return;
+
+    free(connected_buckets);
+    connected_buckets = buckets;
+    connected_mask = capacity - 1;
+}
+
+// IPv4 dạng số (host order); 0 nếu không phải IPv4
+static uint32_t parse_ipv4(const char* ip) {
+    struct in_addr addr;
+    return inet_pton(AF_INET, ip, &addr) == 1 ? ntohl(addr.s_addr) : 0;
+}
+
+// Gia hạn lease của user, thêm user vào bảng nếu chưa có (*added = 1).
+// Trả về NULL nếu thiếu bộ nhớ. Caller giữ connected_users_mutex.
+static ConnectedUser* touch_connected_user_locked(uint32_t user_id, const char* email, const char* ip,
+                                                  int port, time_t now, int* added) {
+    ConnectedUser* user = *find_connected_link(user_id);
+    *added = user == NULL;
+    if (!user) {
+        user = (ConnectedUser*)slab_alloc(connected_slab);
+        if (!user) {
+            return NULL;
+        }
+        user->user_id = user_id;
+        strncpy(user->email, email, MAX_EMAIL - 1);
+        user->connect_time = now;
+        user->success_rate = 1.0f;  // chưa có lần tải nào thì coi như tốt
+        
+        if (connected_count > connected_mask) {
+            grow_connected_buckets();
+        }
+        ConnectedUser** bucket = connected_bucket(user_id);
+        user->next = *bucket;
+        *bucket = user;
+        connected_count++;
     }
     
-    strncpy(new_file->filename, filename, MAX_FILENAME - 1);
-    strncpy(new_file->filehash, filehash, MAX_HASH - 1);
-    strncpy(new_file->owner_email, owner_email, MAX_EMAIL - 1);
-    new_file->file_size = file_size;
-    new_file->chunk_size = chunk_size;
+    strncpy(user->ip, ip, MAX_IP - 1);
+    user->ip[MAX_IP - 1] = '\0';
+    user->addr = parse_ipv4(ip);
+    user->port = port;
+    user->lease_expires = now + PEER_LEASE_SECONDS;
+    timer_wheel_schedule(lease_wheel, &user->lease, (uint64_t)user->lease_expires);
+    return user;
+}
+
+// Gỡ user khỏi bảng; link là liên kết đang trỏ vào nó. Caller giữ connected_users_mutex.
+static void unlink_connected_user_locked(ConnectedUser** link) {
+    ConnectedUser* user = *link;
+    *link = user->next;
+    connected_count--;
+    timer_wheel_cancel(&user->lease);
+    slab_free(connected_slab, user);
+    __atomic_store_n(&connected_users_dirty, 1, __ATOMIC_RELEASE);
+}
+
+// Peer còn sống nếu đã gửi LOGIN/HEARTBEAT trong khoảng lease
+static int lease_alive(const ConnectedUser* user, time_t now) {
+    return user->lease_expires > now;
+}
+
+void add_connected_user(const char* email, const char* ip, int port) {
+    if (!email || !ip) return;
+    uint32_t user_id = user_table_id(user_table, email);
+    if (user_id == 0) return;
     
-    // Add to the beginning of the list
-    new_file->next = files;
-    files = new_file;
+    pthread_mutex_lock(&connected_users_mutex);
+    time_t now = time(NULL);
+    int added = 0;
+    ConnectedUser* user = touch_connected_user_locked(user_id, email, ip, port, now, &added);
+    if (user) {
+        user->connect_time = now;  // đăng nhập lại tính là một kết nối mới
+    }
+    pthread_mutex_unlock(&connected_users_mutex);
+    if (!user) return;
     
-    pthread_mutex_unlock(&files_mutex);
-    save_shared_files();
+    printf("[INFO] User %s connected from %s:%d\n", email, ip, port);
+    __atomic_store_n(&connected_users_dirty, 1, __ATOMIC_RELEASE);
 }
 
-int unpublish_file(const char* filehash, const char* owner_email) {
-    pthread_mutex_lock(&files_mutex);
+int renew_peer_lease(const char* email, const char* ip, int port, int active_uploads) {
+    if (!email || !ip) return -1;
+    uint32_t user_id = user_table_id(user_table, email);
+    if (user_id == 0) return -1;
     
-    SharedFile* current = files;
-    SharedFile* prev = NULL;
-    int file_removed = 0;
+    pthread_mutex_lock(&connected_users_mutex);
+    int added = 0;
+    ConnectedUser* user = touch_connected_user_locked(user_id, email, ip, port, time(NULL), &added);
+    if (user) {
+        user->active_uploads = active_uploads > 0 ? active_uploads : 0;
+    }
+    pthread_mutex_unlock(&connected_users_mutex);
+    if (!user) return -1;
     
-    while (current) {
-        if (strcmp(current->filehash, filehash) == 0 &&
-            strcmp(current->owner_email, owner_email) == 0) {
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                files = current->next;
-            }
-            SharedFile* to_delete = current;
-            current = current->next;
-            free(to_delete);
-            file_removed = 1;
-        } else {
-            prev = current;
-            current = current->next;
-        }
+    if (added) {
+        // Lease đã hết nhưng peer vẫn sống: đưa nó trở lại danh sách
+        printf("[INFO] User %s is back at %s:%d\n", email, ip, port);
+        __atomic_store_n(&connected_users_dirty, 1, __ATOMIC_RELEASE);
     }
+    return !added;
+}
+
+void remove_connected_user(const char* email) {
+    uint32_t user_id = email ? user_table_id(user_table, email) : 0;
+    if (user_id == 0) return;
     
-    pthread_mutex_unlock(&files_mutex);
-    if (file_removed) {
-        save_shared_files(); 
+    pthread_mutex_lock(&connected_users_mutex);
+    
+    ConnectedUser** link = find_connected_link(user_id);
+    if (*link) {
+        unlink_connected_user_locked(link);
+        printf("[INFO] User %s disconnected\n", email);
     }
     
-    return file_removed;
+    pthread_mutex_unlock(&connected_users_mutex);
 }
 
+static void evict_expired_peer(TimerEntry* entry, void* ctx) {
+    ConnectedUser* user = (ConnectedUser*)((char*)entry - offsetof(ConnectedUser, lease));
+    time_t now = *(const time_t*)ctx;
+    printf("[INFO] Lease expired for %s (%s:%d, last heartbeat %lds ago)\n",
+           user->email, user->ip, user->port, (long)(now - (user->lease_expires - PEER_LEASE_SECONDS)));
+    unlink_connected_user_locked(find_connected_link(user->user_id));
+}
 
+int expire_peer_leases(void) {
+    pthread_mutex_lock(&connected_users_mutex);
+    time_t now = time(NULL);
+    size_t expired = timer_wheel_advance(lease_wheel, (uint64_t)now, evict_expired_peer, &now);
+    pthread_mutex_unlock(&connected_users_mutex);
+    return (int)expired;
+}
 
-char* create_session(const char* email) {
-    pthread_mutex_lock(&sessions_mutex);
+int is_user_already_connected(const char* email) {
+    uint32_t user_id = email ? user_table_id(user_table, email) : 0;
+    if (user_id == 0) return 0;
     
-    static char token[64];
-    snprintf(token, sizeof(token), "token_%ld_%s", time(NULL), email);
+    pthread_mutex_lock(&connected_users_mutex);
+    ConnectedUser* user = *find_connected_link(user_id);
+    int connected = user && lease_alive(user, time(NULL));
+    pthread_mutex_unlock(&connected_users_mutex);
+    return connected;
+}
+
+// ----------------------------------------------------------------
+//                          CHỨC NĂNG LOGIC SERVER
+// ----------------------------------------------------------------
+
+int get_username_by_email(const char* email, char* username_out) {
+    return user_table_get_username(user_table, email, username_out);
+}
+
+int get_file_owner_info(const char* filehash, char* ip, int* port) {
+    unsigned char hash[FILE_HASH_BYTES];
+    if (!filehash || !parse_filehash(filehash, hash)) return 0;
+    int found = 0;
     
-    Session* new_session = (Session*)malloc(sizeof(Session));
-    strcpy(new_session->token, token);
-    strcpy(new_session->email, email);
-    new_session->login_time = time(NULL);
-    new_session->next = sessions;
-    sessions = new_session;
+    epoch_enter();
+    pthread_mutex_lock(&connected_users_mutex);
     
-    pthread_mutex_unlock(&sessions_mutex);
+    SharedFile* file = file_index_find(file_index, hash);
+    const OwnerSet* owners = file ? __atomic_load_n(&file->owners, __ATOMIC_ACQUIRE) : NULL;
+    time_t now = time(NULL);
+    for (int i = 0; owners && i < owners->count && !found; i++) {
+        ConnectedUser* user = *find_connected_link(owners->ids[i]);
+        if (user && lease_alive(user, now)) {
+            strncpy(ip, user->ip, MAX_IP - 1);
+            *port = user->port;
+            found = 1;
+        }
+    }
     
-    char* result = (char*)malloc(64);
-    strcpy(result, token);
-    return result;
+    pthread_mutex_unlock(&connected_users_mutex);
+    epoch_exit();
+    return found;
 }
 
-int verify_token(const char* token, const char* email) {
-    if (!token || strlen(token) == 0) {
+int add_user(const char* email, const char* username, const char* password) {
+    if (!user_table_insert(user_table, email, username, password)) {
         return 0;
     }
-    
-    pthread_mutex_lock(&sessions_mutex);
-    
-    Session* current = sessions;
-    while (current) {
-        if (strcmp(current->token, token) == 0 && 
-            strcmp(current->email, email) == 0) {
-            
-            // Check if session expired
-            time_t now = time(NULL);
-            if (now - current->login_time > SESSION_TIMEOUT) {
-                pthread_mutex_unlock(&sessions_mutex);
-                return 0;
-            }
-            
-            pthread_mutex_unlock(&sessions_mutex);
-            return 1;
-        }
-        current = current->next;
+
+    WalRecord record = { .len = 0 };
+    record_put_str(&record, email);
+    record_put_str(&record, username);
+    record_put_str(&record, password);
+    commit_mutation(log_mutation(&record, WAL_ADD_USER));
+    return 1;
+}
+
+int authenticate(const char* email, const char* password) {
+    return user_table_check_password(user_table, email, password);
+}
+
+void publish_file(const char* filename, const char* filehash, const char* owner_email,
+                 long file_size, int chunk_size) {
+    if (!filename || !filehash || !owner_email) {
+        return;
     }
-    
-    pthread_mutex_unlock(&sessions_mutex);
-    return 0;
+
+    WalRecord record = { .len = 0 };
+    record_put_str(&record, filename);
+    record_put_str(&record, filehash);
+    record_put_str(&record, owner_email);
+    record_put_i64(&record, file_size);
+    record_put_i64(&record, chunk_size);
+
+    // Ghi log trong files_mutex để thứ tự trong log khớp thứ tự áp dụng
+    uint64_t ticket = 0;
+    pthread_mutex_lock(&files_mutex);
+    if (upsert_file_locked(filename, filehash, owner_email, file_size, chunk_size)) {
+        ticket = log_mutation(&record, WAL_PUBLISH);
+    }
+    pthread_mutex_unlock(&files_mutex);
+    commit_mutation(ticket);
 }
 
-void destroy_session(const char* token) {
-    pthread_mutex_lock(&sessions_mutex);
-    
-    Session* current = sessions;
-    Session* prev = NULL;
-    
-    while (current) {
-        if (strcmp(current->token, token) == 0) {
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                sessions = current->next;
-            }
-            free(current);
-            break;
-        }
-        prev = current;
-        current = current->next;
+void set_catalog_listener(CatalogListener listener) {
+    catalog_listener = listener;
+}
+
+int unpublish_file(const char* filehash, const char* owner_email) {
+    uint64_t ticket = 0;
+    pthread_mutex_lock(&files_mutex);
+    int file_removed = remove_file_locked(filehash, owner_email);
+    if (file_removed) {
+        WalRecord record = { .len = 0 };
+        record_put_str(&record, filehash);
+        record_put_str(&record, owner_email);
+        ticket = log_mutation(&record, WAL_UNPUBLISH);
     }
+    pthread_mutex_unlock(&files_mutex);
+    commit_mutation(ticket);
     
-    pthread_mutex_unlock(&sessions_mutex);
+    return file_removed;
 }
 
-int is_file_owner(const char* filehash, const char* email) {
-    pthread_mutex_lock(&files_mutex);
+char* create_session(const char* email) {
+    char* token = (char*)malloc(SESSION_TOKEN_SIZE);
+    if (!token) return NULL;
     
-    SharedFile* current = files;
-    while (current) {
-        if (strcmp(current->filehash, filehash) == 0) {
-            int is_owner = (strcmp(current->owner_email, email) == 0);
-            pthread_mutex_unlock(&files_mutex);
-            return is_owner;
-        }
-        current = current->next;
+    if (!session_table_open(session_table, email, token)) {
+        free(token);
+        return NULL;
     }
-    
-    pthread_mutex_unlock(&files_mutex);
-    return 0;
+    return token;
+}
+
+int verify_token(const char* token, const char* email) {
+    if (!token || strlen(token) == 0) {
+        return 0;
+    }
+    return session_table_verify(session_table, token, email);
+}
+
+void destroy_session(const char* token) {
+    session_table_close(session_table, token);
+}
+
+// Gọi định kỳ: xóa các phiên đã hết hạn
+int expire_sessions(void) {
+    return session_table_expire(session_table, time(NULL));
+}
+
+int is_file_owner(const char* filehash, const char* email) {
+    unsigned char hash[FILE_HASH_BYTES];
+    uint32_t owner = email ? user_table_id(user_table, email) : 0;
+    if (!filehash || !parse_filehash(filehash, hash) || owner == 0) return 0;
+
+    epoch_enter();
+    SharedFile* file = file_index_find(file_index, hash);
+    int is_owner = file && owner_set_contains(__atomic_load_n(&file->owners, __ATOMIC_ACQUIRE), owner);
+    epoch_exit();
+    return is_owner;
+}
+
+int validate_filehash(const char* filehash) {
+    unsigned char hash[FILE_HASH_BYTES];
+    return filehash && parse_filehash(filehash, hash);
 }
 
 int validate_email(const char* email) {
@@ -603,7 +1287,68 @@ int validate_filename(const char* filename) {
     return 1;
 }
 
-SearchResponse search_files(const char* keyword) {
+static void fill_file_info(SearchFileInfo* info, const SharedFile* file) {
+    strcpy(info->filename, file->filename);
+    format_filehash(file->hash, info->filehash);
+    info->file_size = file->file_size;
+    info->chunk_size = file->chunk_size;
+    uint64_t downloads = __atomic_load_n(&file->downloads, __ATOMIC_RELAXED);
+    uint64_t completed = __atomic_load_n(&file->completed, __ATOMIC_RELAXED);
+    info->popularity = (float)downloads / POPULARITY_ONE;
+    info->success_rate = downloads ? (float)completed / (float)downloads : 0.0f;
+    if (info->success_rate > 1.0f) info->success_rate = 1.0f;
+}
+
+// Một trang kết quả file đang được điền (SEARCH hoặc BROWSE)
+typedef struct {
+    SearchFileInfo* files;
+    int count;
+    int limit;
+    int dedup;         // SEARCH: chỉ mục có thể trả về cả bản cũ lẫn bản mới
+    uint64_t last_id;  // search_id của file cuối trong trang
+    int more;          // còn file sau trang này
+} FilePage;
+
+static int page_limit(int limit, int max) {
+    return (limit <= 0 || limit > max) ? max : limit;
+}
+
+// Thêm file vào trang; trả về 0 khi trang đã đầy. Một file thừa ra chỉ để
+// biết còn trang sau hay không.
+// Mỗi filehash chỉ có một bản ghi, nhưng khi bản ghi đang được thay thế
+// chỉ mục tìm kiếm có thể trả về cả bản cũ lẫn bản mới.
+static int collect_page_file(SharedFile* file, void* ctx) {
+    FilePage* page = (FilePage*)ctx;
+    if (page->count == page->limit) {
+        page->more = 1;
+        return 0;
+    }
+
+    if (page->dedup) {
+        char filehash[MAX_HASH];
+        format_filehash(file->hash, filehash);
+        for (int i = 0; i < page->count; i++) {
+            if (strcmp(page->files[i].filehash, filehash) == 0) {
+                return 1;
+            }
+        }
+    }
+
+    fill_file_info(&page->files[page->count++], file);
+    page->last_id = file->search_id;
+    return 1;
+}
+
+// Trang tiếp theo bắt đầu ngay dưới file cuối của trang này
+static ResultCursor page_next_cursor(const FilePage* page) {
+    ResultCursor next = {0, 0};
+    if (page->more) {
+        next.id = page->last_id;
+    }
+    return next;
+}
+
+SearchResponse search_files(const char* keyword, ResultCursor cursor, int limit) {
     SearchResponse response;
     memset(&response, 0, sizeof(SearchResponse));
     
@@ -612,40 +1357,15 @@ SearchResponse search_files(const char* keyword) {
     response.status = RESP_SUCCESS;
     response.count = 0;
     
-    pthread_mutex_lock(&files_mutex);
-    
-    SharedFile* current = files;
-    char seen_hashes[100][MAX_HASH];
-    int seen_count = 0;
-    
-    while (current && response.count < 100) {
-        if (strstr(current->filename, keyword) != NULL) {
-            
-            // Chỉ thêm hash nếu chưa thấy
-            int already_added = 0;
-            for (int i = 0; i < seen_count; i++) {
-                if (strcmp(seen_hashes[i], current->filehash) == 0) {
-                    already_added = 1;
-                    break;
-                }
-            }
-            
-            if (!already_added) {
-                strcpy(response.files[response.count].filename, current->filename);
-                strcpy(response.files[response.count].filehash, current->filehash);
-                response.files[response.count].file_size = current->file_size;
-                response.files[response.count].chunk_size = current->chunk_size;
-                
-                strcpy(seen_hashes[seen_count], current->filehash);
-                seen_count++;
-                response.count++;
-            }
-        }
-        current = current->next;
-    }
+    FilePage page = {response.files, 0, 0, 1, 0, 0};
+    page.limit = page_limit(limit, (int)(sizeof(response.files) / sizeof(response.files[0])));
     
-    pthread_mutex_unlock(&files_mutex);
+    epoch_enter();
+    search_index_query(search_index, keyword, cursor.id, collect_page_file, &page);
+    epoch_exit();
     
+    response.count = page.count;
+    response.next_cursor = page_next_cursor(&page);
     if (response.count == 0) {
         response.status = RESP_NOT_FOUND;
     }
@@ -653,60 +1373,437 @@ SearchResponse search_files(const char* keyword) {
     return response;
 }
 
-SearchResponse browse_all_files(void) {
-    SearchResponse response;
-    memset(&response, 0, sizeof(SearchResponse));
+typedef struct {
+    SharedFile* file;
+    uint64_t downloads;
+    uint64_t id;
+} PopularFile;
 
-    response.header.command = CMD_BROWSE_FILES;
-    response.status = RESP_SUCCESS;
-    response.count = 0;
+// Thứ tự BROWSE_POPULAR: tải nhiều hơn trước, bằng nhau thì mới hơn trước
+static int popular_before(uint64_t downloads_a, uint64_t id_a, uint64_t downloads_b, uint64_t id_b) {
+    return downloads_a != downloads_b ? downloads_a > downloads_b : id_a > id_b;
+}
 
-    pthread_mutex_lock(&files_mutex);
+// Đẩy top[i] xuống đúng chỗ trong min-heap (phần tử đứng sau cùng ở gốc)
+static void popular_sift_down(PopularFile* top, int count, int i) {
+    while (1) {
+        int last = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < count && popular_before(top[last].downloads, top[last].id, top[left].downloads, top[left].id)) {
+            last = left;
+        }
+        if (right < count && popular_before(top[last].downloads, top[last].id, top[right].downloads, top[right].id)) {
+            last = right;
+        }
+        if (last == i) return;
+        PopularFile tmp = top[i];
+        top[i] = top[last];
+        top[last] = tmp;
+        i = last;
+    }
+}
 
-    SharedFile* current = files;
+// Con trỏ trang BROWSE_POPULAR: 16 bit cao của key là popularity_generation
+// lúc tạo, phần còn lại là downloads của file cuối trang. Các bộ đếm đã bị
+// làm mờ từ đó nên downloads trong con trỏ cũng được làm mờ bấy nhiêu lần.
+#define POPULAR_CURSOR_BITS 48
+#define POPULAR_CURSOR_MASK (((uint64_t)1 << POPULAR_CURSOR_BITS) - 1)
 
-    // Tránh trùng filehash
-    char seen_hashes[100][MAX_HASH];
-    int seen_count = 0;
+static uint64_t popular_cursor_downloads(ResultCursor cursor) {
+    uint64_t downloads = cursor.key & POPULAR_CURSOR_MASK;
+    uint16_t made = (uint16_t)(cursor.key >> POPULAR_CURSOR_BITS);
+    uint16_t steps = (uint16_t)(__atomic_load_n(&popularity_generation, __ATOMIC_ACQUIRE) - made);
+    for (; steps > 0 && downloads > 0; steps--) {
+        uint64_t drop = downloads >> POPULARITY_DECAY_SHIFT;
+        downloads -= drop ? drop : 1;
+    }
+    return downloads;
+}
 
-    while (current && response.count < 100) {
+// limit file được tải nhiều nhất xếp sau con trỏ: một lượt qua catalog với
+// min-heap cỡ limit + 1, O(n log limit). Caller đang trong epoch.
+static void collect_popular_files(BrowseFilesResponse* response, int limit, ResultCursor cursor) {
+    PopularFile top[sizeof(response->files) / sizeof(response->files[0]) + 1];
+    int keep = limit + 1;  // thêm một để biết còn trang sau
+    int count = 0;
+    int resume = cursor.id != 0;
+    uint64_t cursor_downloads = resume ? popular_cursor_downloads(cursor) : 0;
 
-        int already_added = 0;
-        for (int i = 0; i < seen_count; i++) {
-            if (strcmp(seen_hashes[i], current->filehash) == 0) {
-                already_added = 1;
-                break;
+    SharedFile* current = __atomic_load_n(&files, __ATOMIC_ACQUIRE);
+    for (; current; current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE)) {
+        PopularFile entry = {current, __atomic_load_n(&current->downloads, __ATOMIC_RELAXED), current->search_id};
+        if (entry.downloads == 0) continue;
+        if (resume && !popular_before(cursor_downloads, cursor.id, entry.downloads, entry.id)) continue;
+        if (count < keep) {
+            // Đẩy lên từ cuối heap
+            int i = count++;
+            while (i > 0 && popular_before(top[(i - 1) / 2].downloads, top[(i - 1) / 2].id, entry.downloads, entry.id)) {
+                top[i] = top[(i - 1) / 2];
+                i = (i - 1) / 2;
             }
+            top[i] = entry;
+        } else if (popular_before(entry.downloads, entry.id, top[0].downloads, top[0].id)) {
+            top[0] = entry;
+            popular_sift_down(top, count, 0);
         }
+    }
+
+    // Lấy dần phần tử đứng sau cùng ra cuối mảng: top[] thành đúng thứ tự
+    for (int end = count - 1; end > 0; end--) {
+        PopularFile tmp = top[0];
+        top[0] = top[end];
+        top[end] = tmp;
+        popular_sift_down(top, end, 0);
+    }
+    int shown = count < limit ? count : limit;
+    for (int i = 0; i < shown; i++) {
+        fill_file_info(&response->files[response->count++], top[i].file);
+    }
+    if (count > limit) {
+        const PopularFile* last = &top[limit - 1];
+        uint64_t downloads = last->downloads < POPULAR_CURSOR_MASK ? last->downloads : POPULAR_CURSOR_MASK;
+        uint64_t generation = __atomic_load_n(&popularity_generation, __ATOMIC_ACQUIRE) & 0xFFFF;
+        response->next_cursor.key = (generation << POPULAR_CURSOR_BITS) | downloads;
+        response->next_cursor.id = last->id;
+    }
+}
 
-        if (!already_added) {
-            strncpy(response.files[response.count].filename,
-                    current->filename, MAX_FILENAME - 1);
-            strncpy(response.files[response.count].filehash,
-                    current->filehash, MAX_HASH - 1);
-            response.files[response.count].file_size = current->file_size;
-            response.files[response.count].chunk_size = current->chunk_size;
+static size_t browse_cache_slot(int order, int limit) {
+    return (size_t)((unsigned)order * 31u + (unsigned)limit) % BROWSE_CACHE_SLOTS;
+}
 
-            strncpy(seen_hashes[seen_count],
-                    current->filehash, MAX_HASH - 1);
+// Dựng trang cho (order, limit, cursor). Phiên bản được đọc trước khi duyệt:
+// thay đổi chen vào giữa chỉ làm trang bị dựng lại sớm, không bao giờ để
+// trang cũ được coi là mới. Caller đang trong epoch.
+static BrowsePage* build_browse_page(int order, int limit, ResultCursor cursor) {
+    BrowsePage* page = (BrowsePage*)calloc(1, sizeof(BrowsePage));
+    if (!page) {
+        perror("Failed to build browse page");
+        return NULL;
+    }
+    page->catalog_version = __atomic_load_n(&catalog_version, __ATOMIC_ACQUIRE);
+    page->popularity_generation = __atomic_load_n(&popularity_generation, __ATOMIC_ACQUIRE);
+    page->order = order;
+    page->limit = limit;
 
-            seen_count++;
-            response.count++;
-        }
+    BrowseFilesResponse* response = &page->response;
+    response->header.command = CMD_BROWSE_FILES;
+    if (order == BROWSE_POPULAR) {
+        collect_popular_files(response, limit, cursor);
+    } else {
+        // Mới nhất trước. Mỗi filehash chỉ có một bản ghi trong danh sách
+        // mọi file nên không cần lọc trùng.
+        FilePage files_page = {response->files, 0, limit, 0, 0, 0};
+        search_index_query(search_index, "", cursor.id, collect_page_file, &files_page);
+        response->count = files_page.count;
+        response->next_cursor = page_next_cursor(&files_page);
+    }
+    response->status = response->count > 0 ? RESP_SUCCESS : RESP_NOT_FOUND;
+    return page;
+}
 
-        current = current->next;
+const BrowsePage* browse_page_acquire(int order, int limit, ResultCursor cursor) {
+    limit = page_limit(limit, (int)(sizeof(((BrowseFilesResponse*)0)->files) / sizeof(SearchFileInfo)));
+    if (order != BROWSE_POPULAR) {
+        order = BROWSE_RECENT;
     }
 
-    pthread_mutex_unlock(&files_mutex);
+    epoch_enter();
 
-    if (response.count == 0) {
-        response.status = RESP_NOT_FOUND;
+    // Chỉ trang đầu được giữ lại: đó là trang ai cũng xem, còn các trang
+    // sau của một lượt duyệt dài chỉ đẩy nó ra khỏi cache
+    int first = cursor.key == 0 && cursor.id == 0;
+    BrowsePage** slot = &browse_cache[browse_cache_slot(order, limit)];
+    BrowsePage* page = first ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+    if (page && page->order == order && page->limit == limit &&
+        page->catalog_version == __atomic_load_n(&catalog_version, __ATOMIC_ACQUIRE) &&
+        page->popularity_generation == __atomic_load_n(&popularity_generation, __ATOMIC_ACQUIRE)) {
+        return page;
     }
 
+    page = build_browse_page(order, limit, cursor);
+    if (!page) {
+        epoch_exit();
+        return NULL;
+    }
+    page->cached = first;
+    if (first) {
+        // Người dựng song song cùng ghi đè ô; trang bị thay chờ người đọc rời epoch
+        epoch_retire(__atomic_exchange_n(slot, page, __ATOMIC_ACQ_REL));
+    }
+    return page;
+}
+
+void browse_page_release(const BrowsePage* page) {
+    if (!page->cached) {
+        free((void*)page);
+    }
+    epoch_exit();
+}
+
+BrowseChangesResponse browse_changes(uint64_t since, int limit) {
+    BrowseChangesResponse response;
+    memset(&response, 0, sizeof(BrowseChangesResponse));
+    response.header.command = CMD_BROWSE_CHANGES;
+    response.status = RESP_SUCCESS;
+    limit = page_limit(limit, (int)(sizeof(response.changes) / sizeof(response.changes[0])));
+
+    pthread_rwlock_rdlock(&change_log_lock);
+    uint64_t version = catalog_version;
+    int logged = since >= change_log_floor && since <= version && version - since <= CHANGE_LOG_SIZE;
+    if (logged) {
+        uint64_t last = version - since > (uint64_t)limit ? since + limit : version;
+        for (uint64_t v = since + 1; v <= last; v++) {
+            const CatalogLogEntry* entry = &change_log[v % CHANGE_LOG_SIZE];
+            CatalogChange* change = &response.changes[response.count++];
+            change->removed = entry->removed;
+            format_filehash(entry->hash, change->file.filehash);
+            if (!entry->removed) {
+                strcpy(change->file.filename, entry->filename);
+                change->file.file_size = entry->file_size;
+                change->file.chunk_size = entry->chunk_size;
+            }
+        }
+        response.catalog_version = last;
+        response.more = last < version;
+    }
+    pthread_rwlock_unlock(&change_log_lock);
+    if (logged) {
+        return response;
+    }
+
+    // Nhật ký không còn từ since: gửi trang đầu của danh sách đầy đủ. Phiên
+    // bản của trang được đọc trước khi duyệt nên các thay đổi sau đó vẫn
+    // được gửi lại lần tới; áp dụng lại chúng theo filehash không sai gì.
+    ResultCursor first = {0, 0};
+    const BrowsePage* page = browse_page_acquire(BROWSE_RECENT, limit, first);
+    if (!page) {
+        response.status = RESP_FAIL;
+        return response;
+    }
+    response.full = 1;
+    response.catalog_version = page->catalog_version;
+    response.next_cursor = page->response.next_cursor;
+    response.count = page->response.count;
+    for (int i = 0; i < page->response.count; i++) {
+        response.changes[i].file = page->response.files[i];
+    }
+    browse_page_release(page);
     return response;
 }
 
-FindResponse find_peers(const char* filehash) {
+// Tra peer ip:port trong số owner của nội dung. Caller giữ connected_users_mutex.
+static ConnectedUser* find_owner_peer_locked(const OwnerSet* owners, const char* ip, int port) {
+    for (int i = 0; owners && i < owners->count; i++) {
+        ConnectedUser* user = *find_connected_link(owners->ids[i]);
+        if (user && user->port == port && strcmp(user->ip, ip) == 0) {
+            return user;
+        }
+    }
+    return NULL;
+}
+
+void record_download_result(const char* filehash, const char* ip, int port, int success,
+                            long bytes, int elapsed_ms) {
+    unsigned char hash[FILE_HASH_BYTES];
+    if (!filehash || !ip || !parse_filehash(filehash, hash)) return;
+
+    epoch_enter();
+
+    SharedFile* file = file_index_find(file_index, hash);
+    if (file) {
+        __atomic_add_fetch(&file->downloads, POPULARITY_ONE, __ATOMIC_RELAXED);
+        if (success) {
+            __atomic_add_fetch(&file->completed, POPULARITY_ONE, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_mutex_lock(&connected_users_mutex);
+    const OwnerSet* owners = file ? __atomic_load_n(&file->owners, __ATOMIC_ACQUIRE) : NULL;
+    ConnectedUser* user = find_owner_peer_locked(owners, ip, port);
+    if (user) {
+        user->success_rate += PEER_STATS_ALPHA * ((success ? 1.0f : 0.0f) - user->success_rate);
+        if (success && bytes > 0 && elapsed_ms > 0) {
+            float sample = (float)bytes * 1000.0f / (float)elapsed_ms;
+            user->throughput = user->throughput == 0.0f
+                ? sample
+                : user->throughput + PEER_STATS_ALPHA * (sample - user->throughput);
+        }
+    }
+
+    pthread_mutex_unlock(&connected_users_mutex);
+    epoch_exit();
+}
+
+// Bớt đi 1/2^shift, ít nhất 1 để bộ đếm nhỏ cũng về 0. Lượt tải cộng thêm
+// cùng lúc không bị mất vì chỉ trừ, không ghi đè.
+static void decay_counter(uint64_t* counter) {
+    uint64_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    if (value > 0) {
+        uint64_t drop = value >> POPULARITY_DECAY_SHIFT;
+        __atomic_sub_fetch(counter, drop ? drop : 1, __ATOMIC_RELAXED);
+    }
+}
+
+void decay_popularity(void) {
+    static time_t last_decay = 0;  // chỉ luồng bảo trì gọi
+    time_t now = time(NULL);
+    if (last_decay == 0) {
+        last_decay = now;
+    }
+    if (now - last_decay < POPULARITY_DECAY_SECONDS) return;
+    last_decay = now;
+
+    epoch_enter();
+    SharedFile* current = __atomic_load_n(&files, __ATOMIC_ACQUIRE);
+    for (; current; current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE)) {
+        decay_counter(&current->downloads);
+        decay_counter(&current->completed);
+    }
+    epoch_exit();
+    __atomic_add_fetch(&popularity_generation, 1, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+    PeerInfo peer;
+    uint32_t addr;      // peer.ip dạng số, khóa băm khi lọc trùng
+    uint32_t user_id;
+    uint64_t position;  // tầng (xem peer_tier) rồi key ngẫu nhiên; nhỏ trước
+} RankedPeer;
+
+int add_site_prefix(const char* cidr) {
+    char network[MAX_IP];
+    int bits = 0;
+    char extra;
+    if (site_count == MAX_SITES ||
+        sscanf(cidr, "%15[0-9.]/%d%c", network, &bits, &extra) != 2 || bits < 0 || bits > 32) {
+        return 0;
+    }
+
+    struct in_addr addr;
+    if (inet_pton(AF_INET, network, &addr) != 1) {
+        return 0;
+    }
+    uint32_t mask = bits == 0 ? 0 : 0xFFFFFFFFu << (32 - bits);
+    sites[site_count].network = ntohl(addr.s_addr) & mask;
+    sites[site_count].mask = mask;
+    site_count++;
+    return 1;
+}
+
+void set_site_only(int enabled) {
+    site_only = enabled;
+}
+
+// Site chứa addr, -1 nếu không thuộc site nào. Prefix dài nhất thắng.
+static int site_of(uint32_t addr) {
+    int best = -1;
+    for (int i = 0; i < site_count; i++) {
+        if ((addr & sites[i].mask) == sites[i].network &&
+            (best < 0 || sites[i].mask > sites[best].mask)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// 0 = cùng /24 với requester, 1 = cùng site, 2 = nơi khác
+static int peer_tier(uint32_t peer, uint32_t requester, int requester_site) {
+    if (requester && (peer & 0xFFFFFF00u) == (requester & 0xFFFFFF00u)) {
+        return 0;
+    }
+    if (requester_site >= 0 && site_of(peer) == requester_site) {
+        return 1;
+    }
+    return 2;
+}
+
+// Bộ sinh số giả ngẫu nhiên xorshift64*, đủ cho việc xếp hạng; state khác 0
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Số ngẫu nhiên trong (0, 1] của một peer trong một lượt FIND: chỉ phụ
+// thuộc seed và user id (splitmix64), nên peer khác vào/ra không làm đổi nó
+static double peer_random(uint32_t seed, uint32_t user_id) {
+    uint64_t z = ((uint64_t)seed << 32 | user_id) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return ((z >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+// Seed cho thứ tự của một lượt FIND mới; mỗi luồng một bộ sinh riêng
+static uint32_t new_ranking_seed(void) {
+    static __thread uint64_t state = 0;
+    if (state == 0) {
+        state = ((uint64_t)time(NULL) << 32) ^ (uint64_t)(uintptr_t)&state ^ 0x9E3779B97F4A7C15ULL;
+    }
+    uint32_t seed = (uint32_t)(next_random(&state) >> 32);
+    return seed ? seed : 1;
+}
+
+// Vị trí của peer trong thứ tự: tầng ở 32 bit cao, key (lớn trước) ở 32
+// bit thấp. key được làm tròn về float để vị trí vừa trong cursor.
+static uint64_t rank_position(int tier, double key) {
+    float f = (float)key;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    // Thứ tự số thực -> thứ tự số nguyên không dấu, rồi đảo để key lớn đứng trước
+    uint32_t ascending = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+    return (uint64_t)tier << 32 | (uint32_t)~ascending;
+}
+
+static int rank_tier(uint64_t position) {
+    return (int)(position >> 32);
+}
+
+// Peer nhanh, ít lỗi và đang ít người tải được ưu tiên.
+// Peer chưa có số đo tốc độ được coi như tốc độ trung bình của các peer còn lại.
+static double peer_weight(const ConnectedUser* user, double default_throughput) {
+    double success = user->success_rate > PEER_MIN_SUCCESS ? user->success_rate : PEER_MIN_SUCCESS;
+    double throughput = user->throughput > 0.0f ? user->throughput : default_throughput;
+    return success * success * throughput / (1.0 + user->active_uploads);
+}
+
+// Gần trước, trong cùng tầng thì key lớn trước; user id phân định các key bằng nhau
+static int compare_ranked_peers(const void* a, const void* b) {
+    const RankedPeer* pa = (const RankedPeer*)a;
+    const RankedPeer* pb = (const RankedPeer*)b;
+    if (pa->position != pb->position) {
+        return pa->position < pb->position ? -1 : 1;
+    }
+    return (pa->user_id > pb->user_id) - (pa->user_id < pb->user_id);
+}
+
+// Cursor của FIND: key = seed << 32 | user id, id = vị trí của peer cuối trang
+static int ranked_after_cursor(const RankedPeer* peer, ResultCursor cursor) {
+    uint32_t last_user = (uint32_t)cursor.key;
+    return peer->position > cursor.id ||
+           (peer->position == cursor.id && peer->user_id > last_user);
+}
+
+// Ghi nhận ranked[i] vào bảng băm địa chỉ mở các ip:port đã gặp (ô giữ
+// chỉ số + 1, 0 = trống). Trả về 0 nếu một peer đứng trước có cùng ip:port.
+static int remember_peer(uint32_t* seen, size_t mask, const RankedPeer* ranked, int i) {
+    uint32_t key[2] = { ranked[i].addr, (uint32_t)ranked[i].peer.port };
+    size_t slot = (size_t)hash_bytes(key, sizeof(key)) & mask;
+    while (seen[slot] != 0) {
+        const RankedPeer* other = &ranked[seen[slot] - 1];
+        if (other->peer.port == ranked[i].peer.port && strcmp(other->peer.ip, ranked[i].peer.ip) == 0) {
+            return 0;
+        }
+        slot = (slot + 1) & mask;
+    }
+    seen[slot] = (uint32_t)i + 1;
+    return 1;
+}
+
+FindResponse find_peers(const char* filehash, const char* requester_ip, ResultCursor cursor, int limit) {
     FindResponse resp;
     memset(&resp, 0, sizeof(FindResponse));
     
@@ -715,72 +1812,98 @@ FindResponse find_peers(const char* filehash) {
     resp.status = RESP_SUCCESS;
     resp.count = 0;
     
-    if (!filehash) {
+    unsigned char hash[FILE_HASH_BYTES];
+    if (!filehash || !parse_filehash(filehash, hash)) {
         resp.status = RESP_NOT_FOUND;
         return resp;
     }
 
-    char seen_peers[10][MAX_IP + 6] = {0}; 
-    int seen_count = 0;
-    
-    char owner_emails[10][MAX_EMAIL] = {0};
-    int owner_count = 0;
+    limit = page_limit(limit, (int)(sizeof(resp.peers) / sizeof(resp.peers[0])));
+    // Các trang sau giữ seed của trang đầu và bắt đầu ngay sau peer cuối
+    // của trang trước (keyset), nên peer vào/ra giữa hai trang không làm
+    // lặp hay sót các peer khác
+    int first_page = cursor.key == 0 && cursor.id == 0;
+    uint32_t seed = first_page ? new_ranking_seed() : (uint32_t)(cursor.key >> 32);
+    uint32_t requester = requester_ip ? parse_ipv4(requester_ip) : 0;
+    int requester_site = requester ? site_of(requester) : -1;
+    
+    epoch_enter();
+    pthread_mutex_lock(&connected_users_mutex);
     
-    pthread_mutex_lock(&files_mutex);
-    SharedFile* current = files;
-    
-    while (current && owner_count < 10) {
-        if (strcmp(current->filehash, filehash) == 0) {
-            int already_added = 0;
-            for (int i = 0; i < owner_count; i++) {
-                if (strcmp(owner_emails[i], current->owner_email) == 0) {
-                    already_added = 1;
-                    break;
-                }
-            }
-            
-            if (!already_added) {
-                strncpy(owner_emails[owner_count], current->owner_email, MAX_EMAIL - 1);
-                owner_count++;
+    SharedFile* file = file_index_find(file_index, hash);
+    const OwnerSet* owners = file ? __atomic_load_n(&file->owners, __ATOMIC_ACQUIRE) : NULL;
+    
+    RankedPeer* ranked = owners ? (RankedPeer*)malloc(owners->count * sizeof(RankedPeer)) : NULL;
+    ConnectedUser** live = owners ? (ConnectedUser**)malloc(owners->count * sizeof(ConnectedUser*)) : NULL;
+    int live_count = 0;
+    
+    if (ranked && live) {
+        // Peer hết lease nhưng chưa bị luồng bảo trì gỡ cũng bị bỏ qua
+        time_t now = time(NULL);
+        double throughput_sum = 0;
+        int measured = 0;
+        for (int i = 0; i < owners->count; i++) {
+            ConnectedUser* user = *find_connected_link(owners->ids[i]);
+            if (!user || !lease_alive(user, now)) continue;
+            live[live_count++] = user;
+            if (user->throughput > 0.0f) {
+                throughput_sum += user->throughput;
+                measured++;
             }
         }
-        current = current->next;
+        
+        // Thứ tự ngẫu nhiên có trọng số (Efraimidis-Spirakis): peer tốt
+        // thường đứng đầu nhưng các lượt FIND liên tiếp không dồn cả vào
+        // một seeder
+        double default_throughput = measured ? throughput_sum / measured : 1.0;
+        for (int i = 0; i < live_count; i++) {
+            ranked[i].peer.port = live[i]->port;
+            strcpy(ranked[i].peer.ip, live[i]->ip);
+            ranked[i].addr = live[i]->addr;
+            ranked[i].user_id = live[i]->user_id;
+            double key = log(peer_random(seed, live[i]->user_id)) / peer_weight(live[i], default_throughput);
+            ranked[i].position = rank_position(peer_tier(live[i]->addr, requester, requester_site), key);
+        }
     }
-    pthread_mutex_unlock(&files_mutex);  
     
-    pthread_mutex_lock(&connected_users_mutex);
-    for (int i = 0; i < owner_count && resp.count < 10; i++) {
-        ConnectedUser* user = connected_users;
-        while (user) {
-            if (strcmp(user->email, owner_emails[i]) == 0) {
-                char peer_key[MAX_IP + 6];
-                snprintf(peer_key, sizeof(peer_key), "%s:%d", user->ip, user->port);
-                
-                int already_added = 0;
-                for (int j = 0; j < seen_count; j++) {
-                    if (strcmp(seen_peers[j], peer_key) == 0) {
-                        already_added = 1;
-                        break;
-                    }
-                }
-                
-                if (!already_added) {
-                    strncpy(resp.peers[resp.count].ip, user->ip, MAX_IP - 1);
-                    resp.peers[resp.count].port = user->port;
-                    strncpy(seen_peers[seen_count], peer_key, sizeof(seen_peers[0]) - 1);
-                    seen_count++;
-                    resp.count++;
-                }
-                break;  
+    pthread_mutex_unlock(&connected_users_mutex);
+    epoch_exit();
+    
+    if (live_count > 1) {
+        qsort(ranked, live_count, sizeof(RankedPeer), compare_ranked_peers);
+    }
+    // --site-only: peer ở nơi khác chỉ được trả về khi không có peer nào gần
+    int max_tier = (site_only && live_count > 0 && rank_tier(ranked[0].position) < 2) ? 1 : 2;
+    // Duyệt thứ tự đến hết trang này và thêm một peer để biết còn trang sau.
+    // Hai tài khoản có thể chạy trên cùng một peer: chỉ tài khoản đứng trước
+    // được tính, dù nó ở trang trước, nên các peer trước cursor vẫn được ghi
+    // nhận (O(1) mỗi peer) dù không được trả về.
+    size_t seen_cap = hash_capacity_for((size_t)live_count * 2);
+    uint32_t* seen = live_count > 0 ? (uint32_t*)calloc(seen_cap, sizeof(uint32_t)) : NULL;
+    const RankedPeer* last = NULL;
+    int on_page = 0;
+    for (int i = 0; seen && i < live_count && on_page <= limit && rank_tier(ranked[i].position) <= max_tier; i++) {
+        if (!remember_peer(seen, seen_cap - 1, ranked, i)) {
+            continue;
+        }
+        if (first_page || ranked_after_cursor(&ranked[i], cursor)) {
+            if (on_page++ < limit) {
+                resp.peers[resp.count++] = ranked[i].peer;
+                last = &ranked[i];
             }
-            user = user->next;
         }
     }
-    pthread_mutex_unlock(&connected_users_mutex);
+    if (on_page > limit) {
+        resp.next_cursor.key = (uint64_t)seed << 32 | last->user_id;
+        resp.next_cursor.id = last->position;
+    }
+    free(seen);
+    free(ranked);
+    free(live);
     
     if (resp.count == 0) {
         resp.status = RESP_NOT_FOUND;
     }
     
     return resp;
-}
\ No newline at end of file
+}
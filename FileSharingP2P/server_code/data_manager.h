@@ -2,69 +2,126 @@
 #define DATA_MANAGER_H
 
 #include "../protocol.h"
+#include "wal.h"
+#include "timer_wheel.h"
 #include <pthread.h>
+#include <stdint.h>
+
+#define FILE_HASH_BYTES 32  // SHA-256; filehash trên giao thức là 64 ký tự hex
 
 // Định nghĩa cấu trúc dữ liệu cần quản lý
-typedef struct User {
-    char email[MAX_EMAIL];
-    char username[MAX_USERNAME];
-    char password[MAX_PASSWORD];
-    struct User* next;
-} User;
+// (tài khoản người dùng nằm trong UserTable, xem user_table.h)
+
+// Những người đang chia sẻ một nội dung. Không đổi sau khi công bố:
+// thêm/bớt owner sẽ thay cả tập (copy-on-write).
+typedef struct {
+    int count;
+    uint32_t ids[];  // user id trong UserTable, không theo thứ tự
+} OwnerSet;
 
+// Một bản ghi cho mỗi nội dung (filehash), dùng chung bởi mọi owner.
+// Không đổi sau khi công bố trừ con trỏ owners; đổi tên hay kích thước
+// sẽ thay bằng bản ghi mới.
 typedef struct SharedFile {
-    char filename[MAX_FILENAME];
-    char filehash[MAX_HASH];
-    char owner_email[MAX_EMAIL];
+    unsigned char hash[FILE_HASH_BYTES];  // SHA-256 dạng nhị phân
     long file_size;
     int chunk_size;
-    struct SharedFile* next;
+    uint64_t search_id;       // thứ tự publish, dùng bởi chỉ mục tìm kiếm
+    OwnerSet* owners;
+    // Độ phổ biến: số lượt tải được báo về, dấu phẩy tĩnh (POPULARITY_ONE
+    // mỗi lượt) và giảm dần theo thời gian. Cập nhật bằng phép toán nguyên
+    // tử, không cần khóa; được chép sang bản ghi mới khi bản ghi bị thay.
+    uint64_t downloads;
+    uint64_t completed;       // phần trong downloads đã tải xong
+    struct SharedFile* next;  // danh sách catalog, liên kết đôi để gỡ trong O(1)
+    struct SharedFile* prev;
+    char filename[];          // chỉ dài đúng bằng tên
 } SharedFile;
 
+// Phản hồi BROWSE đã dựng sẵn (request_id = 0, người gửi tự điền)
+typedef struct BrowsePage {
+    uint64_t catalog_version;
+    uint64_t popularity_generation;
+    int order;
+    int limit;
+    int cached;  // 0 = trang riêng của một request, được giải phóng khi trả lại
+    BrowseFilesResponse response;
+} BrowsePage;
+
 typedef struct ConnectedUser {
+    uint32_t user_id;
     char email[MAX_EMAIL];
     char ip[MAX_IP];
+    uint32_t addr;               // ip dạng số (host order), để so subnet
     int port;
     time_t connect_time;
-    struct ConnectedUser* next;
+    time_t lease_expires;        // hết hạn nếu không có HEARTBEAT trước thời điểm này
+    TimerEntry lease;            // trong lease_wheel, hẹn giờ gỡ peer
+    // Thống kê để xếp hạng peer trong FIND
+    int active_uploads;          // peer tự báo qua HEARTBEAT
+    float success_rate;          // trung bình trượt kết quả các lần tải từ peer
+    float throughput;            // byte/giây, trung bình trượt; 0 = chưa có số đo
+    struct ConnectedUser* next;  // bucket chain, keyed by user id
 } ConnectedUser;
 
-typedef struct Session {
-    char token[64];
-    char email[MAX_EMAIL];
-    time_t login_time;
-    struct Session* next;
-} Session;
-
 // Các biến global (sẽ được định nghĩa trong data_manager.c)
-extern User* users;
 extern SharedFile* files;
-extern Session* sessions;
-extern ConnectedUser* connected_users;
-extern pthread_mutex_t users_mutex;
-extern pthread_mutex_t files_mutex;
-extern pthread_mutex_t sessions_mutex;
+extern pthread_mutex_t users_mutex;   // serializes rewrites of users.txt
+extern pthread_mutex_t files_mutex;   // serializes catalog writers; readers use epochs (epoch.h)
 extern pthread_mutex_t connected_users_mutex;
 
 // --- Khai báo hàm Lưu/Tải ---
-void load_data();
-void save_users();
-void save_shared_files();
+void load_data(const WalOptions* persistence);
+int save_users();           // text export; returns -1 on error
+int save_shared_files();    // text export; returns -1 on error
+int export_text_data(void); // both of the above
 void save_connected_users();
+void checkpoint_data(void);
+int background_save(void);  // fork a child that writes the snapshot; -1 if it could not start
 
 // --- Connected Users Management ---
 void add_connected_user(const char* email, const char* ip, int port);
 void remove_connected_user(const char* email);
-void cleanup_disconnected_users();
+// HEARTBEAT: 1 = đã gia hạn, 0 = lease đã hết và peer được thêm lại, -1 = lỗi
+int renew_peer_lease(const char* email, const char* ip, int port, int active_uploads);
+// DOWNLOAD_STATUS: ghi nhận một lần tải filehash từ peer ip:port
+void record_download_result(const char* filehash, const char* ip, int port, int success,
+                            long bytes, int elapsed_ms);
+int expire_peer_leases(void);  // gọi định kỳ; trả về số peer bị gỡ
 
 // --- Khai báo các hàm Logic Server ---
 int add_user(const char* email, const char* username, const char* password);
 int authenticate(const char* email, const char* password);
 void publish_file(const char* filename, const char* filehash, const char* owner_email, long file_size, int chunk_size);
 int unpublish_file(const char* filehash, const char* owner_email);
-SearchResponse browse_all_files(void);
-SearchResponse search_files(const char* keyword);
-FindResponse find_peers(const char* filehash);
+// Được gọi trong files_mutex sau mỗi thay đổi catalog, theo đúng thứ tự áp
+// dụng: NOTIFY_PUBLISHED khi file vào catalog dưới tên này, NOTIFY_SEEDERS
+// khi số owner đổi (seeders = 0 nghĩa là file đã bị gỡ). Không được gọi lại
+// các hàm catalog từ trong listener. Đặt một lần lúc khởi động.
+typedef void (*CatalogListener)(const SearchFileInfo* file, int event, int seeders);
+void set_catalog_listener(CatalogListener listener);
+// BROWSE_RECENT: mới công bố trước; BROWSE_POPULAR: tải nhiều gần đây trước.
+// limit <= 0 hoặc quá lớn thì lấy tối đa số file vừa một phản hồi; cursor
+// là next_cursor của trang trước, toàn 0 cho trang đầu.
+// Trang đầu được mã hóa sẵn và dùng lại đến khi catalog đổi hoặc độ phổ
+// biến được làm mờ lần tới. Trả về NULL nếu thiếu bộ nhớ; trang chỉ đọc và
+// phải được trả lại bằng browse_page_release.
+const BrowsePage* browse_page_acquire(int order, int limit, ResultCursor cursor);
+void browse_page_release(const BrowsePage* page);
+// Các thay đổi catalog kể từ phiên bản since, cũ trước. since quá cũ (hoặc 0)
+// thì trả về trang đầu của danh sách BROWSE_RECENT với full = 1.
+BrowseChangesResponse browse_changes(uint64_t since, int limit);
+void decay_popularity(void);  // gọi định kỳ; làm mờ dần độ phổ biến cũ
+// Mới công bố trước, từng trang như BROWSE
+SearchResponse search_files(const char* keyword, ResultCursor cursor, int limit);
+// Peer cùng /24 với requester_ip đứng trước, rồi cùng site, rồi các peer khác.
+// Các trang sau dùng lại thứ tự ngẫu nhiên của trang đầu (seed trong cursor)
+// và tiếp tục sau peer cuối của trang trước. Chỉ peer có số liệu đổi giữa
+// hai trang (HEARTBEAT, DOWNLOAD_STATUS) mới có thể đổi chỗ qua ranh giới trang.
+FindResponse find_peers(const char* filehash, const char* requester_ip, ResultCursor cursor, int limit);
+// Khai báo một site (CIDR, vd 10.1.0.0/16) cho find_peers; 0 nếu không hợp lệ
+int add_site_prefix(const char* cidr);
+void set_site_only(int enabled);  // chỉ trả peer cùng site nếu có
 void ensure_data_files_exist();
 int get_username_by_email(const char* email, char* username_out);
 int get_file_owner_info(const char* filehash, char* ip, int* port);
@@ -75,8 +132,10 @@ int is_user_already_connected(const char* email);
 char* create_session(const char* email);
 int verify_token(const char* token, const char* email);
 void destroy_session(const char* token);
+int expire_sessions(void);
 int is_file_owner(const char* filehash, const char* email);
 int validate_email(const char* email);
 int validate_filename(const char* filename);
+int validate_filehash(const char* filehash);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "epoch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define EPOCH_RECLAIM_THRESHOLD 1024  // retirements that trigger an eager reclaim
+#define CACHE_LINE 64
+
+// One per thread that ever read; never freed, threads are long-lived
+typedef struct EpochRecord {
+    uint64_t epoch;  // epoch seen on entry; 0 while outside
+    int depth;       // nesting, only touched by the owner
+    struct EpochRecord* next;
+} __attribute__((aligned(CACHE_LINE))) EpochRecord;
+
+typedef struct {
+    void* ptr;
+    void (*release)(void* ptr);
+    uint64_t epoch;  // global epoch when it was unlinked
+} Retired;
+
+static uint64_t global_epoch = 1;
+static EpochRecord* records = NULL;
+static __thread EpochRecord* self = NULL;
+
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static Retired* retired = NULL;
+static size_t retired_count = 0;
+static size_t retired_cap = 0;
+
+static EpochRecord* register_thread(void) {
+    EpochRecord* record = NULL;
+    if (posix_memalign((void**)&record, CACHE_LINE, sizeof(EpochRecord)) != 0) {
+        perror("Failed to register reader thread");
+        abort();
+    }
+    record->epoch = 0;
+    record->depth = 0;
+
+    record->next = __atomic_load_n(&records, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&records, &record->next, record, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+    }
+    return record;
+}
+
+void epoch_enter(void) {
+    if (!self) {
+        self = register_thread();
+    }
+    if (self->depth++ > 0) {
+        return;
+    }
+
+    // The store must be visible before any shared pointer is loaded,
+    // otherwise a reclaimer could miss this reader
+    __atomic_store_n(&self->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void) {
+    if (--self->depth > 0) {
+        return;
+    }
+    __atomic_store_n(&self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(void* ptr) {
+    epoch_retire_with(ptr, free);
+}
+
+void epoch_retire_with(void* ptr, void (*release)(void* ptr)) {
+    if (!ptr) return;
+
+    pthread_mutex_lock(&retired_lock);
+    if (retired_count == retired_cap) {
+        size_t capacity = retired_cap ? retired_cap * 2 : EPOCH_RECLAIM_THRESHOLD;
+        Retired* grown = (Retired*)realloc(retired, capacity * sizeof(Retired));
+        if (!grown) {
+            // Cannot defer it; leaking is the only safe choice
+            pthread_mutex_unlock(&retired_lock);
+            perror("Failed to retire object");
+            return;
+        }
+        retired = grown;
+        retired_cap = capacity;
+    }
+    // Order the caller's unlink before reading the epoch it is tagged with
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    retired[retired_count].ptr = ptr;
+    retired[retired_count].release = release;
+    retired[retired_count].epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    retired_count++;
+    int eager = retired_count >= EPOCH_RECLAIM_THRESHOLD && retired_count % EPOCH_RECLAIM_THRESHOLD == 0;
+    pthread_mutex_unlock(&retired_lock);
+
+    if (eager) {
+        epoch_reclaim();
+    }
+}
+
+size_t epoch_reclaim(void) {
+    // Readers entering from now on see the new epoch, so anything retired
+    // earlier is only reachable by readers already inside
+    uint64_t oldest = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    for (EpochRecord* r = __atomic_load_n(&records, __ATOMIC_ACQUIRE); r; r = r->next) {
+        uint64_t e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+        if (e != 0 && e < oldest) {
+            oldest = e;
+        }
+    }
+
+    size_t freed = 0;
+    pthread_mutex_lock(&retired_lock);
+    size_t kept = 0;
+    for (size_t i = 0; i < retired_count; i++) {
+        if (retired[i].epoch < oldest) {
+            retired[i].release(retired[i].ptr);
+            freed++;
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired_count = kept;
+    pthread_mutex_unlock(&retired_lock);
+    return freed;
+}
@@ -0,0 +1,26 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+
+// Epoch-based reclamation for structures read without locks. Readers
+// bracket every access with epoch_enter()/epoch_exit(); writers unlink an
+// object and hand it to epoch_retire() instead of freeing it, and it is
+// freed once every reader that might still hold it has left.
+
+// May nest. A thread registers itself on its first call.
+void epoch_enter(void);
+void epoch_exit(void);
+
+// Free ptr (with free()) once no reader can reach it. NULL is ignored.
+void epoch_retire(void* ptr);
+
+// Same, but hand ptr to release instead of free(), e.g. to return it to
+// a slab. release runs on whichever thread reclaims.
+void epoch_retire_with(void* ptr, void (*release)(void* ptr));
+
+// Advance the epoch and free what no active reader can see; returns how
+// many objects were freed. Called periodically and when retirements pile up.
+size_t epoch_reclaim(void);
+
+#endif
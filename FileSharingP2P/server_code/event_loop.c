@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_EVENTS 256
+
+typedef struct EventLoop {
+    int id;
+    int epfd;
+    int listen_fd;
+    pthread_t thread;
+    const EventLoopHandlers* handlers;
+
+    ConnList idle;
+
+    // Connections whose next request was refused by the worker pool
+    Connection* stall_head;
+
+    // Requests finished by workers, waiting to be written back
+    Mailbox mailbox;
+} EventLoop;
+
+// ----------------------------------------------------------------
+//                          CONNECTION LIFECYCLE
+// ----------------------------------------------------------------
+
+static void loop_close(EventLoop* loop, Connection* conn) {
+    if (conn->closed) return;
+
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn_list_unlink(&loop->idle, conn);
+
+    if (loop->handlers->on_close) {
+        loop->handlers->on_close(conn);
+    }
+    // Workers may still hold requests for it; they drop the last reference
+    conn_close(conn);
+    conn_release(conn);
+}
+
+static void loop_accept(EventLoop* loop) {
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept4(loop->listen_fd, (struct sockaddr*)&addr, &addr_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Accept failed");
+            }
+            return;
+        }
+
+        Connection* conn = conn_create(fd, &addr);
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->loop = loop;
+        conn->mailbox = &loop->mailbox;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl add client");
+            conn_close(conn);
+            conn_release(conn);
+            continue;
+        }
+
+        conn_list_append(&loop->idle, conn);
+
+        printf("[CONNECT] New connection from %s:%d (loop %d, %d client(s))\n",
+               conn->client_ip, conn->client_port, loop->id, loop->idle.count);
+    }
+}
+
+// Flush pending output; closes the connection once a LOGOUT reply is out.
+// Returns -1 if the connection was closed.
+static int loop_flush(EventLoop* loop, Connection* conn) {
+    if (conn_flush(conn) < 0) {
+        printf("[ERROR] send failed: %s\n", strerror(errno));
+        loop_close(loop, conn);
+        return -1;
+    }
+    if (conn->close_after_flush && !conn_has_pending_output(conn)) {
+        loop_close(loop, conn);
+        return -1;
+    }
+    return 0;
+}
+
+// Move a connection forward: write replies, then parse whatever input is
+// buffered or still unread once dispatch is allowed again. Edge-triggered
+// epoll won't report parked input a second time, so it's resumed here.
+static void loop_pump(EventLoop* loop, Connection* conn, int readable) {
+    while (1) {
+        if (loop_flush(loop, conn) < 0) {
+            return;
+        }
+        if (!readable && !(conn->rx_paused && conn_can_dispatch(conn))) {
+            break;
+        }
+        readable = 0;
+
+        if (conn_on_readable(conn, loop->handlers->on_request) < 0) {
+            // Best effort: push out replies to requests already processed
+            conn_flush(conn);
+            loop_close(loop, conn);
+            return;
+        }
+        conn_list_touch(&loop->idle, conn);
+    }
+
+    if (conn->stalled && !conn->in_stall_list) {
+        conn_retain(conn);
+        conn->in_stall_list = 1;
+        conn->stall_next = loop->stall_head;
+        loop->stall_head = conn;
+    }
+}
+
+static void loop_retry_stalled(EventLoop* loop) {
+    Connection* conn = loop->stall_head;
+    loop->stall_head = NULL;
+
+    while (conn) {
+        Connection* next = conn->stall_next;
+        conn->stall_next = NULL;
+        conn->in_stall_list = 0;
+        conn->stalled = 0;
+        if (!conn->closed) {
+            loop_pump(loop, conn, 0);
+        }
+        conn_release(conn);
+        conn = next;
+    }
+}
+
+static void loop_drain_completions(EventLoop* loop) {
+    uint64_t count;
+    if (read(loop->mailbox.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("eventfd read");
+    }
+
+    Request* req = mailbox_take(&loop->mailbox);
+    while (req) {
+        Request* next = req->next;
+        Connection* conn = req->conn;
+
+        if (conn_complete(conn, req)) {
+            loop_pump(loop, conn, 0);
+        } else if (req->login_email[0] != '\0' && loop->handlers->on_close) {
+            // Client left while its login was being processed
+            loop->handlers->on_close(conn);
+        }
+
+        request_free(req);
+        req = next;
+    }
+}
+
+void event_loop_complete(Request* req) {
+    mailbox_post(req->conn->mailbox, req);
+}
+
+static void loop_sweep_idle(EventLoop* loop, time_t now) {
+    while (loop->idle.head &&
+           now - loop->idle.head->last_active > CLIENT_IDLE_TIMEOUT) {
+        Connection* conn = loop->idle.head;
+        printf("[INFO] Closing idle connection %s:%d\n", conn->client_ip, conn->client_port);
+        loop_close(loop, conn);
+    }
+}
+
+static void* loop_main(void* arg) {
+    EventLoop* loop = (EventLoop*)arg;
+    struct epoll_event events[MAX_EVENTS];
+    time_t last_sweep = time(NULL);
+
+    while (1) {
+        int timeout = loop->stall_head ? STALL_RETRY_MS : 1000;
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        // EPOLL_CTL_DEL doesn't take back events already in this batch, so
+        // a connection closed while handling one of them must outlive it
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr != &loop->listen_fd && events[i].data.ptr != &loop->mailbox) {
+                conn_retain((Connection*)events[i].data.ptr);
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &loop->listen_fd) {
+                loop_accept(loop);
+            } else if (events[i].data.ptr == &loop->mailbox) {
+                loop_drain_completions(loop);
+            } else {
+                Connection* conn = (Connection*)events[i].data.ptr;
+                int readable = (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+                if (!conn->closed) {
+                    loop_pump(loop, conn, readable);
+                }
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr != &loop->listen_fd && events[i].data.ptr != &loop->mailbox) {
+                conn_release((Connection*)events[i].data.ptr);
+            }
+        }
+
+        if (loop->stall_head) {
+            loop_retry_stalled(loop);
+        }
+
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            loop_sweep_idle(loop, now);
+            last_sweep = now;
+        }
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------
+//                              STARTUP
+// ----------------------------------------------------------------
+
+void event_loop_pin_thread(pthread_t thread, int index) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % num_cpus, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0) {
+        printf("[WARN] Could not pin loop %d to a core: %s\n", index, strerror(err));
+    }
+}
+
+int event_loops_run(const int* listen_fds, int num_loops, const EventLoopHandlers* handlers) {
+    if (num_loops < 1) num_loops = 1;
+
+    EventLoop* loops = (EventLoop*)calloc(num_loops, sizeof(EventLoop));
+    if (!loops) {
+        perror("Failed to allocate event loops");
+        return -1;
+    }
+
+    for (int i = 0; i < num_loops; i++) {
+        EventLoop* loop = &loops[i];
+        loop->id = i;
+        loop->listen_fd = listen_fds[i];
+        loop->handlers = handlers;
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd < 0) {
+            perror("epoll_create1 failed");
+            return -1;
+        }
+
+        // Each loop owns its listener, so accepts never contend across loops
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &loop->listen_fd;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listen_fd, &ev) < 0) {
+            perror("epoll_ctl add listener");
+            return -1;
+        }
+
+        // Workers signal finished requests through the mailbox eventfd
+        if (mailbox_init(&loop->mailbox) < 0) {
+            return -1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = &loop->mailbox;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->mailbox.wake_fd, &ev) < 0) {
+            perror("epoll_ctl add eventfd");
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < num_loops; i++) {
+        if (pthread_create(&loops[i].thread, NULL, loop_main, &loops[i]) != 0) {
+            perror("Could not create event loop thread");
+            return -1;
+        }
+        event_loop_pin_thread(loops[i].thread, i);
+    }
+
+    printf("Started %d epoll event loop(s)\n", num_loops);
+
+    for (int i = 0; i < num_loops; i++) {
+        pthread_join(loops[i].thread, NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "connection.h"
+
+#define CLIENT_IDLE_TIMEOUT 300  // seconds without traffic before a client is dropped
+#define ACCEPT_BATCH 64          // accepts per wakeup, so one loop doesn't take a whole storm
+#define STALL_RETRY_MS 5         // poll interval while connections wait for worker capacity
+
+typedef struct {
+    RequestHandler on_request;     // runs on the loop thread; should only queue work
+    void (*on_close)(Connection* conn);
+} EventLoopHandlers;
+
+// Run num_loops edge-triggered epoll loops, one thread each. Loop i accepts
+// from listen_fds[i] only; the listeners share the port via SO_REUSEPORT so
+// the kernel spreads new connections across them. Blocks until every loop exits.
+int event_loops_run(const int* listen_fds, int num_loops, const EventLoopHandlers* handlers);
+
+// Same contract on io_uring: multishot accept and recv into provided buffer
+// rings, batched sends. Returns -1 before starting any thread when the
+// kernel lacks the needed features, so the caller can fall back to epoll.
+int uring_loops_run(const int* listen_fds, int num_loops, const EventLoopHandlers* handlers);
+
+// Pin loop number index to one core (round-robin over online CPUs)
+void event_loop_pin_thread(pthread_t thread, int index);
+
+// Called from a worker when req has been handled: the loop owning the
+// connection writes the reply and applies the state changes it carries.
+void event_loop_complete(Request* req);
+
+#endif
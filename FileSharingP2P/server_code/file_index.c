@@ -0,0 +1,136 @@
+#include "file_index.h"
+#include "data_manager.h"
+#include "epoch.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_INDEX_MAX_LOAD 70          // percent of slots used (live or removed) before rebuilding
+#define REMOVED ((SharedFile*)1)        // keeps probe runs intact after a removal
+
+typedef struct {
+    size_t mask;
+    SharedFile* slots[];
+} SlotArray;
+
+struct FileIndex {
+    SlotArray* table;  // replaced whole when rebuilt
+    size_t count;      // live records; writer only
+    size_t used;       // live plus removed slots; writer only
+};
+
+// Hashes come from clients unchecked, so every byte is mixed in rather
+// than trusting the digest to be uniform
+static size_t slot_hash(const unsigned char* hash) {
+    return (size_t)hash_bytes(hash, FILE_HASH_BYTES);
+}
+
+static SlotArray* slot_array_create(size_t capacity) {
+    SlotArray* table = (SlotArray*)calloc(1, sizeof(SlotArray) + capacity * sizeof(SharedFile*));
+    if (table) {
+        table->mask = capacity - 1;
+    }
+    return table;
+}
+
+// Slot holding the record for hash, or NULL
+static SharedFile** find_slot(SlotArray* table, const unsigned char* hash) {
+    size_t i = slot_hash(hash) & table->mask;
+    while (1) {
+        SharedFile* file = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (!file) {
+            return NULL;
+        }
+        if (file != REMOVED && memcmp(file->hash, hash, FILE_HASH_BYTES) == 0) {
+            return &table->slots[i];
+        }
+        i = (i + 1) & table->mask;
+    }
+}
+
+static void insert_slot(SlotArray* table, SharedFile* file) {
+    size_t i = slot_hash(file->hash) & table->mask;
+    while (table->slots[i] && table->slots[i] != REMOVED) {
+        i = (i + 1) & table->mask;
+    }
+    __atomic_store_n(&table->slots[i], file, __ATOMIC_RELEASE);
+}
+
+// Copy the live records into a fresh array, growing it if they need the
+// room, and drop the removal markers. Readers keep using the old array
+// until they leave their epoch.
+static int rebuild(FileIndex* index) {
+    size_t capacity = hash_capacity_for((index->count + 1) * 2);
+    if (capacity < index->table->mask + 1) {
+        capacity = index->table->mask + 1;
+    }
+    SlotArray* table = slot_array_create(capacity);
+    if (!table) {
+        perror("Failed to grow file index");
+        return 0;
+    }
+
+    SlotArray* old = index->table;
+    for (size_t i = 0; i <= old->mask; i++) {
+        if (old->slots[i] && old->slots[i] != REMOVED) {
+            insert_slot(table, old->slots[i]);
+        }
+    }
+    __atomic_store_n(&index->table, table, __ATOMIC_RELEASE);
+    index->used = index->count;
+    epoch_retire(old);
+    return 1;
+}
+
+FileIndex* file_index_create(size_t expected_files) {
+    FileIndex* index = (FileIndex*)calloc(1, sizeof(FileIndex));
+    if (!index) return NULL;
+
+    index->table = slot_array_create(hash_capacity_for(expected_files * 100 / FILE_INDEX_MAX_LOAD + 1));
+    if (!index->table) {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+SharedFile* file_index_find(FileIndex* index, const unsigned char* hash) {
+    SlotArray* table = __atomic_load_n(&index->table, __ATOMIC_ACQUIRE);
+    SharedFile** slot = find_slot(table, hash);
+    return slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+}
+
+int file_index_add(FileIndex* index, SharedFile* file) {
+    if ((index->used + 1) * 100 > (index->table->mask + 1) * FILE_INDEX_MAX_LOAD &&
+        !rebuild(index)) {
+        return 0;
+    }
+
+    // Reusing a removal marker keeps used unchanged
+    size_t i = slot_hash(file->hash) & index->table->mask;
+    while (index->table->slots[i] && index->table->slots[i] != REMOVED) {
+        i = (i + 1) & index->table->mask;
+    }
+    if (!index->table->slots[i]) {
+        index->used++;
+    }
+    __atomic_store_n(&index->table->slots[i], file, __ATOMIC_RELEASE);
+    index->count++;
+    return 1;
+}
+
+void file_index_replace(FileIndex* index, SharedFile* old_file, SharedFile* new_file) {
+    SharedFile** slot = find_slot(index->table, old_file->hash);
+    if (slot) {
+        __atomic_store_n(slot, new_file, __ATOMIC_RELEASE);
+    }
+}
+
+void file_index_remove(FileIndex* index, SharedFile* file) {
+    SharedFile** slot = find_slot(index->table, file->hash);
+    if (slot) {
+        __atomic_store_n(slot, REMOVED, __ATOMIC_RELEASE);
+        index->count--;
+    }
+}
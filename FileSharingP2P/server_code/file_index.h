@@ -0,0 +1,30 @@
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include <stddef.h>
+
+struct SharedFile;
+
+// Maps a binary SHA-256 to the catalog's content record for it. Open
+// addressing over a flat array of record pointers: a probe compares the
+// 32-byte key in place, with no per-entry node.
+//
+// Lookups are lock-free and must run inside epoch_enter()/epoch_exit().
+// Changes are serialized by files_mutex; the slot array is replaced whole
+// when it is rebuilt and the old one retired.
+typedef struct FileIndex FileIndex;
+
+FileIndex* file_index_create(size_t expected_files);
+
+// The record for hash (FILE_HASH_BYTES long), or NULL
+struct SharedFile* file_index_find(FileIndex* index, const unsigned char* hash);
+
+// Index a record whose hash is not present yet. Returns 0 on allocation failure.
+int file_index_add(FileIndex* index, struct SharedFile* file);
+
+// Swap old_file for new_file, which must carry the same hash
+void file_index_replace(FileIndex* index, struct SharedFile* old_file, struct SharedFile* new_file);
+
+void file_index_remove(FileIndex* index, struct SharedFile* file);
+
+#endif
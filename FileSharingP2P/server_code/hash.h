@@ -0,0 +1,35 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// FNV-1a over a NUL-terminated key; shared by the server's hash tables
+static inline uint64_t hash_string(const char* key) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// FNV-1a over a fixed-length binary key
+static inline uint64_t hash_bytes(const void* key, size_t len) {
+    const unsigned char* p = (const unsigned char*)key;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Round up to a power of two (minimum 16) so probes can mask instead of mod
+static inline size_t hash_capacity_for(size_t n) {
+    size_t cap = 16;
+    while (cap < n) cap <<= 1;
+    return cap;
+}
+
+#endif
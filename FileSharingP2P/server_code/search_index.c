@@ -0,0 +1,326 @@
+#include "search_index.h"
+#include "data_manager.h"
+#include "epoch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define SEARCH_INDEX_MAX_LOAD 70  // percent of slots in use before doubling
+
+typedef struct {
+    uint64_t id;       // publish order; postings are sorted on it
+    SharedFile* file;  // NULL once the file is removed
+} Posting;
+
+// Readers only look at entries below count, so a writer appends by filling
+// the next entry and then publishing the new count. Removal leaves a
+// tombstone; the list is copied without them once they dominate.
+typedef struct {
+    uint32_t count;
+    uint32_t cap;
+    uint32_t dead;  // tombstones; writer only
+    Posting entries[];
+} PostingList;
+
+// Slots are never vacated, which keeps probing simple; an emptied list
+// is dropped and the slot skipped when the table is next rebuilt.
+typedef struct {
+    uint32_t key;  // trigram + 1; 0 marks an empty slot
+    PostingList* list;
+} TrigramSlot;
+
+typedef struct {
+    size_t mask;
+    TrigramSlot slots[];
+} SlotTable;
+
+struct SearchIndex {
+    SlotTable* table;  // replaced whole when it grows
+    PostingList* all;  // every file, for keywords too short to have a trigram
+    size_t used;       // writer only
+    uint64_t next_id;
+};
+
+static uint32_t trigram_at(const char* s) {
+    return (((uint32_t)(unsigned char)s[0] << 16) |
+            ((uint32_t)(unsigned char)s[1] << 8) |
+            (uint32_t)(unsigned char)s[2]) + 1;
+}
+
+// Trigram keys are dense small integers; spread them before masking
+static size_t slot_hash(uint32_t key) {
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static SlotTable* slot_table_create(size_t capacity) {
+    SlotTable* table = (SlotTable*)calloc(1, sizeof(SlotTable) + capacity * sizeof(TrigramSlot));
+    if (table) {
+        table->mask = capacity - 1;
+    }
+    return table;
+}
+
+static TrigramSlot* find_slot(SlotTable* table, uint32_t key) {
+    size_t i = slot_hash(key) & table->mask;
+    while (1) {
+        uint32_t k = __atomic_load_n(&table->slots[i].key, __ATOMIC_ACQUIRE);
+        if (k == 0 || k == key) {
+            return &table->slots[i];
+        }
+        i = (i + 1) & table->mask;
+    }
+}
+
+static void grow_slots(SearchIndex* index) {
+    SlotTable* old = index->table;
+    SlotTable* table = slot_table_create((old->mask + 1) * 2);
+    if (!table) {
+        perror("Failed to grow search index");
+        return;
+    }
+
+    size_t used = 0;
+    for (size_t s = 0; s <= old->mask; s++) {
+        TrigramSlot* slot = &old->slots[s];
+        if (slot->key == 0 || !slot->list) continue;
+        size_t i = slot_hash(slot->key) & table->mask;
+        while (table->slots[i].key != 0) {
+            i = (i + 1) & table->mask;
+        }
+        table->slots[i] = *slot;
+        used++;
+    }
+
+    __atomic_store_n(&index->table, table, __ATOMIC_RELEASE);
+    index->used = used;
+    epoch_retire(old);
+}
+
+// Copy of list's live postings with room for at least min_cap
+static PostingList* posting_list_copy(const PostingList* list, uint32_t min_cap) {
+    uint32_t live = list ? list->count - list->dead : 0;
+    uint32_t cap = 4;
+    while (cap < min_cap || cap < live) cap *= 2;
+
+    PostingList* copy = (PostingList*)malloc(sizeof(PostingList) + cap * sizeof(Posting));
+    if (!copy) {
+        perror("Failed to grow posting list");
+        return NULL;
+    }
+    copy->count = 0;
+    copy->cap = cap;
+    copy->dead = 0;
+    for (uint32_t i = 0; list && i < list->count; i++) {
+        if (list->entries[i].file) {
+            copy->entries[copy->count++] = list->entries[i];
+        }
+    }
+    return copy;
+}
+
+// First position whose id is >= id, among the first count entries
+static uint32_t lower_bound(const PostingList* list, uint32_t count, uint64_t id) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (list->entries[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int posting_append(PostingList** where, SharedFile* file) {
+    PostingList* list = *where;
+    if (list && list->count > 0 && list->entries[list->count - 1].id == file->search_id) {
+        return 1;  // trigram repeats within the filename
+    }
+
+    if (!list || list->count == list->cap) {
+        PostingList* grown = posting_list_copy(list, list ? list->count - list->dead + 1 : 1);
+        if (!grown) return 0;
+        grown->entries[grown->count].id = file->search_id;
+        grown->entries[grown->count].file = file;
+        grown->count++;
+        __atomic_store_n(where, grown, __ATOMIC_RELEASE);
+        epoch_retire(list);
+        return 1;
+    }
+
+    list->entries[list->count].id = file->search_id;
+    list->entries[list->count].file = file;
+    __atomic_store_n(&list->count, list->count + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void posting_remove(PostingList** where, uint64_t id) {
+    PostingList* list = *where;
+    if (!list) return;
+
+    uint32_t pos = lower_bound(list, list->count, id);
+    if (pos >= list->count || list->entries[pos].id != id || !list->entries[pos].file) {
+        return;  // already removed via an earlier copy of this trigram
+    }
+
+    __atomic_store_n(&list->entries[pos].file, NULL, __ATOMIC_RELEASE);
+    list->dead++;
+
+    if (list->dead == list->count) {
+        __atomic_store_n(where, NULL, __ATOMIC_RELEASE);
+        epoch_retire(list);
+    } else if (list->dead * 2 > list->count) {
+        PostingList* compact = posting_list_copy(list, 0);
+        if (compact) {  // otherwise the tombstones just stay a while
+            __atomic_store_n(where, compact, __ATOMIC_RELEASE);
+            epoch_retire(list);
+        }
+    }
+}
+
+SearchIndex* search_index_create(void) {
+    SearchIndex* index = (SearchIndex*)calloc(1, sizeof(SearchIndex));
+    if (!index) return NULL;
+
+    index->table = slot_table_create(4096);
+    if (!index->table) {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+int search_index_add(SearchIndex* index, SharedFile* file) {
+    // Every record is new, so postings stay sorted by appending
+    file->search_id = ++index->next_id;
+    if (!posting_append(&index->all, file)) {
+        return 0;
+    }
+
+    const char* name = file->filename;
+    size_t len = strlen(name);
+    for (size_t i = 0; i + SEARCH_MIN_KEYWORD <= len; i++) {
+        uint32_t key = trigram_at(name + i);
+        TrigramSlot* slot = find_slot(index->table, key);
+
+        if (slot->key == 0) {
+            if ((index->used + 1) * 100 > (index->table->mask + 1) * SEARCH_INDEX_MAX_LOAD) {
+                grow_slots(index);
+                slot = find_slot(index->table, key);
+            }
+            if (slot->key == 0) {
+                index->used++;
+            }
+        }
+
+        if (!posting_append(&slot->list, file)) {
+            search_index_remove(index, file);
+            return 0;
+        }
+        // The list must be reachable before readers can match the key
+        __atomic_store_n(&slot->key, key, __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+
+void search_index_remove(SearchIndex* index, SharedFile* file) {
+    posting_remove(&index->all, file->search_id);
+
+    const char* name = file->filename;
+    size_t len = strlen(name);
+    for (size_t i = 0; i + SEARCH_MIN_KEYWORD <= len; i++) {
+        TrigramSlot* slot = find_slot(index->table, trigram_at(name + i));
+        if (slot->key != 0) {
+            posting_remove(&slot->list, file->search_id);
+        }
+    }
+}
+
+typedef struct {
+    const PostingList* list;
+    uint32_t count;  // snapshot of list->count
+} ListView;
+
+static int contains(const ListView* view, uint64_t id) {
+    uint32_t pos = lower_bound(view->list, view->count, id);
+    return pos < view->count && view->list->entries[pos].id == id &&
+           __atomic_load_n(&view->list->entries[pos].file, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// First entry to visit, walking down: the newest one below before
+static uint32_t start_below(const ListView* view, uint64_t before) {
+    return before ? lower_bound(view->list, view->count, before) : view->count;
+}
+
+void search_index_query(SearchIndex* index, const char* keyword, uint64_t before,
+                        int (*fn)(SharedFile* file, void* ctx), void* ctx) {
+    size_t len = strlen(keyword);
+    if (len >= MAX_FILENAME) {
+        return;  // longer than any filename
+    }
+    if (len < SEARCH_MIN_KEYWORD) {
+        ListView all;
+        all.list = __atomic_load_n(&index->all, __ATOMIC_ACQUIRE);
+        all.count = all.list ? __atomic_load_n(&all.list->count, __ATOMIC_ACQUIRE) : 0;
+        for (uint32_t p = start_below(&all, before); p-- > 0;) {
+            SharedFile* file = __atomic_load_n(&all.list->entries[p].file, __ATOMIC_ACQUIRE);
+            if (file && (len == 0 || strstr(file->filename, keyword)) && !fn(file, ctx)) {
+                break;
+            }
+        }
+        return;
+    }
+
+    SlotTable* table = __atomic_load_n(&index->table, __ATOMIC_ACQUIRE);
+
+    // Distinct posting lists of the keyword's trigrams, shortest first
+    ListView views[MAX_FILENAME];
+    int num_views = 0;
+    for (size_t i = 0; i + SEARCH_MIN_KEYWORD <= len; i++) {
+        TrigramSlot* slot = find_slot(table, trigram_at(keyword + i));
+        PostingList* list = slot->key ? __atomic_load_n(&slot->list, __ATOMIC_ACQUIRE) : NULL;
+        uint32_t count = list ? __atomic_load_n(&list->count, __ATOMIC_ACQUIRE) : 0;
+        if (count == 0) {
+            return;  // some trigram appears in no filename
+        }
+
+        int j = num_views;
+        int duplicate = 0;
+        while (j > 0 && views[j - 1].count >= count) {
+            if (views[j - 1].list == list) {
+                duplicate = 1;
+                break;
+            }
+            j--;
+        }
+        if (duplicate) continue;
+
+        memmove(&views[j + 1], &views[j], (num_views - j) * sizeof(ListView));
+        views[j].list = list;
+        views[j].count = count;
+        num_views++;
+    }
+
+    // Walk the rarest trigram newest first and probe the others. Trigram
+    // hits are only candidates: the trigrams may sit apart in the name.
+    const ListView* rarest = &views[0];
+    for (uint32_t p = start_below(rarest, before); p-- > 0;) {
+        const Posting* candidate = &rarest->list->entries[p];
+        SharedFile* file = __atomic_load_n(&candidate->file, __ATOMIC_ACQUIRE);
+        if (!file) continue;
+
+        int in_all = 1;
+        for (int j = 1; j < num_views && in_all; j++) {
+            in_all = contains(&views[j], candidate->id);
+        }
+        if (!in_all || !strstr(file->filename, keyword)) {
+            continue;
+        }
+
+        if (!fn(file, ctx)) {
+            break;
+        }
+    }
+}
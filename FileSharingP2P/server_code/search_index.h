@@ -0,0 +1,37 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct SharedFile;
+
+#define SEARCH_MIN_KEYWORD 3  // shorter keywords have no trigram to look up
+
+// Trigram inverted index over catalog filenames. Each trigram maps to the
+// files containing it, sorted by publish order, so a substring query only
+// visits files that contain every trigram of the keyword. A list of every
+// file, in the same order, serves short keywords and full listings.
+//
+// Queries are lock-free and must run inside epoch_enter()/epoch_exit().
+// Changes are serialized by files_mutex.
+typedef struct SearchIndex SearchIndex;
+
+SearchIndex* search_index_create(void);
+
+// Index a newly created record under its filename, stamping it with the
+// next search_id. Returns 0 on allocation failure.
+int search_index_add(SearchIndex* index, struct SharedFile* file);
+
+// Must be called with the filename the file was indexed under
+void search_index_remove(SearchIndex* index, struct SharedFile* file);
+
+// Calls fn for every file whose filename contains keyword, newest first,
+// until fn returns 0. Only files with a search_id below before are visited
+// (0 = start from the newest), so a caller can resume where it stopped.
+// A keyword shorter than SEARCH_MIN_KEYWORD is matched against every
+// file; an empty one lists them all.
+void search_index_query(SearchIndex* index, const char* keyword, uint64_t before,
+                        int (*fn)(struct SharedFile* file, void* ctx), void* ctx);
+
+#endif
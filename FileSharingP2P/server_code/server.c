@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,10 +6,22 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <ifaddrs.h>
-#include <sys/time.h>
-#include <pthread.h>
+#include <signal.h>
 #include "../protocol.h"
 #include "data_manager.h"
+#include "epoch.h"
+#include "event_loop.h"
+#include "subscriptions.h"
+#include "worker_pool.h"
+
+#define WORKERS_PER_CORE 4          // handlers block on data locks and disk writes
+#define REQUEST_QUEUE_CAPACITY 4096 // queued requests before loops stop reading
+#define DEFAULT_LISTEN_BACKLOG 4096 // per listener; absorbs reconnect storms after a restart
+#define DEFAULT_FLUSH_MS 10         // WAL group-commit window for --fsync none/interval
+
+#define MAINTENANCE_INTERVAL 1      // seconds between housekeeping passes
+
+static WorkerPool* worker_pool = NULL;
 
 void cleanup_client_connection(int sock) {
     if (sock >= 0) {
@@ -28,7 +41,13 @@ static const char* cmd_name(int code) {
         case CMD_LOGOUT: return "CMD_LOGOUT";
         case CMD_DOWNLOAD_STATUS: return "CMD_DOWNLOAD_STATUS";
         case CMD_BROWSE_FILES: return "CMD_BROWSE_FILES";
+        case CMD_HEARTBEAT: return "CMD_HEARTBEAT";
+        case CMD_HELLO: return "CMD_HELLO";
+        case CMD_BROWSE_CHANGES: return "CMD_BROWSE_CHANGES";
+        case CMD_SUBSCRIBE: return "CMD_SUBSCRIBE";
+        case CMD_NOTIFY: return "CMD_NOTIFY";
         case RESP_SUCCESS: return "RESP_SUCCESS";
+        case RESP_FAIL: return "RESP_FAIL";
         case RESP_USER_EXISTS: return "RESP_USER_EXISTS";
         case RESP_INVALID_CRED: return "RESP_INVALID_CRED";
         case RESP_NOT_FOUND: return "RESP_NOT_FOUND";
@@ -41,21 +60,6 @@ static const char* cmd_name(int code) {
     }
 }
 
-// Helper function to receive full struct
-static int recv_full(int sock, void* buffer, size_t size) {
-    char* buf = (char*)buffer;
-    size_t total = 0;
-    
-    while (total < size) {
-        int bytes = recv(sock, buf + total, size - total, 0);
-        if (bytes <= 0) {
-            return bytes;
-        }
-        total += bytes;
-    }
-    return total;
-}
-
 void display_server_ips() {
     struct ifaddrs *ifaddr, *ifa;
     char ip[INET_ADDRSTRLEN];
@@ -114,476 +118,724 @@ void display_server_ips() {
     printf("================================\n\n");
 }
 
-void* handle_client(void* arg) {
-    int client_sock = *(int*)arg;
-    free(arg);
-    
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    getpeername(client_sock, (struct sockaddr*)&client_addr, &addr_len);
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-    int client_port = ntohs(client_addr.sin_port);
-    
-    char current_email[MAX_EMAIL] = {0};
-    
-    struct timeval tv;
-    tv.tv_sec = 300; 
-    tv.tv_usec = 0;
-    setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+// Runs on a worker thread. Replies and connection state changes are
+// recorded on the request and applied by the owning event loop.
+static void handle_request(Request* request) {
+    const char* msg = request->msg;
+    MessageHeader header;
+    memcpy(&header, msg, sizeof(MessageHeader));
+
+    printf("\n[RECV] Command: %s (request_id: %u)\n", 
+           cmd_name(header.command), header.request_id);
     
-    while (1) {
-        // First, peek at the header to determine message type
-        MessageHeader header;
-        int bytes = recv(client_sock, &header, sizeof(MessageHeader), MSG_PEEK);
-        
-        if (bytes <= 0) {
-            if (bytes == 0) {
-                printf("[INFO] Client disconnected gracefully.\n");
+    switch (header.command) {
+        case CMD_REGISTER: {
+            RegisterRequest req;
+            memcpy(&req, msg, sizeof(RegisterRequest));
+            
+            printf("  === REGISTER REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Username: %s\n", req.username);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            RegisterResponse resp;
+            memset(&resp, 0, sizeof(RegisterResponse));
+            resp.header.command = CMD_REGISTER;
+            resp.header.request_id = req.header.request_id;
+            
+            if (add_user(req.email, req.username, req.password)) {
+                resp.status = RESP_SUCCESS;
+                printf("[REGISTER] Success: %s (%s)\n", req.username, req.email);
             } else {
-                printf("[ERROR] recv failed (timeout or error).\n");
+                resp.status = RESP_USER_EXISTS;
+                printf("[REGISTER] Failed: %s (email exists)\n", req.email);
             }
+            
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            request_reply(request, &resp, sizeof(RegisterResponse));
             break;
         }
         
-        printf("\n[RECV] Command: %s (request_id: %u)\n", 
-               cmd_name(header.command), header.request_id);
-        
-        switch (header.command) {
-            case CMD_REGISTER: {
-                RegisterRequest req;
-                if (recv_full(client_sock, &req, sizeof(RegisterRequest)) <= 0) break;
-                
-                printf("  === REGISTER REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Username: %s\n", req.username);
-                printf("  Request ID: %u\n", req.header.request_id);
-                
-                RegisterResponse resp;
-                memset(&resp, 0, sizeof(RegisterResponse));
-                resp.header.command = CMD_REGISTER;
-                resp.header.request_id = req.header.request_id;
-                
-                if (add_user(req.email, req.username, req.password)) {
-                    resp.status = RESP_SUCCESS;
-                    printf("[REGISTER] Success: %s (%s)\n", req.username, req.email);
-                } else {
-                    resp.status = RESP_USER_EXISTS;
-                    printf("[REGISTER] Failed: %s (email exists)\n", req.email);
-                }
-                
+        case CMD_LOGIN: {
+            LoginRequest req;
+            memcpy(&req, msg, sizeof(LoginRequest));
+            
+            printf("  === LOGIN REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Password: %s\n", req.password);
+            printf("  P2P Port: %d\n", req.port);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            LoginResponse resp;
+            memset(&resp, 0, sizeof(LoginResponse));
+            resp.header.command = CMD_LOGIN;
+            resp.header.request_id = req.header.request_id;
+            
+            // Check if user is already logged in
+            if (is_user_already_connected(req.email)) {
+                resp.status = RESP_ALREADY_LOGGED_IN;
+                printf("[LOGIN] Failed: %s is already logged in from another location\n", req.email);
                 printf("[SEND] Response: %s\n", cmd_name(resp.status));
                 printf("  Status: %s\n", cmd_name(resp.status));
                 printf("  Request ID: %u\n", resp.header.request_id);
-                send(client_sock, &resp, sizeof(RegisterResponse), 0);
+                request_reply(request, &resp, sizeof(LoginResponse));
                 break;
             }
             
-            case CMD_LOGIN: {
-                LoginRequest req;
-                if (recv_full(client_sock, &req, sizeof(LoginRequest)) <= 0) break;
+            char* token = NULL;
+            if (!authenticate(req.email, req.password)) {
+                resp.status = RESP_INVALID_CRED;
+                printf("[LOGIN] Failed: %s (invalid credentials)\n", req.email);
+            } else if (!(token = create_session(req.email))) {
+                resp.status = RESP_FAIL;
+                printf("[LOGIN] Failed: could not create a session for %s\n", req.email);
+            } else {
+                resp.status = RESP_SUCCESS;
+                strcpy(resp.access_token, token);
+                free(token);
                 
-                printf("  === LOGIN REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Password: %s\n", req.password);
-                printf("  P2P Port: %d\n", req.port);
-                printf("  Request ID: %u\n", req.header.request_id);
+                if (!get_username_by_email(req.email, resp.username)) {
+                    strcpy(resp.username, "Unknown");
+                }
                 
-                LoginResponse resp;
-                memset(&resp, 0, sizeof(LoginResponse));
-                resp.header.command = CMD_LOGIN;
-                resp.header.request_id = req.header.request_id;
+                strncpy(request->login_email, req.email, MAX_EMAIL - 1);
                 
-                // Check if user is already logged in
-                if (is_user_already_connected(req.email)) {
-                    resp.status = RESP_ALREADY_LOGGED_IN;
-                    printf("[LOGIN] Failed: %s is already logged in from another location\n", req.email);
-                    printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                    printf("  Status: %s\n", cmd_name(resp.status));
-                    printf("  Request ID: %u\n", resp.header.request_id);
-                    send(client_sock, &resp, sizeof(LoginResponse), 0);
-                    break;
+                int p2p_port = req.port;
+                if (p2p_port == 0) {
+                    p2p_port = request->conn->client_port;
                 }
                 
-                if (authenticate(req.email, req.password)) {
-                    resp.status = RESP_SUCCESS;
-                    char* token = create_session(req.email);
-                    strcpy(resp.access_token, token);
-                    free(token);
-                    
-                    if (!get_username_by_email(req.email, resp.username)) {
-                        strcpy(resp.username, "Unknown");
-                    }
-                    
-                    strncpy(current_email, req.email, MAX_EMAIL - 1);
-                    
-                    int p2p_port = req.port;
-                    if (p2p_port == 0) {
-                        p2p_port = client_port;
-                    }
-                    
-                    add_connected_user(current_email, client_ip, p2p_port);
-                    
-                    printf("[LOGIN] Success: %s (%s) from %s:%d (P2P port: %d)\n", 
-                        resp.username, req.email, client_ip, client_port, p2p_port);
-                } else {
-                    resp.status = RESP_INVALID_CRED;
-                    printf("[LOGIN] Failed: %s (invalid credentials)\n", req.email);
-                }
+                add_connected_user(req.email, request->conn->client_ip, p2p_port);
                 
-                printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                printf("  Status: %s\n", cmd_name(resp.status));
-                printf("  Request ID: %u\n", resp.header.request_id);
-                if (resp.status == RESP_SUCCESS) {
-                    printf("  Username: %s\n", resp.username);
-                    printf("  Access Token: %s\n", resp.access_token);
-                }
-                send(client_sock, &resp, sizeof(LoginResponse), 0);
-                break;
+                printf("[LOGIN] Success: %s (%s) from %s:%d (P2P port: %d)\n", 
+                    resp.username, req.email, request->conn->client_ip,
+                    request->conn->client_port, p2p_port);
             }
             
-            case CMD_BROWSE_FILES: {
-                BrowseFilesRequest req;
-                if (recv_full(client_sock, &req, sizeof(BrowseFilesRequest)) <= 0) break;
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            if (resp.status == RESP_SUCCESS) {
+                printf("  Username: %s\n", resp.username);
+                printf("  Access Token: %s\n", resp.access_token);
+            }
+            request_reply(request, &resp, sizeof(LoginResponse));
+            break;
+        }
+        
+        case CMD_BROWSE_FILES: {
+            BrowseFilesRequest req;
+            memcpy(&req, msg, sizeof(BrowseFilesRequest));
 
-                printf("  === BROWSE FILES REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Access Token: %s\n", req.access_token);
+            printf("  === BROWSE FILES REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Order: %s, limit %d\n", req.order == BROWSE_POPULAR ? "popular" : "recent", req.limit);
 
+            const BrowsePage* page = NULL;
+            int status = RESP_SUCCESS;
+            if (!verify_token(req.access_token, req.email)) {
+                status = RESP_INVALID_TOKEN;
+                printf("[BROWSE] Invalid token\n");
+            } else if (!(page = browse_page_acquire(req.order, req.limit, req.cursor))) {
+                status = RESP_FAIL;
+                printf("[BROWSE] Failed: out of memory\n");
+            }
+
+            if (page) {
+                // The cached page goes out as-is behind this request's header
+                MessageHeader header = page->response.header;
+                header.request_id = req.header.request_id;
+                request_reply(request, &header, sizeof(header));
+                request_reply(request, (const char*)&page->response + sizeof(header),
+                              sizeof(BrowseFilesResponse) - sizeof(header));
+                printf("[BROWSE] %d shared file(s)\n", page->response.count);
+                browse_page_release(page);
+            } else {
                 BrowseFilesResponse resp;
                 memset(&resp, 0, sizeof(BrowseFilesResponse));
                 resp.header.command = CMD_BROWSE_FILES;
                 resp.header.request_id = req.header.request_id;
+                resp.status = status;
+                request_reply(request, &resp, sizeof(BrowseFilesResponse));
+            }
+            break;
+        }
+        case CMD_BROWSE_CHANGES: {
+            BrowseChangesRequest req;
+            memcpy(&req, msg, sizeof(BrowseChangesRequest));
 
-                if (!verify_token(req.access_token, req.email)) {
-                    resp.status = RESP_INVALID_TOKEN;
-                    resp.count = 0;
-                    printf("[BROWSE] Invalid token\n");
-                } else {
-                    SearchResponse data = browse_all_files();
-                    resp.status = data.status;
-                    resp.count = data.count;
-                    memcpy(resp.files, data.files, sizeof(resp.files));
-
-                    printf("[BROWSE] %d shared file(s)\n", resp.count);
-                }
+            printf("  === BROWSE CHANGES REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Since: %llu, limit %d\n", (unsigned long long)req.since, req.limit);
 
-                send(client_sock, &resp, sizeof(BrowseFilesResponse), 0);
-                break;
+            BrowseChangesResponse resp;
+            if (!verify_token(req.access_token, req.email)) {
+                memset(&resp, 0, sizeof(BrowseChangesResponse));
+                resp.header.command = CMD_BROWSE_CHANGES;
+                resp.status = RESP_INVALID_TOKEN;
+                printf("[BROWSE] Invalid token\n");
+            } else {
+                resp = browse_changes(req.since, req.limit);
+                printf("[BROWSE] %s: %d change(s), now at %llu\n", resp.full ? "Full listing" : "Delta",
+                       resp.count, (unsigned long long)resp.catalog_version);
             }
-            case CMD_SEARCH: {
-                SearchRequest req;
-                if (recv_full(client_sock, &req, sizeof(SearchRequest)) <= 0) break;
-                
-                printf("  === SEARCH REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Access Token: %s\n", req.access_token);
-                printf("  Keyword: %s\n", req.keyword);
-                printf("  Request ID: %u\n", req.header.request_id);
-                
-                SearchResponse resp;
-                memset(&resp, 0, sizeof(SearchResponse));
-                resp.header.command = CMD_SEARCH;
-                resp.header.request_id = req.header.request_id;
-                
-                if (!verify_token(req.access_token, req.email)) {
-                    resp.status = RESP_INVALID_TOKEN;
-                    resp.count = 0;
-                    printf("[SEARCH] Failed: Invalid token for %s\n", req.email);
-                } else {
-                    // Get search results from data manager
-                    SearchResponse search_data = search_files(req.keyword);
-                    resp.status = (search_data.count > 0) ? RESP_SUCCESS : RESP_NOT_FOUND;
-                    resp.count = search_data.count;
-                    memcpy(resp.files, search_data.files, sizeof(resp.files));
-                    
-                    printf("[SEARCH] Keyword '%s': %d file(s) found\n", 
-                          req.keyword, resp.count);
-                    
-                    for (int i = 0; i < resp.count && i < 5; i++) {
-                        printf("  #%d: %s (hash: %.16s...) size=%ld\n", 
-                              i+1, resp.files[i].filename, 
-                              resp.files[i].filehash, resp.files[i].file_size);
-                    }
-                }
-                
-                printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                printf("  Status: %s\n", cmd_name(resp.status));
-                printf("  Request ID: %u\n", resp.header.request_id);
-                if (resp.status == RESP_SUCCESS) {
-                    printf("  Files Found: %d\n", resp.count);
-                } else if (resp.status == RESP_INVALID_TOKEN) {
-                    printf("  Error: Invalid access token\n");
+            resp.header.request_id = req.header.request_id;
+            request_reply(request, &resp, sizeof(BrowseChangesResponse));
+            break;
+        }
+        case CMD_SEARCH: {
+            SearchRequest req;
+            memcpy(&req, msg, sizeof(SearchRequest));
+            
+            printf("  === SEARCH REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Keyword: %s\n", req.keyword);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            SearchResponse resp;
+            memset(&resp, 0, sizeof(SearchResponse));
+            resp.header.command = CMD_SEARCH;
+            resp.header.request_id = req.header.request_id;
+            
+            if (!verify_token(req.access_token, req.email)) {
+                resp.status = RESP_INVALID_TOKEN;
+                resp.count = 0;
+                printf("[SEARCH] Failed: Invalid token for %s\n", req.email);
+            } else {
+                // Get search results from data manager
+                SearchResponse search_data = search_files(req.keyword, req.cursor, req.limit);
+                resp.status = (search_data.count > 0) ? RESP_SUCCESS : RESP_NOT_FOUND;
+                resp.count = search_data.count;
+                resp.next_cursor = search_data.next_cursor;
+                memcpy(resp.files, search_data.files, sizeof(resp.files));
+                
+                printf("[SEARCH] Keyword '%s': %d file(s) found\n", 
+                      req.keyword, resp.count);
+                
+                for (int i = 0; i < resp.count && i < 5; i++) {
+                    printf("  #%d: %s (hash: %.16s...) size=%ld\n", 
+                          i+1, resp.files[i].filename, 
+                          resp.files[i].filehash, resp.files[i].file_size);
                 }
-                printf("  Access Token: %s\n", req.access_token);
-                send(client_sock, &resp, sizeof(SearchResponse), 0);
-                break;
             }
             
-            case CMD_FIND: {
-                FindRequest req;
-                if (recv_full(client_sock, &req, sizeof(FindRequest)) <= 0) break;
-                
-                printf("  === FIND PEERS REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Access Token: %s\n", req.access_token);
-                printf("  Filehash: %.16s...\n", req.filehash);
-                printf("  Request ID: %u\n", req.header.request_id);
-                
-                FindResponse resp;
-                memset(&resp, 0, sizeof(FindResponse));
-                resp.header.command = CMD_FIND;
-                resp.header.request_id = req.header.request_id;
-                
-                if (!verify_token(req.access_token, req.email)) {
-                    resp.status = RESP_INVALID_TOKEN;
-                    resp.count = 0;
-                    printf("[FIND] Failed: Invalid token for %s\n", req.email);
-                } else {
-                    // Get peer list from data manager
-                    FindResponse find_data = find_peers(req.filehash);
-                    resp.status = (find_data.count > 0) ? RESP_SUCCESS : RESP_NOT_FOUND;
-                    resp.count = find_data.count;
-                    memcpy(resp.peers, find_data.peers, sizeof(resp.peers));
-                    
-                    printf("[FIND] Hash '%.16s...': %d peer(s) found\n", 
-                          req.filehash, resp.count);
-                    
-                    for (int i = 0; i < resp.count && i < 5; i++) {
-                        printf("  #%d: peer %s:%d\n", 
-                              i+1, resp.peers[i].ip, resp.peers[i].port);
-                    }
-                }
-                
-                printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                printf("  Status: %s\n", cmd_name(resp.status));
-                printf("  Request ID: %u\n", resp.header.request_id);
-                if (resp.status == RESP_SUCCESS) {
-                    printf("  Peers Found: %d\n", resp.count);
-                } else if (resp.status == RESP_INVALID_TOKEN) {
-                    printf("  Error: Invalid access token\n");
-                }
-                printf("  Access Token: %s\n", req.access_token);
-                send(client_sock, &resp, sizeof(FindResponse), 0);
-                break;
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            if (resp.status == RESP_SUCCESS) {
+                printf("  Files Found: %d\n", resp.count);
+            } else if (resp.status == RESP_INVALID_TOKEN) {
+                printf("  Error: Invalid access token\n");
             }
+            printf("  Access Token: %s\n", req.access_token);
+            request_reply(request, &resp, sizeof(SearchResponse));
+            break;
+        }
+        
+        case CMD_FIND: {
+            FindRequest req;
+            memcpy(&req, msg, sizeof(FindRequest));
             
-            case CMD_PUBLISH: {
-                PublishRequest req;
-                if (recv_full(client_sock, &req, sizeof(PublishRequest)) <= 0) break;
-                
-                printf("  === PUBLISH FILE REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Access Token: %s\n", req.access_token);
-                printf("  Filename: %s\n", req.filename);
-                printf("  Filehash: %.16s...\n", req.filehash);
-                printf("  File Size: %ld bytes\n", req.file_size);
-                printf("  Chunk Size: %d\n", req.chunk_size);
-                printf("  Request ID: %u\n", req.header.request_id);
-                
-                PublishResponse resp;
-                memset(&resp, 0, sizeof(PublishResponse));
-                resp.header.command = CMD_PUBLISH;
-                resp.header.request_id = req.header.request_id;
-                
-                if (!verify_token(req.access_token, req.email)) {
-                    resp.status = RESP_INVALID_TOKEN;
-                    printf("[PUBLISH] Failed: Invalid token for %s\n", req.email);
-                } else if (!validate_filename(req.filename)) {
-                    resp.status = RESP_INVALID_INPUT;
-                    printf("[PUBLISH] Failed: Invalid filename for %s\n", req.email);
-                } else {
-                    publish_file(req.filename, req.filehash, req.email, 
-                               req.file_size, req.chunk_size);
-                    resp.status = RESP_SUCCESS;
-                    printf("[PUBLISH] File: %s (hash: %.16s...) by %s\n", 
-                          req.filename, req.filehash, req.email);
+            printf("  === FIND PEERS REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Filehash: %.16s...\n", req.filehash);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            FindResponse resp;
+            memset(&resp, 0, sizeof(FindResponse));
+            resp.header.command = CMD_FIND;
+            resp.header.request_id = req.header.request_id;
+            
+            if (!verify_token(req.access_token, req.email)) {
+                resp.status = RESP_INVALID_TOKEN;
+                resp.count = 0;
+                printf("[FIND] Failed: Invalid token for %s\n", req.email);
+            } else {
+                // Get peer list from data manager
+                FindResponse find_data = find_peers(req.filehash, request->conn->client_ip,
+                                                    req.cursor, req.limit);
+                resp.status = (find_data.count > 0) ? RESP_SUCCESS : RESP_NOT_FOUND;
+                resp.count = find_data.count;
+                resp.next_cursor = find_data.next_cursor;
+                memcpy(resp.peers, find_data.peers, sizeof(resp.peers));
+                
+                printf("[FIND] Hash '%.16s...': %d peer(s) found\n", 
+                      req.filehash, resp.count);
+                
+                for (int i = 0; i < resp.count && i < 5; i++) {
+                    printf("  #%d: peer %s:%d\n", 
+                          i+1, resp.peers[i].ip, resp.peers[i].port);
                 }
-                
-                printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                printf("  Status: %s\n", cmd_name(resp.status));
-                printf("  Request ID: %u\n", resp.header.request_id);
-                send(client_sock, &resp, sizeof(PublishResponse), 0);
-                break;
             }
             
-            case CMD_UNPUBLISH: {
-                UnpublishRequest req;
-                if (recv_full(client_sock, &req, sizeof(UnpublishRequest)) <= 0) break;
-                
-                printf("  === UNPUBLISH FILE REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Access Token: %s\n", req.access_token);
-                printf("  Filehash: %.16s...\n", req.filehash);
-                printf("  Request ID: %u\n", req.header.request_id);
-                
-                UnpublishResponse resp;
-                memset(&resp, 0, sizeof(UnpublishResponse));
-                resp.header.command = CMD_UNPUBLISH;
-                resp.header.request_id = req.header.request_id;
-                
-                if (!verify_token(req.access_token, req.email)) {
-                    resp.status = RESP_INVALID_TOKEN;
-                    printf("[UNPUBLISH] Failed: Invalid token for %s\n", req.email);
-                } else if (!is_file_owner(req.filehash, req.email)) {
-                    resp.status = RESP_FILE_NOT_OWNED;
-                    printf("[UNPUBLISH] Failed: File %.16s... not owned by %s\n", 
-                          req.filehash, req.email);
-                } else {
-                    unpublish_file(req.filehash, req.email);
-                    resp.status = RESP_SUCCESS;
-                    printf("[UNPUBLISH] Hash %.16s... by %s\n", 
-                          req.filehash, req.email);
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            if (resp.status == RESP_SUCCESS) {
+                printf("  Peers Found: %d\n", resp.count);
+            } else if (resp.status == RESP_INVALID_TOKEN) {
+                printf("  Error: Invalid access token\n");
+            }
+            printf("  Access Token: %s\n", req.access_token);
+            request_reply(request, &resp, sizeof(FindResponse));
+            break;
+        }
+        
+        case CMD_PUBLISH: {
+            PublishRequest req;
+            memcpy(&req, msg, sizeof(PublishRequest));
+            
+            printf("  === PUBLISH FILE REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Filename: %s\n", req.filename);
+            printf("  Filehash: %.16s...\n", req.filehash);
+            printf("  File Size: %ld bytes\n", req.file_size);
+            printf("  Chunk Size: %d\n", req.chunk_size);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            PublishResponse resp;
+            memset(&resp, 0, sizeof(PublishResponse));
+            resp.header.command = CMD_PUBLISH;
+            resp.header.request_id = req.header.request_id;
+            
+            if (!verify_token(req.access_token, req.email)) {
+                resp.status = RESP_INVALID_TOKEN;
+                printf("[PUBLISH] Failed: Invalid token for %s\n", req.email);
+            } else if (!validate_filename(req.filename)) {
+                resp.status = RESP_INVALID_INPUT;
+                printf("[PUBLISH] Failed: Invalid filename for %s\n", req.email);
+            } else if (!validate_filehash(req.filehash)) {
+                resp.status = RESP_INVALID_INPUT;
+                printf("[PUBLISH] Failed: Invalid filehash for %s\n", req.email);
+            } else {
+                publish_file(req.filename, req.filehash, req.email, 
+                           req.file_size, req.chunk_size);
+                resp.status = RESP_SUCCESS;
+                printf("[PUBLISH] File: %s (hash: %.16s...) by %s\n", 
+                      req.filename, req.filehash, req.email);
+            }
+            
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            request_reply(request, &resp, sizeof(PublishResponse));
+            break;
+        }
+        
+        case CMD_UNPUBLISH: {
+            UnpublishRequest req;
+            memcpy(&req, msg, sizeof(UnpublishRequest));
+            
+            printf("  === UNPUBLISH FILE REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Filehash: %.16s...\n", req.filehash);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            UnpublishResponse resp;
+            memset(&resp, 0, sizeof(UnpublishResponse));
+            resp.header.command = CMD_UNPUBLISH;
+            resp.header.request_id = req.header.request_id;
+            
+            if (!verify_token(req.access_token, req.email)) {
+                resp.status = RESP_INVALID_TOKEN;
+                printf("[UNPUBLISH] Failed: Invalid token for %s\n", req.email);
+            } else if (!is_file_owner(req.filehash, req.email)) {
+                resp.status = RESP_FILE_NOT_OWNED;
+                printf("[UNPUBLISH] Failed: File %.16s... not owned by %s\n", 
+                      req.filehash, req.email);
+            } else {
+                unpublish_file(req.filehash, req.email);
+                resp.status = RESP_SUCCESS;
+                printf("[UNPUBLISH] Hash %.16s... by %s\n", 
+                      req.filehash, req.email);
+            }
+            
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            request_reply(request, &resp, sizeof(UnpublishResponse));
+            break;
+        }
+        
+        case CMD_SUBSCRIBE: {
+            SubscribeRequest req;
+            memcpy(&req, msg, sizeof(SubscribeRequest));
+            req.target[MAX_FILENAME - 1] = '\0';
+            
+            printf("  === SUBSCRIBE REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  %s %s: %s\n", req.remove ? "Remove" : "Add",
+                   req.watch == WATCH_FILEHASH ? "filehash" : "keyword", req.target);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            SubscribeResponse resp;
+            memset(&resp, 0, sizeof(SubscribeResponse));
+            resp.header.command = CMD_SUBSCRIBE;
+            resp.header.request_id = req.header.request_id;
+            
+            if (!verify_token(req.access_token, req.email)) {
+                resp.status = RESP_INVALID_TOKEN;
+                printf("[SUBSCRIBE] Failed: Invalid token for %s\n", req.email);
+            } else if (req.watch == WATCH_FILEHASH && !validate_filehash(req.target)) {
+                resp.status = RESP_INVALID_INPUT;
+                printf("[SUBSCRIBE] Failed: Invalid filehash for %s\n", req.email);
+            } else if (req.remove) {
+                resp.status = subscriptions_remove(request->conn, req.watch, req.target);
+            } else {
+                resp.status = subscriptions_add(request->conn, req.watch, req.target);
+                if (resp.status == RESP_FAIL) {
+                    printf("[SUBSCRIBE] Failed: %s holds %d subscriptions already\n",
+                           req.email, MAX_SUBSCRIPTIONS);
                 }
-                
-                printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                printf("  Status: %s\n", cmd_name(resp.status));
-                printf("  Request ID: %u\n", resp.header.request_id);
-                send(client_sock, &resp, sizeof(UnpublishResponse), 0);
-                break;
             }
             
-            case CMD_LOGOUT: {
-                LogoutRequest req;
-                if (recv_full(client_sock, &req, sizeof(LogoutRequest)) <= 0) break;
-                
-                printf("  === LOGOUT REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Access Token: %s\n", req.access_token);
-                printf("  Request ID: %u\n", req.header.request_id);
-                
-                destroy_session(req.access_token);
-                remove_connected_user(req.email);  
-                
-                LogoutResponse resp;
-                memset(&resp, 0, sizeof(LogoutResponse));
-                resp.header.command = CMD_LOGOUT;
-                resp.header.request_id = req.header.request_id;
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            request_reply(request, &resp, sizeof(SubscribeResponse));
+            break;
+        }
+        
+        case CMD_LOGOUT: {
+            LogoutRequest req;
+            memcpy(&req, msg, sizeof(LogoutRequest));
+            
+            printf("  === LOGOUT REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            destroy_session(req.access_token);
+            remove_connected_user(req.email);  
+            
+            LogoutResponse resp;
+            memset(&resp, 0, sizeof(LogoutResponse));
+            resp.header.command = CMD_LOGOUT;
+            resp.header.request_id = req.header.request_id;
+            resp.status = RESP_SUCCESS;
+            
+            printf("[LOGOUT] %s\n", req.email);
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            request_reply(request, &resp, sizeof(LogoutResponse));
+            request->close_after_reply = 1;
+            break;
+        }
+        
+        case CMD_HEARTBEAT: {
+            HeartbeatRequest req;
+            memcpy(&req, msg, sizeof(HeartbeatRequest));
+            
+            HeartbeatResponse resp;
+            memset(&resp, 0, sizeof(HeartbeatResponse));
+            resp.header.command = CMD_HEARTBEAT;
+            resp.header.request_id = req.header.request_id;
+            
+            int p2p_port = req.port;
+            if (p2p_port == 0) {
+                p2p_port = request->conn->client_port;
+            }
+            
+            if (!verify_token(req.access_token, req.email)) {
+                resp.status = RESP_INVALID_TOKEN;
+                printf("[HEARTBEAT] Failed: Invalid token for %s\n", req.email);
+            } else if (renew_peer_lease(req.email, request->conn->client_ip, p2p_port,
+                                        req.active_uploads) < 0) {
+                resp.status = RESP_FAIL;
+                printf("[HEARTBEAT] Failed: could not renew the lease of %s\n", req.email);
+            } else {
                 resp.status = RESP_SUCCESS;
-                
-                printf("[LOGOUT] %s\n", req.email);
-                printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                printf("  Status: %s\n", cmd_name(resp.status));
-                printf("  Request ID: %u\n", resp.header.request_id);
-                send(client_sock, &resp, sizeof(LogoutResponse), 0);
-                
-                close(client_sock);
-                return NULL;
+                resp.lease_seconds = PEER_LEASE_SECONDS;
+                printf("[HEARTBEAT] %s renewed for %ds\n", req.email, PEER_LEASE_SECONDS);
             }
             
-            case CMD_DOWNLOAD_STATUS: {
-                DownloadStatusRequest req;
-                if (recv_full(client_sock, &req, sizeof(DownloadStatusRequest)) <= 0) break;
-                
-                printf("  === DOWNLOAD STATUS REQUEST ===\n");
-                printf("  Email: %s\n", req.email);
-                printf("  Access Token: %s\n", req.access_token);
-                printf("  Filehash: %.16s...\n", req.filehash);
-                printf("  Download Success: %d\n", req.download_success);
-                printf("  Request ID: %u\n", req.header.request_id);
-                
-                DownloadStatusResponse resp;
-                memset(&resp, 0, sizeof(DownloadStatusResponse));
-                resp.header.command = CMD_DOWNLOAD_STATUS;
-                resp.header.request_id = req.header.request_id;
-                
-                if (!verify_token(req.access_token, req.email)) {
-                    resp.status = RESP_INVALID_TOKEN;
-                    printf("[DOWNLOAD_STATUS] Failed: Invalid token\n");
+            request_reply(request, &resp, sizeof(HeartbeatResponse));
+            break;
+        }
+        
+        case CMD_DOWNLOAD_STATUS: {
+            DownloadStatusRequest req;
+            memcpy(&req, msg, sizeof(DownloadStatusRequest));
+            
+            printf("  === DOWNLOAD STATUS REQUEST ===\n");
+            printf("  Email: %s\n", req.email);
+            printf("  Access Token: %s\n", req.access_token);
+            printf("  Filehash: %.16s...\n", req.filehash);
+            printf("  Download Success: %d\n", req.download_success);
+            printf("  Peer: %.*s:%d (%lld bytes in %d ms)\n", MAX_IP, req.peer.ip, req.peer.port,
+                   (long long)req.bytes, req.elapsed_ms);
+            printf("  Request ID: %u\n", req.header.request_id);
+            
+            DownloadStatusResponse resp;
+            memset(&resp, 0, sizeof(DownloadStatusResponse));
+            resp.header.command = CMD_DOWNLOAD_STATUS;
+            resp.header.request_id = req.header.request_id;
+            
+            if (!verify_token(req.access_token, req.email)) {
+                resp.status = RESP_INVALID_TOKEN;
+                printf("[DOWNLOAD_STATUS] Failed: Invalid token\n");
+            } else {
+                resp.status = RESP_SUCCESS;
+                req.peer.ip[MAX_IP - 1] = '\0';
+                record_download_result(req.filehash, req.peer.ip, req.peer.port,
+                                       req.download_success == 1, (long)req.bytes, req.elapsed_ms);
+                if (req.download_success == 1) {
+                    printf("[DOWNLOAD_STATUS] Success: %s downloaded file (hash: %.16s...)\n", 
+                          req.email, req.filehash);
                 } else {
-                    resp.status = RESP_SUCCESS;
-                    if (req.download_success == 1) {
-                        printf("[DOWNLOAD_STATUS] Success: %s downloaded file (hash: %.16s...)\n", 
-                              req.email, req.filehash);
-                    } else {
-                        printf("[DOWNLOAD_STATUS] Failed: %s failed to download file (hash: %.16s...)\n", 
-                              req.email, req.filehash);
-                    }
+                    printf("[DOWNLOAD_STATUS] Failed: %s failed to download file (hash: %.16s...)\n", 
+                          req.email, req.filehash);
                 }
-                
-                printf("[SEND] Response: %s\n", cmd_name(resp.status));
-                printf("  Status: %s\n", cmd_name(resp.status));
-                printf("  Request ID: %u\n", resp.header.request_id);
-                send(client_sock, &resp, sizeof(DownloadStatusResponse), 0);
-                break;
             }
             
-            default:
-                printf("[ERROR] Unknown command: %d\n", header.command);
-                close(client_sock);
-                return NULL;
+            printf("[SEND] Response: %s\n", cmd_name(resp.status));
+            printf("  Status: %s\n", cmd_name(resp.status));
+            printf("  Request ID: %u\n", resp.header.request_id);
+            request_reply(request, &resp, sizeof(DownloadStatusResponse));
+            break;
         }
+        
+        default:
+            // Framing rejects unknown commands before they get here
+            printf("[ERROR] Unknown command: %d\n", header.command);
+            break;
     }
-    
-    if (current_email[0] != '\0') {
-        remove_connected_user(current_email);
+}
+
+static void run_request(void* arg) {
+    Request* request = (Request*)arg;
+    handle_request(request);
+    request_encode_reply(request);
+    event_loop_complete(request);
+}
+
+// Runs on the event loop: hand the decoded request to the worker pool
+static int dispatch_request(Connection* conn, const MessageHeader* msg, size_t size) {
+    Request* request = request_create(conn, msg, size);
+    if (!request) {
+        return -1;
+    }
+    if (worker_pool_submit(worker_pool, run_request, request) < 0) {
+        // Saturated: leave the bytes buffered, the loop retries shortly
+        request_free(request);
+        return -1;
+    }
+    return 0;
+}
+
+static void handle_disconnect(Connection* conn) {
+    subscriptions_drop(conn);
+    if (conn->current_email[0] != '\0') {
+        remove_connected_user(conn->current_email);
+    }
+}
+
+// Set by SIGUSR1; the maintenance thread starts the save
+static volatile sig_atomic_t bgsave_requested = 0;
+
+static void request_bgsave(int sig) {
+    (void)sig;
+    bgsave_requested = 1;
+}
+
+// Background housekeeping that must not wait for client traffic
+static void* maintenance_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        sleep(MAINTENANCE_INTERVAL);
+        
+        if (bgsave_requested) {
+            bgsave_requested = 0;
+            background_save();
+        }
+        
+        int expired = expire_sessions();
+        if (expired > 0) {
+            printf("[INFO] Expired %d session(s)\n", expired);
+        }
+        
+        // Peers that stopped sending HEARTBEATs leave the FIND results
+        int evicted = expire_peer_leases();
+        if (evicted > 0) {
+            printf("[INFO] Evicted %d peer(s) with expired leases\n", evicted);
+        }
+        
+        // Older downloads count less toward BROWSE_POPULAR
+        decay_popularity();
+        
+        // Free catalog records retired by publish/unpublish
+        epoch_reclaim();
+        
+        checkpoint_data();
     }
-    
-    close(client_sock);
     return NULL;
 }
 
-int main() {
-    int server_sock;  
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    printf("=== P2P File Sharing Server ===\n");
-    printf("Initializing...\n\n");
-    
-    // Load data on startup
-    load_data(); 
-    
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
+// One listening socket per loop. SO_REUSEPORT lets all of them bind
+// SERVER_PORT and the kernel hashes incoming connections across them.
+static int create_listener(int backlog) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
         perror("Socket creation failed");
-        exit(1);
+        return -1;
     }
     
     int opt = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("SO_REUSEPORT failed");
+        close(sock);
+        return -1;
+    }
     
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(SERVER_PORT);
     
-    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    if (bind(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Bind failed");
-        exit(1);
+        close(sock);
+        return -1;
     }
     
-    if (listen(server_sock, 10) < 0) {
+    if (listen(sock, backlog) < 0) {
         perror("Listen failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s [--io-uring] [--loops N] [--backlog N] [--fsync POLICY] [--flush-ms N]\n"
+           "       %*s [--site CIDR]... [--site-only]\n"
+           "       %s --export-text\n", prog, (int)strlen(prog), "", prog);
+    printf("  --loops N       event loops / listening sockets (default: one per core)\n");
+    printf("  --backlog N     listen() backlog per socket (default: %d)\n", DEFAULT_LISTEN_BACKLOG);
+    printf("  --fsync POLICY  none | interval | always (default: interval)\n");
+    printf("  --flush-ms N    WAL batching window for none/interval (default: %d)\n", DEFAULT_FLUSH_MS);
+    printf("  --site CIDR     a site network (e.g. 10.1.0.0/16); FIND lists peers on the\n"
+           "                  requester's /24 first, then its site, then the rest\n");
+    printf("  --site-only     leave other sites out of FIND when closer peers exist\n");
+    printf("  --export-text   write users.txt and shared_files.txt from the snapshot and exit\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    int use_uring = 0;
+    int num_loops = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int backlog = DEFAULT_LISTEN_BACKLOG;
+    WalOptions persistence = { WAL_SYNC_INTERVAL, DEFAULT_FLUSH_MS };
+    int export_text = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--io-uring") == 0) {
+            use_uring = 1;
+        } else if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+            num_loops = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            backlog = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fsync") == 0 && i + 1 < argc) {
+            const char* policy = argv[++i];
+            if (strcmp(policy, "none") == 0) {
+                persistence.sync = WAL_SYNC_NONE;
+            } else if (strcmp(policy, "interval") == 0) {
+                persistence.sync = WAL_SYNC_INTERVAL;
+            } else if (strcmp(policy, "always") == 0) {
+                persistence.sync = WAL_SYNC_ALWAYS;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--flush-ms") == 0 && i + 1 < argc) {
+            persistence.flush_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--site") == 0 && i + 1 < argc) {
+            if (!add_site_prefix(argv[++i])) {
+                fprintf(stderr, "Invalid site prefix: %s\n", argv[i]);
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--site-only") == 0) {
+            set_site_only(1);
+        } else if (strcmp(argv[i], "--export-text") == 0) {
+            export_text = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (num_loops < 1 || backlog < 1 || persistence.flush_ms < 1) {
+        usage(argv[0]);
+    }
+    
+    printf("=== P2P File Sharing Server ===\n");
+    printf("Initializing...\n\n");
+    
+    // A client vanishing mid-send must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    // kill -USR1 <pid> writes a snapshot in a forked child (like BGSAVE)
+    signal(SIGUSR1, request_bgsave);
+    
+    // Load data on startup
+    load_data(&persistence);
+    if (export_text) {
+        exit(export_text_data() == 0 ? 0 : 1);
+    }
+    // Catalog changes from here on are pushed to subscribed clients
+    set_catalog_listener(subscriptions_notify);
+    
+    int* listen_fds = (int*)malloc(num_loops * sizeof(int));
+    if (!listen_fds) {
+        perror("Failed to allocate listeners");
         exit(1);
     }
+    for (int i = 0; i < num_loops; i++) {
+        listen_fds[i] = create_listener(backlog);
+        if (listen_fds[i] < 0) {
+            exit(1);
+        }
+    }
     
     display_server_ips();
-    printf("Server running on port %d...\n", SERVER_PORT);
+    printf("Server running on port %d (%d listener(s), backlog %d)...\n",
+           SERVER_PORT, num_loops, backlog);
     printf("Waiting for connections...\n\n");
     
-    while (1) {
-        int* client_sock = malloc(sizeof(int));  
-        *client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &addr_len);
-        
-        if (*client_sock < 0) {
-            perror("Accept failed");
-            free(client_sock);
-            continue;
-        }
-        
-        printf("[CONNECT] New connection from %s:%d\n", 
-               inet_ntoa(client_addr.sin_addr), 
-               ntohs(client_addr.sin_port));
-        
-        pthread_t thread_id;  
-        if (pthread_create(&thread_id, NULL, handle_client, client_sock) != 0) {
-            perror("Could not create thread");
-            close(*client_sock);  
-            free(client_sock);
-            continue;
-        }
-        pthread_detach(thread_id);
+    int num_cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    worker_pool = worker_pool_create(num_cores * WORKERS_PER_CORE, REQUEST_QUEUE_CAPACITY);
+    if (!worker_pool) {
+        exit(1);
     }
     
-    close(server_sock);
+    pthread_t maintenance;
+    if (pthread_create(&maintenance, NULL, maintenance_thread, NULL) != 0) {
+        perror("Could not create maintenance thread");
+        exit(1);
+    }
+    pthread_detach(maintenance);
+    
+    EventLoopHandlers handlers = {
+        .on_request = dispatch_request,
+        .on_close = handle_disconnect
+    };
+    
+    // Each loop owns one listener; io_uring falls back to epoll on older kernels
+    if (!use_uring || uring_loops_run(listen_fds, num_loops, &handlers) < 0) {
+        event_loops_run(listen_fds, num_loops, &handlers);
+    }
+    
+    for (int i = 0; i < num_loops; i++) {
+        close(listen_fds[i]);
+    }
+    free(listen_fds);
     return 0;
-}
\ No newline at end of file
+}
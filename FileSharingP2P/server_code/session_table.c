@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include "session_table.h"
+#include "hash.h"
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define TOKEN_RANDOM_BYTES 16  // 128-bit tokens, hex encoded
+
+typedef struct SessionEntry {
+    char token[SESSION_TOKEN_SIZE];
+    char email[MAX_EMAIL];
+    time_t expires_at;
+    size_t heap_index;
+    struct SessionEntry* next;  // bucket chain
+} SessionEntry;
+
+struct SessionTable {
+    pthread_rwlock_t lock;
+    int timeout;
+    int random_fd;
+    Slab* entries;
+
+    SessionEntry** buckets;
+    size_t mask;
+    size_t count;
+
+    // Min-heap on expires_at; each entry knows its position for O(log n) removal
+    SessionEntry** heap;
+    size_t heap_cap;
+};
+
+// ----------------------------------------------------------------
+//                              HEAP
+// ----------------------------------------------------------------
+
+static void heap_set(SessionTable* table, size_t i, SessionEntry* entry) {
+    table->heap[i] = entry;
+    entry->heap_index = i;
+}
+
+static void heap_sift_up(SessionTable* table, size_t i) {
+    SessionEntry* entry = table->heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (table->heap[parent]->expires_at <= entry->expires_at) break;
+        heap_set(table, i, table->heap[parent]);
+        i = parent;
+    }
+    heap_set(table, i, entry);
+}
+
+static void heap_sift_down(SessionTable* table, size_t i) {
+    SessionEntry* entry = table->heap[i];
+    size_t n = table->count;
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && table->heap[child + 1]->expires_at < table->heap[child]->expires_at) {
+            child++;
+        }
+        if (entry->expires_at <= table->heap[child]->expires_at) break;
+        heap_set(table, i, table->heap[child]);
+        i = child;
+    }
+    heap_set(table, i, entry);
+}
+
+// ----------------------------------------------------------------
+//                              HASH
+// ----------------------------------------------------------------
+
+static SessionEntry** bucket_for(SessionTable* table, const char* token) {
+    return &table->buckets[hash_string(token) & table->mask];
+}
+
+static int grow_buckets(SessionTable* table) {
+    size_t capacity = (table->mask + 1) * 2;
+    SessionEntry** buckets = (SessionEntry**)calloc(capacity, sizeof(SessionEntry*));
+    if (!buckets) return -1;
+
+    for (size_t b = 0; b <= table->mask; b++) {
+        SessionEntry* entry = table->buckets[b];
+        while (entry) {
+            SessionEntry* next = entry->next;
+            SessionEntry** bucket = &buckets[hash_string(entry->token) & (capacity - 1)];
+            entry->next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->mask = capacity - 1;
+    return 0;
+}
+
+// Unlink from its bucket and the heap, then free. Caller holds the write lock.
+static void remove_entry(SessionTable* table, SessionEntry* entry) {
+    SessionEntry** link = bucket_for(table, entry->token);
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    size_t i = entry->heap_index;
+    table->count--;
+    if (i != table->count) {
+        SessionEntry* moved = table->heap[table->count];
+        heap_set(table, i, moved);
+        heap_sift_down(table, i);
+        heap_sift_up(table, moved->heap_index);
+    }
+    slab_free(table->entries, entry);
+}
+
+static SessionEntry* find_entry(SessionTable* table, const char* token) {
+    SessionEntry* entry = *bucket_for(table, token);
+    while (entry && strcmp(entry->token, token) != 0) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+static int random_token(SessionTable* table, char* token_out) {
+    unsigned char bytes[TOKEN_RANDOM_BYTES];
+    size_t got = 0;
+    while (got < sizeof(bytes)) {
+        ssize_t n = read(table->random_fd, bytes + got, sizeof(bytes) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += n;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        token_out[2 * i] = hex[bytes[i] >> 4];
+        token_out[2 * i + 1] = hex[bytes[i] & 0xf];
+    }
+    token_out[2 * sizeof(bytes)] = '\0';
+    return 0;
+}
+
+// ----------------------------------------------------------------
+//                              API
+// ----------------------------------------------------------------
+
+SessionTable* session_table_create(int timeout_seconds) {
+    SessionTable* table = (SessionTable*)calloc(1, sizeof(SessionTable));
+    if (!table) return NULL;
+
+    table->random_fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (table->random_fd < 0) {
+        perror("Cannot open /dev/urandom");
+        free(table);
+        return NULL;
+    }
+
+    size_t capacity = hash_capacity_for(1024);
+    table->buckets = (SessionEntry**)calloc(capacity, sizeof(SessionEntry*));
+    table->entries = slab_create(sizeof(SessionEntry));
+    if (!table->buckets || !table->entries) {
+        free(table->buckets);
+        free(table->entries);
+        close(table->random_fd);
+        free(table);
+        return NULL;
+    }
+    table->mask = capacity - 1;
+    table->timeout = timeout_seconds;
+    pthread_rwlock_init(&table->lock, NULL);
+    return table;
+}
+
+int session_table_open(SessionTable* table, const char* email, char* token_out) {
+    SessionEntry* entry = (SessionEntry*)slab_alloc(table->entries);
+    if (!entry) return 0;
+
+    strncpy(entry->email, email, MAX_EMAIL - 1);
+    entry->expires_at = time(NULL) + table->timeout;
+
+    pthread_rwlock_wrlock(&table->lock);
+
+    // 128 random bits make a collision practically impossible, but a
+    // duplicate would hand one user another's session, so check anyway
+    do {
+        if (random_token(table, entry->token) < 0) {
+            pthread_rwlock_unlock(&table->lock);
+            perror("Cannot read session token randomness");
+            slab_free(table->entries, entry);
+            return 0;
+        }
+    } while (find_entry(table, entry->token));
+
+    if (table->count == table->heap_cap) {
+        size_t capacity = table->heap_cap ? table->heap_cap * 2 : 1024;
+        SessionEntry** heap = (SessionEntry**)realloc(table->heap, capacity * sizeof(SessionEntry*));
+        if (!heap) {
+            pthread_rwlock_unlock(&table->lock);
+            slab_free(table->entries, entry);
+            return 0;
+        }
+        table->heap = heap;
+        table->heap_cap = capacity;
+    }
+    if (table->count > table->mask) {
+        grow_buckets(table);  // on failure the chains just get longer
+    }
+
+    SessionEntry** bucket = bucket_for(table, entry->token);
+    entry->next = *bucket;
+    *bucket = entry;
+
+    table->count++;
+    heap_set(table, table->count - 1, entry);
+    heap_sift_up(table, table->count - 1);
+
+    strcpy(token_out, entry->token);
+    pthread_rwlock_unlock(&table->lock);
+    return 1;
+}
+
+int session_table_verify(SessionTable* table, const char* token, const char* email) {
+    time_t now = time(NULL);
+
+    pthread_rwlock_rdlock(&table->lock);
+    SessionEntry* entry = find_entry(table, token);
+    int ok = entry && entry->expires_at > now && strcmp(entry->email, email) == 0;
+    pthread_rwlock_unlock(&table->lock);
+    return ok;
+}
+
+void session_table_close(SessionTable* table, const char* token) {
+    pthread_rwlock_wrlock(&table->lock);
+    SessionEntry* entry = find_entry(table, token);
+    if (entry) {
+        remove_entry(table, entry);
+    }
+    pthread_rwlock_unlock(&table->lock);
+}
+
+int session_table_expire(SessionTable* table, time_t now) {
+    int expired = 0;
+
+    pthread_rwlock_wrlock(&table->lock);
+    while (table->count > 0 && table->heap[0]->expires_at <= now) {
+        remove_entry(table, table->heap[0]);
+        expired++;
+    }
+    pthread_rwlock_unlock(&table->lock);
+    return expired;
+}
+
+size_t session_table_count(SessionTable* table) {
+    pthread_rwlock_rdlock(&table->lock);
+    size_t count = table->count;
+    pthread_rwlock_unlock(&table->lock);
+    return count;
+}
+
+void session_table_foreach(SessionTable* table,
+                           void (*fn)(const char* token, const char* email, time_t expires_at, void* ctx),
+                           void* ctx) {
+    pthread_rwlock_rdlock(&table->lock);
+    // The heap holds exactly the live sessions, densely
+    for (size_t i = 0; i < table->count; i++) {
+        const SessionEntry* entry = table->heap[i];
+        fn(entry->token, entry->email, entry->expires_at, ctx);
+    }
+    pthread_rwlock_unlock(&table->lock);
+}
+
+void session_table_fork_prepare(SessionTable* table) {
+    pthread_rwlock_wrlock(&table->lock);
+}
+
+void session_table_fork_parent(SessionTable* table) {
+    pthread_rwlock_unlock(&table->lock);
+}
+
+void session_table_fork_child(SessionTable* table) {
+    pthread_rwlock_init(&table->lock, NULL);
+}
@@ -0,0 +1,42 @@
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include "../protocol.h"
+#include <stddef.h>
+#include <time.h>
+
+#define SESSION_TOKEN_SIZE 64  // matches access_token in the wire structs
+
+// Login sessions keyed by an unguessable random token. Lookups are a single
+// hash probe; a min-heap ordered by expiry lets expired sessions be dropped
+// without scanning, so memory tracks the live sessions only.
+typedef struct SessionTable SessionTable;
+
+SessionTable* session_table_create(int timeout_seconds);
+
+// Writes a fresh token into token_out. Returns 0 if no randomness was available.
+int session_table_open(SessionTable* table, const char* email, char* token_out);
+
+// True if token is live and belongs to email
+int session_table_verify(SessionTable* table, const char* token, const char* email);
+
+void session_table_close(SessionTable* table, const char* token);
+
+// Drop every session whose lifetime ended by now; returns how many
+int session_table_expire(SessionTable* table, time_t now);
+
+size_t session_table_count(SessionTable* table);
+
+// Visit every live session under the shared lock, in no particular order
+void session_table_foreach(SessionTable* table,
+                           void (*fn)(const char* token, const char* email, time_t expires_at, void* ctx),
+                           void* ctx);
+
+// Bracket a fork(): prepare takes the lock exclusively so the child copies
+// a table no writer is halfway through; afterwards the parent releases it
+// and the child, whose copy of the lock is stale, gets a fresh one.
+void session_table_fork_prepare(SessionTable* table);
+void session_table_fork_parent(SessionTable* table);
+void session_table_fork_child(SessionTable* table);
+
+#endif
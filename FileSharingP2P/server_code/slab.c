@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SLAB_CHUNK_BYTES (1024 * 1024)  // growth step when no reservation is pending
+
+typedef struct FreeObject {
+    struct FreeObject* next;
+} FreeObject;
+
+struct Slab {
+    pthread_mutex_t lock;
+    size_t object_size;     // rounded up to keep every object 8-byte aligned
+    FreeObject* free_list;  // freed objects, linked through their first word
+    char* bump;             // untouched tail of the newest chunk
+    char* bump_end;
+    size_t reserved;        // allocations still owed to slab_reserve, taken from bump
+    size_t live;
+};
+
+Slab* slab_create(size_t object_size) {
+    Slab* slab = (Slab*)calloc(1, sizeof(Slab));
+    if (!slab) return NULL;
+
+    if (object_size < sizeof(FreeObject)) {
+        object_size = sizeof(FreeObject);
+    }
+    slab->object_size = (object_size + 7) & ~(size_t)7;
+    pthread_mutex_init(&slab->lock, NULL);
+    return slab;
+}
+
+// Retire what is left of the current chunk to the free list and start a
+// new chunk of n objects. Caller holds the lock.
+static int new_chunk(Slab* slab, size_t n) {
+    char* chunk = (char*)malloc(n * slab->object_size);
+    if (!chunk) {
+        perror("Failed to grow slab");
+        return -1;
+    }
+
+    while (slab->bump < slab->bump_end) {
+        FreeObject* object = (FreeObject*)slab->bump;
+        object->next = slab->free_list;
+        slab->free_list = object;
+        slab->bump += slab->object_size;
+    }
+    slab->bump = chunk;
+    slab->bump_end = chunk + n * slab->object_size;
+    return 0;
+}
+
+int slab_reserve(Slab* slab, size_t n) {
+    pthread_mutex_lock(&slab->lock);
+    int rc = 0;
+    if ((size_t)(slab->bump_end - slab->bump) < n * slab->object_size) {
+        rc = new_chunk(slab, n);
+    }
+    if (rc == 0) {
+        slab->reserved = n;
+    }
+    pthread_mutex_unlock(&slab->lock);
+    return rc;
+}
+
+void* slab_alloc(Slab* slab) {
+    pthread_mutex_lock(&slab->lock);
+
+    // The free list waits while a reservation is pending, or the reserved
+    // objects would not be contiguous
+    void* ptr = slab->reserved ? NULL : slab->free_list;
+    if (ptr) {
+        slab->free_list = slab->free_list->next;
+    } else {
+        if (slab->reserved) {
+            slab->reserved--;
+        }
+        if (slab->bump == slab->bump_end) {
+            size_t n = SLAB_CHUNK_BYTES / slab->object_size;
+            if (new_chunk(slab, n ? n : 1) < 0) {
+                pthread_mutex_unlock(&slab->lock);
+                return NULL;
+            }
+        }
+        ptr = slab->bump;
+        slab->bump += slab->object_size;
+    }
+    slab->live++;
+
+    pthread_mutex_unlock(&slab->lock);
+    memset(ptr, 0, slab->object_size);
+    return ptr;
+}
+
+void slab_free(Slab* slab, void* ptr) {
+    if (!ptr) return;
+
+    pthread_mutex_lock(&slab->lock);
+    FreeObject* object = (FreeObject*)ptr;
+    object->next = slab->free_list;
+    slab->free_list = object;
+    slab->live--;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+size_t slab_live(Slab* slab) {
+    pthread_mutex_lock(&slab->lock);
+    size_t live = slab->live;
+    pthread_mutex_unlock(&slab->lock);
+    return live;
+}
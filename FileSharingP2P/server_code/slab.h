@@ -0,0 +1,30 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+// Allocator for fixed-size records of one type. Objects are carved from
+// large chunks, so they carry no per-allocation header and sit densely
+// next to each other; freed objects go on a free list and are handed out
+// again before the chunk is extended. Chunks are never returned to the
+// system, which suits tables that shrink and regrow around a steady size.
+//
+// Thread-safe; each slab has its own lock.
+typedef struct Slab Slab;
+
+Slab* slab_create(size_t object_size);
+
+// Make sure the next n allocations come from one contiguous block, so a
+// bulk load costs a single allocation: until they are made, the free list
+// is not used. Returns -1 if it cannot be made.
+int slab_reserve(Slab* slab, size_t n);
+
+// A zeroed object, or NULL when out of memory
+void* slab_alloc(Slab* slab);
+
+void slab_free(Slab* slab, void* ptr);
+
+// Objects currently handed out
+size_t slab_live(Slab* slab);
+
+#endif
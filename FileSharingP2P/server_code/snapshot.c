@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "P2PSNAP"            // 8 bytes with the terminator
+#define SNAPSHOT_WRITE_BUFFER (1024 * 1024)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t user_size;   // sizeof(SnapshotUser) when written
+    uint32_t file_size;   // sizeof(SnapshotFile) when written
+    uint64_t user_count;
+    uint64_t file_count;
+    uint64_t users_offset;
+    uint64_t files_offset;     // sections start 8-byte aligned
+    // Version 2
+    uint32_t session_size;     // sizeof(SnapshotSession) when written
+    uint32_t reserved;
+    uint64_t session_count;
+    uint64_t sessions_offset;
+} SnapshotHeader;
+
+#define SNAPSHOT_V1_HEADER_SIZE offsetof(SnapshotHeader, session_size)
+
+enum { SECTION_USERS, SECTION_FILES, SECTION_SESSIONS, SECTION_END };
+
+struct Snapshot {
+    void* map;
+    size_t length;
+    const SnapshotHeader* header;
+};
+
+struct SnapshotWriter {
+    FILE* fp;
+    char path[256];
+    char tmp_path[272];
+    SnapshotHeader header;
+    uint64_t offset;
+    int section;
+    int failed;
+};
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+// Sections must follow each other in order and end exactly at length.
+// Offsets and counts come from disk, so they are bounded before any
+// arithmetic that could overflow.
+static int header_valid(const SnapshotHeader* h, size_t length) {
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0) {
+        return 0;
+    }
+
+    int v2 = h->version == 2;
+    if ((h->version != 1 && !v2) ||
+        h->header_size != (v2 ? sizeof(SnapshotHeader) : SNAPSHOT_V1_HEADER_SIZE) ||
+        length < h->header_size ||
+        h->user_size != sizeof(SnapshotUser) || h->file_size != sizeof(SnapshotFile) ||
+        (v2 && h->session_size != sizeof(SnapshotSession))) {
+        return 0;
+    }
+
+    const uint64_t offsets[] = { h->users_offset, h->files_offset, v2 ? h->sessions_offset : 0 };
+    const uint64_t counts[] = { h->user_count, h->file_count, v2 ? h->session_count : 0 };
+    const uint64_t sizes[] = { sizeof(SnapshotUser), sizeof(SnapshotFile), sizeof(SnapshotSession) };
+    uint64_t end = h->header_size;
+    for (int s = 0; s < (v2 ? 3 : 2); s++) {
+        if (offsets[s] < end || offsets[s] % 8 != 0 || offsets[s] > length ||
+            counts[s] > (length - offsets[s]) / sizes[s]) {
+            return 0;
+        }
+        end = offsets[s] + counts[s] * sizes[s];
+    }
+    return end == length;
+}
+
+Snapshot* snapshot_open(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < SNAPSHOT_V1_HEADER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t length = (size_t)st.st_size;
+    void* map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    // Loading walks both arrays front to back, so start reading ahead now
+    madvise(map, length, MADV_SEQUENTIAL);
+    madvise(map, length, MADV_WILLNEED);
+
+    // A version 1 header is a prefix of the current one
+    if (!header_valid((const SnapshotHeader*)map, length)) {
+        munmap(map, length);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    Snapshot* snap = (Snapshot*)malloc(sizeof(Snapshot));
+    if (!snap) {
+        munmap(map, length);
+        return NULL;
+    }
+    snap->map = map;
+    snap->length = length;
+    snap->header = (const SnapshotHeader*)map;
+    return snap;
+}
+
+const SnapshotUser* snapshot_users(const Snapshot* snap, size_t* count) {
+    *count = (size_t)snap->header->user_count;
+    return (const SnapshotUser*)((const char*)snap->map + snap->header->users_offset);
+}
+
+const SnapshotFile* snapshot_files(const Snapshot* snap, size_t* count) {
+    *count = (size_t)snap->header->file_count;
+    return (const SnapshotFile*)((const char*)snap->map + snap->header->files_offset);
+}
+
+void snapshot_close(Snapshot* snap) {
+    if (!snap) return;
+    munmap(snap->map, snap->length);
+    free(snap);
+}
+
+static void writer_put(SnapshotWriter* writer, const void* data, size_t len) {
+    if (fwrite(data, 1, len, writer->fp) != len) {
+        writer->failed = 1;
+    }
+    writer->offset += len;
+}
+
+SnapshotWriter* snapshot_writer_open(const char* path) {
+    SnapshotWriter* writer = (SnapshotWriter*)calloc(1, sizeof(SnapshotWriter));
+    if (!writer) return NULL;
+
+    snprintf(writer->path, sizeof(writer->path), "%s", path);
+    snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s.tmp", path);
+    writer->fp = fopen(writer->tmp_path, "w");
+    if (!writer->fp) {
+        perror("Failed to open snapshot");
+        free(writer);
+        return NULL;
+    }
+    setvbuf(writer->fp, NULL, _IOFBF, SNAPSHOT_WRITE_BUFFER);
+
+    // The header is rewritten with the final counts on commit
+    memcpy(writer->header.magic, SNAPSHOT_MAGIC, sizeof(writer->header.magic));
+    writer->header.version = SNAPSHOT_VERSION;
+    writer->header.header_size = sizeof(SnapshotHeader);
+    writer->header.user_size = sizeof(SnapshotUser);
+    writer->header.file_size = sizeof(SnapshotFile);
+    writer->header.session_size = sizeof(SnapshotSession);
+    writer_put(writer, &writer->header, sizeof(SnapshotHeader));
+    writer->section = -1;
+    return writer;
+}
+
+// Move forward to section, padding so each one starts 8-byte aligned.
+// Returns -1 if that section was already closed.
+static int enter_section(SnapshotWriter* writer, int section) {
+    static const char padding[8];
+    if (section < writer->section) {
+        return -1;
+    }
+    while (writer->section < section) {
+        writer->section++;
+        uint64_t aligned = align8(writer->offset);
+        writer_put(writer, padding, aligned - writer->offset);
+        if (writer->section == SECTION_USERS) {
+            writer->header.users_offset = aligned;
+        } else if (writer->section == SECTION_FILES) {
+            writer->header.files_offset = aligned;
+        } else if (writer->section == SECTION_SESSIONS) {
+            writer->header.sessions_offset = aligned;
+        }
+    }
+    return 0;
+}
+
+int snapshot_write_user(SnapshotWriter* writer, const char* email, const char* username,
+                        const char* password) {
+    if (enter_section(writer, SECTION_USERS) < 0) {
+        return -1;
+    }
+
+    SnapshotUser record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.email, email, sizeof(record.email) - 1);
+    strncpy(record.username, username, sizeof(record.username) - 1);
+    strncpy(record.password, password, sizeof(record.password) - 1);
+    writer_put(writer, &record, sizeof(record));
+    writer->header.user_count++;
+    return 0;
+}
+
+int snapshot_write_file(SnapshotWriter* writer, const char* filename, const char* filehash,
+                        const char* owner_email, long file_size, int chunk_size) {
+    if (enter_section(writer, SECTION_FILES) < 0) {
+        return -1;
+    }
+
+    SnapshotFile record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.filename, filename, sizeof(record.filename) - 1);
+    strncpy(record.filehash, filehash, sizeof(record.filehash) - 1);
+    strncpy(record.owner_email, owner_email, sizeof(record.owner_email) - 1);
+    record.file_size = file_size;
+    record.chunk_size = chunk_size;
+    writer_put(writer, &record, sizeof(record));
+    writer->header.file_count++;
+    return 0;
+}
+
+int snapshot_write_session(SnapshotWriter* writer, const char* token, const char* email,
+                           time_t expires_at) {
+    if (enter_section(writer, SECTION_SESSIONS) < 0) {
+        return -1;
+    }
+
+    SnapshotSession record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.token, token, sizeof(record.token) - 1);
+    strncpy(record.email, email, sizeof(record.email) - 1);
+    record.expires_at = expires_at;
+    writer_put(writer, &record, sizeof(record));
+    writer->header.session_count++;
+    return 0;
+}
+
+int snapshot_writer_commit(SnapshotWriter* writer) {
+    // Empty trailing sections still get their offsets
+    enter_section(writer, SECTION_END);
+
+    int ok = !writer->failed && fflush(writer->fp) == 0 &&
+             fseek(writer->fp, 0, SEEK_SET) == 0 &&
+             fwrite(&writer->header, sizeof(SnapshotHeader), 1, writer->fp) == 1 &&
+             fflush(writer->fp) == 0 && fsync(fileno(writer->fp)) == 0;
+    ok = fclose(writer->fp) == 0 && ok;
+    if (!ok || rename(writer->tmp_path, writer->path) < 0) {
+        perror("Failed to write snapshot");
+        unlink(writer->tmp_path);
+        free(writer);
+        return -1;
+    }
+    free(writer);
+    return 0;
+}
+
+void snapshot_writer_abort(SnapshotWriter* writer) {
+    fclose(writer->fp);
+    unlink(writer->tmp_path);
+    free(writer);
+}
@@ -0,0 +1,69 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "../protocol.h"
+#include "session_table.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary tracker snapshot: a fixed header followed by arrays of user,
+// file and session records. Records are fixed-size and in host byte
+// order, so a mapped snapshot is read in place with no parsing; the text
+// files remain the portable import/export format.
+//
+// The header stores the version and the record sizes, so a snapshot
+// written with different MAX_* limits is rejected instead of misread.
+// Version 1 had no session section and is still accepted.
+
+#define SNAPSHOT_VERSION 2
+
+typedef struct {
+    char email[MAX_EMAIL];
+    char username[MAX_USERNAME];
+    char password[MAX_PASSWORD];
+} SnapshotUser;
+
+typedef struct {
+    char filename[MAX_FILENAME];
+    char filehash[MAX_HASH];
+    char owner_email[MAX_EMAIL];
+    int64_t file_size;
+    int32_t chunk_size;
+    int32_t reserved;
+} SnapshotFile;
+
+// Saved as part of a point-in-time backup. Not loaded at startup: logouts
+// after the snapshot are not logged, so restoring would revive them.
+typedef struct {
+    char token[SESSION_TOKEN_SIZE];
+    char email[MAX_EMAIL];
+    int64_t expires_at;
+} SnapshotSession;
+
+typedef struct Snapshot Snapshot;
+
+// Map path read-only. Returns NULL if it is missing or invalid; a
+// missing file leaves errno at ENOENT.
+Snapshot* snapshot_open(const char* path);
+const SnapshotUser* snapshot_users(const Snapshot* snap, size_t* count);
+const SnapshotFile* snapshot_files(const Snapshot* snap, size_t* count);
+void snapshot_close(Snapshot* snap);
+
+typedef struct SnapshotWriter SnapshotWriter;
+
+// Writes go to a temporary file that replaces path on commit, so a crash
+// mid-write leaves the previous snapshot intact. Records are written in
+// section order: all users, then files, then sessions.
+SnapshotWriter* snapshot_writer_open(const char* path);
+int snapshot_write_user(SnapshotWriter* writer, const char* email, const char* username,
+                        const char* password);
+int snapshot_write_file(SnapshotWriter* writer, const char* filename, const char* filehash,
+                        const char* owner_email, long file_size, int chunk_size);
+int snapshot_write_session(SnapshotWriter* writer, const char* token, const char* email,
+                           time_t expires_at);
+
+// Both release the writer. Commit returns -1 if anything failed to write.
+int snapshot_writer_commit(SnapshotWriter* writer);
+void snapshot_writer_abort(SnapshotWriter* writer);
+
+#endif
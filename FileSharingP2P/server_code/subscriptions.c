@@ -0,0 +1,202 @@
+#include "subscriptions.h"
+#include "search_index.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#define SUBSCRIPTION_BUCKETS 1024  // per kind; chains stay short for thousands of watches
+
+typedef struct Subscription {
+    Connection* conn;
+    int watch;
+    struct Subscription* prev;       // bucket chain
+    struct Subscription* next;
+    struct Subscription* conn_next;  // the connection's other subscriptions
+    char target[MAX_FILENAME];
+} Subscription;
+
+// One lock for everything: SUBSCRIBE is rare next to the catalog writes
+// that notify, and those are already serialized by files_mutex.
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static Subscription* keyword_buckets[SUBSCRIPTION_BUCKETS];  // by the keyword's first trigram
+static Subscription* short_keywords;  // shorter than SEARCH_MIN_KEYWORD
+static Subscription* hash_buckets[SUBSCRIPTION_BUCKETS];
+static int subscription_total = 0;  // read without the lock to skip idle notifies
+static uint64_t event_stamp = 0;
+
+static size_t trigram_bucket(const char* s) {
+    return hash_bytes(s, SEARCH_MIN_KEYWORD) & (SUBSCRIPTION_BUCKETS - 1);
+}
+
+static Subscription** bucket_for(int watch, const char* target) {
+    if (watch == WATCH_FILEHASH) {
+        return &hash_buckets[hash_string(target) & (SUBSCRIPTION_BUCKETS - 1)];
+    }
+    if (strlen(target) < SEARCH_MIN_KEYWORD) {
+        return &short_keywords;
+    }
+    return &keyword_buckets[trigram_bucket(target)];
+}
+
+// Copy target as it will be compared: filehashes in the lowercase hex the
+// catalog reports
+static void normalize_target(int watch, const char* target, char* out) {
+    strncpy(out, target, MAX_FILENAME - 1);
+    out[MAX_FILENAME - 1] = '\0';
+    if (watch == WATCH_FILEHASH) {
+        for (char* c = out; *c; c++) {
+            *c = (char)tolower((unsigned char)*c);
+        }
+    }
+}
+
+// Caller holds registry_lock
+static Subscription** find_locked(Connection* conn, int watch, const char* target) {
+    Subscription** link = &conn->subscriptions;
+    while (*link) {
+        if ((*link)->watch == watch && strcmp((*link)->target, target) == 0) {
+            return link;
+        }
+        link = &(*link)->conn_next;
+    }
+    return NULL;
+}
+
+// Caller holds registry_lock
+static void unlink_locked(Subscription* sub) {
+    if (sub->prev) {
+        sub->prev->next = sub->next;
+    } else {
+        *bucket_for(sub->watch, sub->target) = sub->next;
+    }
+    if (sub->next) {
+        sub->next->prev = sub->prev;
+    }
+    __atomic_sub_fetch(&subscription_total, 1, __ATOMIC_RELAXED);
+}
+
+int subscriptions_add(Connection* conn, int watch, const char* target) {
+    if (watch != WATCH_KEYWORD && watch != WATCH_FILEHASH) {
+        return RESP_INVALID_INPUT;
+    }
+    char key[MAX_FILENAME];
+    normalize_target(watch, target, key);
+
+    pthread_mutex_lock(&registry_lock);
+    int status = RESP_SUCCESS;
+    if (conn->subscription_count < 0 || conn->subscription_count >= MAX_SUBSCRIPTIONS) {
+        status = RESP_FAIL;  // closed, or holding too many
+    } else if (!find_locked(conn, watch, key)) {
+        Subscription* sub = (Subscription*)malloc(sizeof(Subscription));
+        if (!sub) {
+            status = RESP_FAIL;
+        } else {
+            sub->conn = conn;
+            sub->watch = watch;
+            memcpy(sub->target, key, MAX_FILENAME);
+
+            Subscription** bucket = bucket_for(watch, sub->target);
+            sub->prev = NULL;
+            sub->next = *bucket;
+            if (*bucket) (*bucket)->prev = sub;
+            *bucket = sub;
+
+            sub->conn_next = conn->subscriptions;
+            conn->subscriptions = sub;
+            conn->subscription_count++;
+            __atomic_add_fetch(&subscription_total, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return status;
+}
+
+int subscriptions_remove(Connection* conn, int watch, const char* target) {
+    char key[MAX_FILENAME];
+    normalize_target(watch, target, key);
+
+    pthread_mutex_lock(&registry_lock);
+    Subscription** link = find_locked(conn, watch, key);
+    Subscription* sub = link ? *link : NULL;
+    if (sub) {
+        *link = sub->conn_next;
+        conn->subscription_count--;
+        unlink_locked(sub);
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    if (!sub) {
+        return RESP_NOT_FOUND;
+    }
+    free(sub);
+    return RESP_SUCCESS;
+}
+
+void subscriptions_drop(Connection* conn) {
+    pthread_mutex_lock(&registry_lock);
+    Subscription* sub = conn->subscriptions;
+    conn->subscriptions = NULL;
+    conn->subscription_count = -1;
+    for (Subscription* s = sub; s; s = s->conn_next) {
+        unlink_locked(s);
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    while (sub) {
+        Subscription* next = sub->conn_next;
+        free(sub);
+        sub = next;
+    }
+}
+
+// Caller holds registry_lock. The registry keeps subscribed connections
+// alive: they are dropped on close, before the loop lets go of them.
+static void deliver_locked(Subscription* sub, const NotifyMessage* msg, uint64_t stamp) {
+    if (sub->conn->notify_stamp == stamp) {
+        return;  // another of its subscriptions matched already
+    }
+    sub->conn->notify_stamp = stamp;
+    conn_push(sub->conn, msg, sizeof(NotifyMessage));
+}
+
+void subscriptions_notify(const SearchFileInfo* file, int event, int seeders) {
+    if (__atomic_load_n(&subscription_total, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    NotifyMessage msg;
+    memset(&msg, 0, sizeof(NotifyMessage));
+    msg.header.command = CMD_NOTIFY;
+    msg.event = event;
+    msg.seeders = seeders;
+    msg.file = *file;
+
+    pthread_mutex_lock(&registry_lock);
+    uint64_t stamp = ++event_stamp;
+    if (event == NOTIFY_PUBLISHED) {
+        const char* name = file->filename;
+        for (Subscription* sub = short_keywords; sub; sub = sub->next) {
+            if (strstr(name, sub->target)) {
+                deliver_locked(sub, &msg, stamp);
+            }
+        }
+        // A name containing the keyword contains its first trigram somewhere
+        size_t len = strlen(name);
+        for (size_t i = 0; i + SEARCH_MIN_KEYWORD <= len; i++) {
+            for (Subscription* sub = keyword_buckets[trigram_bucket(name + i)]; sub; sub = sub->next) {
+                if (strncmp(name + i, sub->target, strlen(sub->target)) == 0) {
+                    deliver_locked(sub, &msg, stamp);
+                }
+            }
+        }
+    } else {
+        for (Subscription* sub = *bucket_for(WATCH_FILEHASH, file->filehash); sub; sub = sub->next) {
+            if (strcmp(sub->target, file->filehash) == 0) {
+                deliver_locked(sub, &msg, stamp);
+            }
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
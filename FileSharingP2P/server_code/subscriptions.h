@@ -0,0 +1,27 @@
+#ifndef SUBSCRIPTIONS_H
+#define SUBSCRIPTIONS_H
+
+#include "../protocol.h"
+#include "connection.h"
+
+// What clients asked to be told about (SUBSCRIBE), and the NOTIFY pushes
+// that answer catalog changes. Keyword watches are bucketed by their first
+// trigram, so a publish only looks at the watches whose trigram appears in
+// the new filename (keywords shorter than a trigram are checked every
+// time); filehash watches are a plain hash lookup.
+//
+// Each connection holds at most MAX_SUBSCRIPTIONS; they go away with it.
+
+// Returns a ResponseCode for the SUBSCRIBE reply
+int subscriptions_add(Connection* conn, int watch, const char* target);
+int subscriptions_remove(Connection* conn, int watch, const char* target);
+
+// Forget every subscription of a closing connection and refuse new ones.
+// Runs on the connection's loop.
+void subscriptions_drop(Connection* conn);
+
+// Push NOTIFY to every connection watching this change (a CatalogListener,
+// so it runs under files_mutex and keeps notifications in catalog order)
+void subscriptions_notify(const SearchFileInfo* file, int event, int seeders);
+
+#endif
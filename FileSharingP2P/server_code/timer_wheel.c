@@ -0,0 +1,124 @@
+#include "timer_wheel.h"
+#include <stdlib.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4  // 2^24 ticks ahead; later timers wait in the top level
+
+#define LEVEL_SPAN(level) ((uint64_t)1 << (WHEEL_BITS * ((level) + 1)))
+#define MAX_DELTA (LEVEL_SPAN(WHEEL_LEVELS - 1) - 1)
+
+struct TimerWheel {
+    uint64_t current;  // next tick to process
+    TimerEntry slots[WHEEL_LEVELS][WHEEL_SLOTS];  // circular list heads
+};
+
+static void list_init(TimerEntry* head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_append(TimerEntry* head, TimerEntry* entry) {
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+// Move every entry of from onto the empty list to
+static void list_take(TimerEntry* from, TimerEntry* to) {
+    if (from->next == from) {
+        list_init(to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+TimerWheel* timer_wheel_create(uint64_t now) {
+    TimerWheel* wheel = (TimerWheel*)malloc(sizeof(TimerWheel));
+    if (!wheel) return NULL;
+
+    wheel->current = now;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+    return wheel;
+}
+
+// The slot is picked by how far away the timer is, so a level's slots
+// only ever hold timers that are due within one turn of the level above
+static void place(TimerWheel* wheel, TimerEntry* entry) {
+    uint64_t expires = entry->expires;
+    if (expires < wheel->current) {
+        expires = wheel->current;
+    } else if (expires - wheel->current > MAX_DELTA) {
+        expires = wheel->current + MAX_DELTA;  // re-placed when cascaded
+    }
+
+    uint64_t delta = expires - wheel->current;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= LEVEL_SPAN(level)) {
+        level++;
+    }
+    list_append(&wheel->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK], entry);
+}
+
+void timer_wheel_schedule(TimerWheel* wheel, TimerEntry* entry, uint64_t expires) {
+    timer_wheel_cancel(entry);
+    entry->expires = expires;
+    place(wheel, entry);
+}
+
+void timer_wheel_cancel(TimerEntry* entry) {
+    if (!entry->next) return;
+
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+// Spread one slot of a higher level over the levels below it
+static void cascade(TimerWheel* wheel, int level, int slot) {
+    TimerEntry pending;
+    list_take(&wheel->slots[level][slot], &pending);
+    while (pending.next != &pending) {
+        TimerEntry* entry = pending.next;
+        timer_wheel_cancel(entry);
+        place(wheel, entry);
+    }
+}
+
+size_t timer_wheel_advance(TimerWheel* wheel, uint64_t now, TimerExpireFn expire, void* ctx) {
+    size_t fired = 0;
+    while (wheel->current <= now) {
+        int index = (int)(wheel->current & WHEEL_MASK);
+        // Level 0 wrapped: bring down the next slot of each level above
+        // until one of them has not wrapped either
+        for (int level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+            int slot = (int)((wheel->current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+            cascade(wheel, level, slot);
+            if (slot != 0) break;
+        }
+
+        // Detached first so a callback re-arming its timer cannot keep
+        // this list from draining
+        TimerEntry due;
+        list_take(&wheel->slots[0][index], &due);
+        wheel->current++;
+        while (due.next != &due) {
+            TimerEntry* entry = due.next;
+            timer_wheel_cancel(entry);
+            expire(entry, ctx);
+            fired++;
+        }
+    }
+    return fired;
+}
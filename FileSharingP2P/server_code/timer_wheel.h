@@ -0,0 +1,42 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel. Level 0 has one slot per tick; each higher
+// level covers a whole turn of the level below in every slot, and its
+// slots are cascaded down as time reaches them. Arming, re-arming and
+// cancelling a timer are O(1) whatever the number of timers, and an
+// advance only touches the slots that came due.
+//
+// Timers are intrusive: embed a TimerEntry in the record it belongs to.
+// Not thread-safe; the owner serializes access.
+typedef struct TimerEntry {
+    struct TimerEntry* next;  // NULL while not armed
+    struct TimerEntry* prev;
+    uint64_t expires;         // tick it fires at
+} TimerEntry;
+
+typedef struct TimerWheel TimerWheel;
+
+// Called for each timer that came due; the entry is already disarmed and
+// may be re-armed or freed by the callback
+typedef void (*TimerExpireFn)(TimerEntry* entry, void* ctx);
+
+TimerWheel* timer_wheel_create(uint64_t now);
+
+// Arm entry to fire at expires, moving it if it is already armed. Ticks
+// in the past fire on the next advance.
+void timer_wheel_schedule(TimerWheel* wheel, TimerEntry* entry, uint64_t expires);
+
+void timer_wheel_cancel(TimerEntry* entry);
+
+static inline int timer_wheel_armed(const TimerEntry* entry) {
+    return entry->next != NULL;
+}
+
+// Run every timer due at or before now. Returns how many fired.
+size_t timer_wheel_advance(TimerWheel* wheel, uint64_t now, TimerExpireFn expire, void* ctx);
+
+#endif
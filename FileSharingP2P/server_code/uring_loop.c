@@ -0,0 +1,682 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// liburing isn't a dependency: the ring is driven through the raw syscalls.
+
+#define URING_ENTRIES 1024       // submission slots per loop; completions get 4x
+#define RECV_BUFFERS 1024        // provided receive buffers per loop (power of two)
+#define RECV_BUFFER_SIZE RX_BUFFER_SIZE
+#define RECV_GROUP 0
+
+// Operation kind lives in the low bits of user_data (pointers are 8-aligned)
+#define OP_ACCEPT 1
+#define OP_WAKE   2
+#define OP_RECV   3
+#define OP_SEND   4
+#define OP_CANCEL 5
+#define OP_MASK   7ULL
+
+// Connection.recv_armed states
+#define RECV_IDLE       0
+#define RECV_ARMED      1
+#define RECV_CANCELLING 2
+
+typedef struct {
+    int fd;
+    void* ring_ptr;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;       // local tail, published on enter
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+} Ring;
+
+typedef struct UringLoop {
+    int id;
+    int listen_fd;
+    pthread_t thread;
+    const EventLoopHandlers* handlers;
+    Ring ring;
+
+    // Provided buffer ring the kernel picks receive buffers from
+    struct io_uring_buf_ring* buf_ring;
+    char* buf_base;
+    unsigned short buf_tail;
+
+    ConnList idle;
+    Connection* stall_head;
+    Connection* dirty_head;  // touched this batch; pumped once before the next enter
+
+    Mailbox mailbox;
+    uint64_t wake_count;     // target of the pending eventfd read
+} UringLoop;
+
+// ----------------------------------------------------------------
+//                              RING
+// ----------------------------------------------------------------
+
+static int ring_init(Ring* r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;  // multishot recv can post many completions per submission
+
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+
+    unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & needed) != needed) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    r->ring_ptr = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->ring_ptr == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring_ptr, r->ring_size);
+        close(r->fd);
+        return -1;
+    }
+
+    char* base = (char*)r->ring_ptr;
+    r->sq_head = (unsigned*)(base + p.sq_off.head);
+    r->sq_tail = (unsigned*)(base + p.sq_off.tail);
+    r->sq_array = (unsigned*)(base + p.sq_off.array);
+    r->sq_mask = *(unsigned*)(base + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+
+    r->cq_head = (unsigned*)(base + p.cq_off.head);
+    r->cq_tail = (unsigned*)(base + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)(base + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(base + p.cq_off.cqes);
+    return 0;
+}
+
+static void ring_destroy(Ring* r) {
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->ring_ptr, r->ring_size);
+    close(r->fd);
+}
+
+// Multishot recv shipped in the same release as SEND_ZC (6.0). The probe
+// has no entry for multishot itself, so SEND_ZC serves as the marker.
+static int ring_supports_multishot(Ring* r) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, len);
+    if (!probe) return 0;
+
+    int ok = 0;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        ok = probe->last_op >= IORING_OP_SEND_ZC &&
+             (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+// Submit queued entries and, when wait is set, block for at least one
+// completion or until timeout_ms passes.
+static int ring_enter(Ring* r, int wait, int timeout_ms) {
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    unsigned flags = 0;
+    void* argp = NULL;
+    size_t argsz = 0;
+
+    if (wait) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    int ret = (int)syscall(__NR_io_uring_enter, r->fd, to_submit, wait ? 1 : 0,
+                           flags, argp, argsz);
+    if (ret < 0 && (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+        return 0;
+    }
+    return ret;
+}
+
+static struct io_uring_sqe* ring_get_sqe(Ring* r) {
+    // Full: push what's queued to the kernel, which consumes it synchronously
+    while (r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries) {
+        ring_enter(r, 0, 0);
+    }
+
+    unsigned index = r->sqe_tail & r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    r->sqe_tail++;
+    return sqe;
+}
+
+// ----------------------------------------------------------------
+//                          OPERATIONS
+// ----------------------------------------------------------------
+
+static uint64_t op_tag(void* ptr, uint64_t op) {
+    return (uint64_t)(uintptr_t)ptr | op;
+}
+
+// Every operation naming a connection holds a reference and keeps its fd open
+static void uloop_op_start(Connection* conn) {
+    conn_retain(conn);
+    conn->uring_ops++;
+}
+
+static void uloop_op_done(Connection* conn) {
+    if (--conn->uring_ops == 0 && conn->closed && conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn_release(conn);
+}
+
+static void uloop_arm_accept(UringLoop* loop) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = op_tag(loop, OP_ACCEPT);
+}
+
+static void uloop_arm_wake(UringLoop* loop) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->mailbox.wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->wake_count;
+    sqe->len = sizeof(loop->wake_count);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = op_tag(loop, OP_WAKE);
+}
+
+static void uloop_arm_recv(UringLoop* loop, Connection* conn) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = op_tag(conn, OP_RECV);
+
+    conn->recv_armed = RECV_ARMED;
+    uloop_op_start(conn);
+}
+
+static void uloop_cancel_recv(UringLoop* loop, Connection* conn) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = op_tag(conn, OP_RECV);
+    sqe->user_data = op_tag(NULL, OP_CANCEL);
+
+    conn->recv_armed = RECV_CANCELLING;
+}
+
+static void uloop_submit_send(UringLoop* loop, Connection* conn) {
+    struct io_uring_sqe* sqe = ring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(conn->tx_inflight + conn->tx_inflight_off);
+    sqe->len = (unsigned)(conn->tx_inflight_len - conn->tx_inflight_off);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = op_tag(conn, OP_SEND);
+    uloop_op_start(conn);
+}
+
+// Hand everything queued so far to the kernel as one send
+static void uloop_start_send(UringLoop* loop, Connection* conn) {
+    conn->tx_inflight = conn->tx;
+    conn->tx_inflight_len = conn->tx_len;
+    conn->tx_inflight_off = conn->tx_off;
+    conn->tx = NULL;
+    conn->tx_len = conn->tx_off = conn->tx_cap = 0;
+    uloop_submit_send(loop, conn);
+}
+
+static void uloop_recycle_buffer(UringLoop* loop, unsigned bid) {
+    struct io_uring_buf* buf = &loop->buf_ring->bufs[loop->buf_tail & (RECV_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(loop->buf_base + (size_t)bid * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = (unsigned short)bid;
+    loop->buf_tail++;
+    __atomic_store_n(&loop->buf_ring->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+// ----------------------------------------------------------------
+//                          CONNECTION LIFECYCLE
+// ----------------------------------------------------------------
+
+static void uloop_close(UringLoop* loop, Connection* conn) {
+    if (conn->closed) return;
+
+    conn_list_unlink(&loop->idle, conn);
+    if (loop->handlers->on_close) {
+        loop->handlers->on_close(conn);
+    }
+    conn->closed = 1;
+
+    if (conn->uring_ops > 0) {
+        // The kernel still holds operations on this fd. Closing it now would
+        // let accept hand the number to a new client while they complete,
+        // so shut the socket down and close on the last completion.
+        shutdown(conn->fd, SHUT_RDWR);
+        if (conn->recv_armed == RECV_ARMED) {
+            uloop_cancel_recv(loop, conn);
+        }
+    } else {
+        conn_close(conn);
+    }
+    conn_release(conn);
+}
+
+static void uloop_mark_dirty(UringLoop* loop, Connection* conn) {
+    if (conn->dirty) return;
+    conn_retain(conn);
+    conn->dirty = 1;
+    conn->dirty_next = loop->dirty_head;
+    loop->dirty_head = conn;
+}
+
+// Same job as the epoll loop_pump: resume parked input, queue replies,
+// close after LOGOUT, and keep exactly one recv armed while input is wanted.
+static void uloop_pump(UringLoop* loop, Connection* conn) {
+    if (conn->rx_paused && conn_can_dispatch(conn)) {
+        if (conn_resume(conn, loop->handlers->on_request) < 0) {
+            uloop_close(loop, conn);
+            return;
+        }
+    }
+
+    if (!conn->tx_inflight) {
+        if (conn_has_pending_output(conn)) {
+            uloop_start_send(loop, conn);
+        } else if (conn->close_after_flush) {
+            uloop_close(loop, conn);
+            return;
+        }
+    }
+
+    // Stop pulling bytes the parser can't take yet; resume re-arms
+    if (conn->rx_len < RX_SPILL_LIMIT) {
+        if (conn->recv_armed == RECV_IDLE) {
+            uloop_arm_recv(loop, conn);
+        }
+    } else if (conn->recv_armed == RECV_ARMED) {
+        uloop_cancel_recv(loop, conn);
+    }
+
+    if (conn->stalled && !conn->in_stall_list) {
+        conn_retain(conn);
+        conn->in_stall_list = 1;
+        conn->stall_next = loop->stall_head;
+        loop->stall_head = conn;
+    }
+}
+
+static void uloop_pump_dirty(UringLoop* loop) {
+    while (loop->dirty_head) {
+        Connection* conn = loop->dirty_head;
+        loop->dirty_head = conn->dirty_next;
+        conn->dirty_next = NULL;
+        conn->dirty = 0;
+        if (!conn->closed) {
+            uloop_pump(loop, conn);
+        }
+        conn_release(conn);
+    }
+}
+
+static void uloop_retry_stalled(UringLoop* loop) {
+    Connection* conn = loop->stall_head;
+    loop->stall_head = NULL;
+
+    while (conn) {
+        Connection* next = conn->stall_next;
+        conn->stall_next = NULL;
+        conn->in_stall_list = 0;
+        conn->stalled = 0;
+        if (!conn->closed) {
+            uloop_mark_dirty(loop, conn);
+        }
+        conn_release(conn);
+        conn = next;
+    }
+}
+
+// ----------------------------------------------------------------
+//                          COMPLETIONS
+// ----------------------------------------------------------------
+
+static void uloop_on_accept(UringLoop* loop, const struct io_uring_cqe* cqe) {
+    if (cqe->res >= 0) {
+        int fd = cqe->res;
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        getpeername(fd, (struct sockaddr*)&addr, &addr_len);
+
+        Connection* conn = conn_create(fd, &addr);
+        if (!conn) {
+            close(fd);
+        } else {
+            conn->loop = loop;
+            conn->mailbox = &loop->mailbox;
+            conn_list_append(&loop->idle, conn);
+            uloop_arm_recv(loop, conn);
+
+            printf("[CONNECT] New connection from %s:%d (loop %d, %d client(s))\n",
+                   conn->client_ip, conn->client_port, loop->id, loop->idle.count);
+        }
+    } else if (cqe->res != -ECONNABORTED) {
+        printf("[ERROR] accept failed: %s\n", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uloop_arm_accept(loop);
+    }
+}
+
+static void uloop_on_wake(UringLoop* loop, const struct io_uring_cqe* cqe) {
+    if (cqe->res < 0 && cqe->res != -EAGAIN) {
+        printf("[ERROR] eventfd read failed: %s\n", strerror(-cqe->res));
+    }
+
+    Request* req = mailbox_take(&loop->mailbox);
+    while (req) {
+        Request* next = req->next;
+        Connection* conn = req->conn;
+
+        if (conn_complete(conn, req)) {
+            uloop_mark_dirty(loop, conn);
+        } else if (req->login_email[0] != '\0' && loop->handlers->on_close) {
+            // Client left while its login was being processed
+            loop->handlers->on_close(conn);
+        }
+
+        request_free(req);
+        req = next;
+    }
+
+    uloop_arm_wake(loop);
+}
+
+static void uloop_on_recv(UringLoop* loop, Connection* conn, const struct io_uring_cqe* cqe) {
+    if (cqe->res > 0) {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!conn->closed) {
+            const char* data = loop->buf_base + (size_t)bid * RECV_BUFFER_SIZE;
+            if (conn_feed(conn, data, (size_t)cqe->res, loop->handlers->on_request) < 0) {
+                // Best effort: push out replies to requests already processed
+                if (!conn->tx_inflight) conn_flush(conn);
+                uloop_close(loop, conn);
+            } else {
+                conn_list_touch(&loop->idle, conn);
+                uloop_mark_dirty(loop, conn);
+            }
+        }
+        uloop_recycle_buffer(loop, bid);
+    } else if (cqe->res == 0) {
+        if (!conn->closed) {
+            printf("[INFO] Client disconnected gracefully.\n");
+            uloop_close(loop, conn);
+        }
+    } else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        if (!conn->closed) {
+            printf("[ERROR] recv failed: %s\n", strerror(-cqe->res));
+            uloop_close(loop, conn);
+        }
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        // Multishot ended (EOF, error, cancel or out of buffers); the pump
+        // re-arms it if the connection still wants input
+        conn->recv_armed = RECV_IDLE;
+        if (!conn->closed) {
+            uloop_mark_dirty(loop, conn);
+        }
+        uloop_op_done(conn);
+    }
+}
+
+static void uloop_on_send(UringLoop* loop, Connection* conn, const struct io_uring_cqe* cqe) {
+    if (cqe->res < 0) {
+        if (!conn->closed) {
+            printf("[ERROR] send failed: %s\n", strerror(-cqe->res));
+            uloop_close(loop, conn);
+        }
+    } else {
+        conn->tx_inflight_off += (size_t)cqe->res;
+        if (conn->tx_inflight_off < conn->tx_inflight_len && !conn->closed) {
+            // Short send: the rest goes out before anything queued since
+            uloop_submit_send(loop, conn);
+            uloop_op_done(conn);
+            return;
+        }
+    }
+
+    free(conn->tx_inflight);
+    conn->tx_inflight = NULL;
+    conn->tx_inflight_len = conn->tx_inflight_off = 0;
+    if (!conn->closed) {
+        uloop_mark_dirty(loop, conn);
+    }
+    uloop_op_done(conn);
+}
+
+static void uloop_reap(UringLoop* loop) {
+    Ring* r = &loop->ring;
+    unsigned head = *r->cq_head;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe cqe = r->cqes[head & r->cq_mask];
+        head++;
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+        void* ptr = (void*)(uintptr_t)(cqe.user_data & ~OP_MASK);
+        switch (cqe.user_data & OP_MASK) {
+            case OP_ACCEPT:
+                uloop_on_accept(loop, &cqe);
+                break;
+            case OP_WAKE:
+                uloop_on_wake(loop, &cqe);
+                break;
+            case OP_RECV:
+                uloop_on_recv(loop, (Connection*)ptr, &cqe);
+                break;
+            case OP_SEND:
+                uloop_on_send(loop, (Connection*)ptr, &cqe);
+                break;
+            default:
+                break;  // cancel results carry nothing to act on
+        }
+    }
+}
+
+static void uloop_sweep_idle(UringLoop* loop, time_t now) {
+    while (loop->idle.head &&
+           now - loop->idle.head->last_active > CLIENT_IDLE_TIMEOUT) {
+        Connection* conn = loop->idle.head;
+        printf("[INFO] Closing idle connection %s:%d\n", conn->client_ip, conn->client_port);
+        uloop_close(loop, conn);
+    }
+}
+
+static void* uloop_main(void* arg) {
+    UringLoop* loop = (UringLoop*)arg;
+    time_t last_sweep = time(NULL);
+
+    uloop_arm_accept(loop);
+    uloop_arm_wake(loop);
+
+    while (1) {
+        int timeout = loop->stall_head ? STALL_RETRY_MS : 1000;
+        if (ring_enter(&loop->ring, 1, timeout) < 0) {
+            perror("io_uring_enter failed");
+            break;
+        }
+
+        uloop_reap(loop);
+        if (loop->stall_head) {
+            uloop_retry_stalled(loop);
+        }
+        // Sends queued by every completion above go out in the next enter
+        uloop_pump_dirty(loop);
+
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            uloop_sweep_idle(loop, now);
+            last_sweep = now;
+        }
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------
+//                              STARTUP
+// ----------------------------------------------------------------
+
+// Leaves nothing allocated when it fails
+static int uloop_init(UringLoop* loop) {
+    if (ring_init(&loop->ring, URING_ENTRIES) < 0) {
+        return -1;
+    }
+    if (!ring_supports_multishot(&loop->ring)) {
+        ring_destroy(&loop->ring);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t ring_bytes = RECV_BUFFERS * sizeof(struct io_uring_buf);
+    void* mem = mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    loop->buf_base = (char*)malloc((size_t)RECV_BUFFERS * RECV_BUFFER_SIZE);
+    if (mem == MAP_FAILED || !loop->buf_base) {
+        int saved = errno;
+        ring_destroy(&loop->ring);
+        if (mem != MAP_FAILED) munmap(mem, ring_bytes);
+        free(loop->buf_base);
+        loop->buf_base = NULL;
+        errno = saved;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = RECV_GROUP;
+    if (syscall(__NR_io_uring_register, loop->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 ||
+        mailbox_init(&loop->mailbox) < 0) {
+        int saved = errno;
+        ring_destroy(&loop->ring);
+        munmap(mem, ring_bytes);
+        free(loop->buf_base);
+        loop->buf_base = NULL;
+        errno = saved;
+        return -1;
+    }
+
+    loop->buf_ring = (struct io_uring_buf_ring*)mem;
+    loop->buf_tail = 0;
+    for (unsigned bid = 0; bid < RECV_BUFFERS; bid++) {
+        uloop_recycle_buffer(loop, bid);
+    }
+    return 0;
+}
+
+// Undo uloop_init for a loop that never ran. Closing the ring fd tears
+// down the buffer registration with it.
+static void uloop_destroy(UringLoop* loop) {
+    ring_destroy(&loop->ring);
+    munmap(loop->buf_ring, RECV_BUFFERS * sizeof(struct io_uring_buf));
+    free(loop->buf_base);
+    mailbox_destroy(&loop->mailbox);
+}
+
+int uring_loops_run(const int* listen_fds, int num_loops, const EventLoopHandlers* handlers) {
+    if (num_loops < 1) num_loops = 1;
+
+    UringLoop* loops = (UringLoop*)calloc(num_loops, sizeof(UringLoop));
+    if (!loops) {
+        perror("Failed to allocate io_uring loops");
+        return -1;
+    }
+
+    for (int i = 0; i < num_loops; i++) {
+        UringLoop* loop = &loops[i];
+        loop->id = i;
+        loop->listen_fd = listen_fds[i];
+        loop->handlers = handlers;
+        if (uloop_init(loop) < 0) {
+            printf("[INFO] io_uring unavailable: %s\n", strerror(errno));
+            for (int j = 0; j < i; j++) {
+                uloop_destroy(&loops[j]);
+            }
+            free(loops);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < num_loops; i++) {
+        if (pthread_create(&loops[i].thread, NULL, uloop_main, &loops[i]) != 0) {
+            // Earlier loops already accept on the shared listeners; falling
+            // back to epoll now would run both backends on them
+            perror("Could not create io_uring loop thread");
+            exit(1);
+        }
+        event_loop_pin_thread(loops[i].thread, i);
+    }
+
+    printf("Started %d io_uring event loop(s)\n", num_loops);
+
+    for (int i = 0; i < num_loops; i++) {
+        pthread_join(loops[i].thread, NULL);
+    }
+    return 0;
+}
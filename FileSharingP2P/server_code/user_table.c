@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include "user_table.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define USER_TABLE_MAX_LOAD 70  // percent of slots in use before doubling
+
+// 8-byte probe slot. The tag rejects nearly every mismatch without touching
+// the record, so a probe run stays inside a cache line or two.
+typedef struct {
+    uint32_t tag;    // high half of the key hash
+    uint32_t index;  // record index + 1; 0 marks an empty slot
+} Slot;
+
+struct UserTable {
+    pthread_rwlock_t lock;
+    Slot* slots;
+    size_t mask;
+
+    // Dense, append-only: keeps registration order for saving
+    UserRecord* records;
+    size_t count;
+    size_t records_cap;
+};
+
+static void copy_field(char* dst, const char* src, size_t size) {
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+// The slot holding email, or the empty slot where it would go
+static Slot* find_slot(const UserTable* table, const char* email, uint64_t h) {
+    uint32_t tag = (uint32_t)(h >> 32);
+    size_t i = (size_t)h & table->mask;
+
+    while (1) {
+        Slot* slot = &table->slots[i];
+        if (slot->index == 0) {
+            return slot;
+        }
+        if (slot->tag == tag && strcmp(table->records[slot->index - 1].email, email) == 0) {
+            return slot;
+        }
+        i = (i + 1) & table->mask;
+    }
+}
+
+static int grow_slots(UserTable* table) {
+    size_t capacity = (table->mask + 1) * 2;
+    Slot* slots = (Slot*)calloc(capacity, sizeof(Slot));
+    if (!slots) {
+        perror("Failed to grow user table");
+        return -1;
+    }
+
+    for (size_t r = 0; r < table->count; r++) {
+        uint64_t h = hash_string(table->records[r].email);
+        size_t i = (size_t)h & (capacity - 1);
+        while (slots[i].index != 0) {
+            i = (i + 1) & (capacity - 1);
+        }
+        slots[i].tag = (uint32_t)(h >> 32);
+        slots[i].index = (uint32_t)(r + 1);
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->mask = capacity - 1;
+    return 0;
+}
+
+static int grow_records(UserTable* table) {
+    size_t capacity = table->records_cap ? table->records_cap * 2 : 1024;
+    UserRecord* records = (UserRecord*)realloc(table->records, capacity * sizeof(UserRecord));
+    if (!records) {
+        perror("Failed to grow user records");
+        return -1;
+    }
+    table->records = records;
+    table->records_cap = capacity;
+    return 0;
+}
+
+UserTable* user_table_create(size_t expected_users) {
+    UserTable* table = (UserTable*)calloc(1, sizeof(UserTable));
+    if (!table) return NULL;
+
+    size_t capacity = hash_capacity_for(expected_users * 100 / USER_TABLE_MAX_LOAD + 1);
+    table->slots = (Slot*)calloc(capacity, sizeof(Slot));
+    if (!table->slots) {
+        free(table);
+        return NULL;
+    }
+    table->mask = capacity - 1;
+    pthread_rwlock_init(&table->lock, NULL);
+    return table;
+}
+
+int user_table_insert(UserTable* table, const char* email, const char* username,
+                      const char* password) {
+    uint64_t h = hash_string(email);
+
+    pthread_rwlock_wrlock(&table->lock);
+
+    Slot* slot = find_slot(table, email, h);
+    if (slot->index != 0) {
+        pthread_rwlock_unlock(&table->lock);
+        return 0;
+    }
+
+    if (table->count == table->records_cap && grow_records(table) < 0) {
+        pthread_rwlock_unlock(&table->lock);
+        return 0;
+    }
+    if ((table->count + 1) * 100 > (table->mask + 1) * USER_TABLE_MAX_LOAD) {
+        if (grow_slots(table) < 0) {
+            pthread_rwlock_unlock(&table->lock);
+            return 0;
+        }
+        slot = find_slot(table, email, h);
+    }
+
+    UserRecord* user = &table->records[table->count];
+    copy_field(user->email, email, sizeof(user->email));
+    copy_field(user->username, username, sizeof(user->username));
+    copy_field(user->password, password, sizeof(user->password));
+
+    table->count++;
+    slot->tag = (uint32_t)(h >> 32);
+    slot->index = (uint32_t)table->count;
+
+    pthread_rwlock_unlock(&table->lock);
+    return 1;
+}
+
+int user_table_check_password(UserTable* table, const char* email, const char* password) {
+    uint64_t h = hash_string(email);
+
+    pthread_rwlock_rdlock(&table->lock);
+    Slot* slot = find_slot(table, email, h);
+    int ok = slot->index != 0 &&
+             strcmp(table->records[slot->index - 1].password, password) == 0;
+    pthread_rwlock_unlock(&table->lock);
+    return ok;
+}
+
+int user_table_get_username(UserTable* table, const char* email, char* username_out) {
+    uint64_t h = hash_string(email);
+
+    pthread_rwlock_rdlock(&table->lock);
+    Slot* slot = find_slot(table, email, h);
+    int found = slot->index != 0;
+    if (found) {
+        strcpy(username_out, table->records[slot->index - 1].username);
+    }
+    pthread_rwlock_unlock(&table->lock);
+    return found;
+}
+
+uint32_t user_table_id(UserTable* table, const char* email) {
+    uint64_t h = hash_string(email);
+
+    pthread_rwlock_rdlock(&table->lock);
+    uint32_t id = find_slot(table, email, h)->index;
+    pthread_rwlock_unlock(&table->lock);
+    return id;
+}
+
+int user_table_email(UserTable* table, uint32_t id, char* email_out) {
+    pthread_rwlock_rdlock(&table->lock);
+    int found = id != 0 && id <= table->count;
+    if (found) {
+        strcpy(email_out, table->records[id - 1].email);
+    }
+    pthread_rwlock_unlock(&table->lock);
+    return found;
+}
+
+size_t user_table_count(UserTable* table) {
+    pthread_rwlock_rdlock(&table->lock);
+    size_t count = table->count;
+    pthread_rwlock_unlock(&table->lock);
+    return count;
+}
+
+void user_table_foreach(UserTable* table, void (*fn)(const UserRecord* user, void* ctx), void* ctx) {
+    pthread_rwlock_rdlock(&table->lock);
+    for (size_t i = 0; i < table->count; i++) {
+        fn(&table->records[i], ctx);
+    }
+    pthread_rwlock_unlock(&table->lock);
+}
+
+void user_table_fork_prepare(UserTable* table) {
+    pthread_rwlock_wrlock(&table->lock);
+}
+
+void user_table_fork_parent(UserTable* table) {
+    pthread_rwlock_unlock(&table->lock);
+}
+
+void user_table_fork_child(UserTable* table) {
+    pthread_rwlock_init(&table->lock, NULL);
+}
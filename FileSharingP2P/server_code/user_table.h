@@ -0,0 +1,47 @@
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include "../protocol.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    char email[MAX_EMAIL];
+    char username[MAX_USERNAME];
+    char password[MAX_PASSWORD];
+} UserRecord;
+
+// Registered accounts keyed by email. Open addressing with linear probing
+// over a flat slot array; lookups take a shared lock so logins don't
+// serialize behind each other.
+typedef struct UserTable UserTable;
+
+UserTable* user_table_create(size_t expected_users);
+
+// Returns 0 if the email is already registered
+int user_table_insert(UserTable* table, const char* email, const char* username,
+                      const char* password);
+
+int user_table_check_password(UserTable* table, const char* email, const char* password);
+int user_table_get_username(UserTable* table, const char* email, char* username_out);
+
+// Accounts are never removed, so a user's id (its registration number,
+// starting at 1) is stable and can stand in for the email elsewhere.
+// Returns 0 if email is not registered.
+uint32_t user_table_id(UserTable* table, const char* email);
+
+// Copies the email of user id into email_out; returns 0 for an unknown id
+int user_table_email(UserTable* table, uint32_t id, char* email_out);
+size_t user_table_count(UserTable* table);
+
+// Visit every account in registration order under the shared lock
+void user_table_foreach(UserTable* table, void (*fn)(const UserRecord* user, void* ctx), void* ctx);
+
+// Bracket a fork(): prepare takes the lock exclusively so the child copies
+// a table no writer is halfway through; afterwards the parent releases it
+// and the child, whose copy of the lock is stale, gets a fresh one.
+void user_table_fork_prepare(UserTable* table);
+void user_table_fork_parent(UserTable* table);
+void user_table_fork_child(UserTable* table);
+
+#endif
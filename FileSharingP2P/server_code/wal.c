@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include "wal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define WAL_HEADER_SIZE 8                     // length + crc
+#define WAL_FLUSH_BYTES (1024 * 1024)         // flush early once this much is queued
+#define WAL_MAX_QUEUED (64 * 1024 * 1024)     // appenders wait beyond this
+
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+} WalBuffer;
+
+struct Wal {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;     // persistence thread
+    pthread_cond_t flushed;  // appenders and rotate waiting on a flush
+    int fd;
+    char path[256];
+    WalOptions options;
+
+    WalBuffer queue;  // filled by appenders
+    WalBuffer spare;  // the flusher's buffer, swapped in on each flush
+    int flushing;     // a write is in progress without the lock
+
+    // Byte offsets over the life of the process, across rotations
+    uint64_t appended;  // end of the last queued record
+    uint64_t done;      // everything below is written (and synced if the policy says so)
+    uint64_t lost_from; // last failed flush dropped [lost_from, lost_to)
+    uint64_t lost_to;
+
+    size_t size;       // current file length, queued records included
+    size_t file_size;  // bytes actually in the current file
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const unsigned char* data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        c = crc_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static int write_full(int fd, const unsigned char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+long wal_replay(const char* path, WalReplayFn fn, void* ctx) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    unsigned char* data = size ? (unsigned char*)malloc(size) : NULL;
+    if (size && !data) {
+        close(fd);
+        return -1;
+    }
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, data + got, size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += n;
+    }
+
+    long records = 0;
+    size_t offset = 0;
+    while (offset + WAL_HEADER_SIZE <= got) {
+        uint32_t len = get_u32(data + offset);
+        uint32_t crc = get_u32(data + offset + 4);
+        if (len == 0 || len > WAL_MAX_PAYLOAD + 1 || offset + WAL_HEADER_SIZE + len > got) {
+            break;
+        }
+        const unsigned char* body = data + offset + WAL_HEADER_SIZE;
+        if (crc32(body, len) != crc) {
+            break;
+        }
+        fn(body[0], body + 1, len - 1, ctx);
+        records++;
+        offset += WAL_HEADER_SIZE + len;
+    }
+
+    if (offset < size) {
+        fprintf(stderr, "[WAL] %s: dropping %zu byte(s) of torn or corrupt tail\n", path, size - offset);
+        if (ftruncate(fd, (off_t)offset) < 0) {
+            perror("Failed to truncate WAL tail");
+        }
+    }
+
+    free(data);
+    close(fd);
+    return records;
+}
+
+static int open_log(const char* path) {
+    return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+// Write the queue out; called and returns with the lock held, but drops it
+// for the I/O so appenders keep going.
+static int flush_locked(Wal* wal) {
+    while (wal->flushing) {
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+    }
+    if (wal->queue.len == 0) {
+        return 0;
+    }
+
+    WalBuffer batch = wal->queue;
+    wal->queue = wal->spare;
+    wal->queue.len = 0;
+    uint64_t start = wal->done;
+    uint64_t end = wal->appended;
+    size_t file_size = wal->file_size;
+    int fd = wal->fd;
+    wal->flushing = 1;
+    pthread_mutex_unlock(&wal->lock);
+
+    int rc = write_full(fd, batch.data, batch.len);
+    if (rc == 0 && wal->options.sync != WAL_SYNC_NONE) {
+        rc = fdatasync(fd);
+    }
+    if (rc < 0) {
+        perror("WAL flush failed");
+        // A torn batch mid-log would hide every later record from replay
+        if (ftruncate(fd, (off_t)file_size) < 0) {
+            perror("Failed to roll back partial WAL write");
+        }
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    if (rc == 0) {
+        wal->file_size += batch.len;
+    } else {
+        wal->size -= batch.len;
+        wal->lost_from = start;
+        wal->lost_to = end;
+    }
+    batch.len = 0;
+    wal->spare = batch;
+    wal->done = end;
+    wal->flushing = 0;
+    pthread_cond_broadcast(&wal->flushed);
+    return rc;
+}
+
+static void* persistence_thread(void* arg) {
+    Wal* wal = (Wal*)arg;
+
+    pthread_mutex_lock(&wal->lock);
+    while (1) {
+        if (wal->options.sync == WAL_SYNC_ALWAYS) {
+            // Whatever queued up during the last fsync goes out together
+            while (wal->queue.len == 0) {
+                pthread_cond_wait(&wal->wake, &wal->lock);
+            }
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += wal->options.flush_ms / 1000;
+            deadline.tv_nsec += (long)(wal->options.flush_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (wal->queue.len < WAL_FLUSH_BYTES &&
+                   pthread_cond_timedwait(&wal->wake, &wal->lock, &deadline) != ETIMEDOUT) {
+            }
+        }
+        flush_locked(wal);
+    }
+    return NULL;
+}
+
+Wal* wal_open(const char* path, const WalOptions* options) {
+    Wal* wal = (Wal*)calloc(1, sizeof(Wal));
+    if (!wal) return NULL;
+
+    snprintf(wal->path, sizeof(wal->path), "%s", path);
+    wal->options = *options;
+    if (wal->options.flush_ms < 1) {
+        wal->options.flush_ms = 1;
+    }
+    wal->fd = open_log(path);
+    if (wal->fd < 0) {
+        perror("Failed to open WAL");
+        free(wal);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(wal->fd, &st) == 0) {
+        wal->size = wal->file_size = (size_t)st.st_size;
+    }
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->wake, NULL);
+    pthread_cond_init(&wal->flushed, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, persistence_thread, wal) != 0) {
+        perror("Failed to start WAL persistence thread");
+        close(wal->fd);
+        free(wal);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return wal;
+}
+
+static int buffer_reserve(WalBuffer* buffer, size_t extra) {
+    if (buffer->len + extra <= buffer->cap) {
+        return 0;
+    }
+    size_t capacity = buffer->cap ? buffer->cap : 64 * 1024;
+    while (capacity < buffer->len + extra) {
+        capacity *= 2;
+    }
+    unsigned char* data = (unsigned char*)realloc(buffer->data, capacity);
+    if (!data) {
+        return -1;
+    }
+    buffer->data = data;
+    buffer->cap = capacity;
+    return 0;
+}
+
+uint64_t wal_append(Wal* wal, uint8_t type, const void* payload, size_t len) {
+    if (len > WAL_MAX_PAYLOAD) {
+        return 0;
+    }
+
+    unsigned char record[WAL_HEADER_SIZE + 1 + WAL_MAX_PAYLOAD];
+    unsigned char* body = record + WAL_HEADER_SIZE;
+    body[0] = type;
+    memcpy(body + 1, payload, len);
+    put_u32(record, (uint32_t)(len + 1));
+    put_u32(record + 4, crc32(body, len + 1));
+    size_t total = WAL_HEADER_SIZE + 1 + len;
+
+    pthread_mutex_lock(&wal->lock);
+
+    // Bound memory if the disk cannot keep up
+    while (wal->queue.len >= WAL_MAX_QUEUED) {
+        pthread_cond_signal(&wal->wake);
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+    }
+    if (buffer_reserve(&wal->queue, total) < 0) {
+        pthread_mutex_unlock(&wal->lock);
+        perror("WAL append failed");
+        return 0;
+    }
+
+    memcpy(wal->queue.data + wal->queue.len, record, total);
+    wal->queue.len += total;
+    wal->size += total;
+    wal->appended += total;
+    uint64_t ticket = wal->appended;
+
+    if (wal->options.sync == WAL_SYNC_ALWAYS || wal->queue.len >= WAL_FLUSH_BYTES) {
+        pthread_cond_signal(&wal->wake);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return ticket;
+}
+
+int wal_commit(Wal* wal, uint64_t ticket) {
+    if (wal->options.sync != WAL_SYNC_ALWAYS) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    while (wal->done < ticket) {
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+    }
+    int rc = (ticket > wal->lost_from && ticket <= wal->lost_to) ? -1 : 0;
+    pthread_mutex_unlock(&wal->lock);
+    return rc;
+}
+
+int wal_flush(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    int rc = flush_locked(wal);
+    pthread_mutex_unlock(&wal->lock);
+    return rc;
+}
+
+int wal_rotate(Wal* wal, const char* old_path) {
+    pthread_mutex_lock(&wal->lock);
+
+    // Queued records belong to the log being retired
+    if (flush_locked(wal) < 0) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+
+    if (rename(wal->path, old_path) < 0) {
+        pthread_mutex_unlock(&wal->lock);
+        perror("Failed to rotate WAL");
+        return -1;
+    }
+    int fd = open_log(wal->path);
+    if (fd < 0) {
+        // Keep appending to the renamed file rather than lose records
+        rename(old_path, wal->path);
+        pthread_mutex_unlock(&wal->lock);
+        perror("Failed to start a new WAL");
+        return -1;
+    }
+
+    close(wal->fd);
+    wal->fd = fd;
+    wal->size = wal->queue.len;
+    wal->file_size = 0;
+    pthread_mutex_unlock(&wal->lock);
+    return 0;
+}
+
+size_t wal_size(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    size_t size = wal->size;
+    pthread_mutex_unlock(&wal->lock);
+    return size;
+}
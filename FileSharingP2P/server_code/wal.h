@@ -0,0 +1,62 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Append-only write-ahead log. Each record is framed as
+//   uint32 length | uint32 crc32 | uint8 type | payload
+// where length and the CRC cover type and payload. A crash can only leave
+// a torn record at the tail; replay stops there and cuts it off.
+//
+// Appends only copy the record into memory. A persistence thread writes
+// whatever has accumulated in one write() and syncs it per the policy, so
+// bursts of mutations coalesce and requests never wait on the disk unless
+// WAL_SYNC_ALWAYS asks for it.
+typedef struct Wal Wal;
+
+#define WAL_MAX_PAYLOAD 4096
+
+typedef enum {
+    WAL_SYNC_NONE,      // write every flush_ms, leave syncing to the kernel
+    WAL_SYNC_INTERVAL,  // write and fdatasync every flush_ms
+    WAL_SYNC_ALWAYS     // wal_commit() waits for durability; waiters share an fsync
+} WalSyncPolicy;
+
+typedef struct {
+    WalSyncPolicy sync;
+    int flush_ms;  // batching window for NONE and INTERVAL
+} WalOptions;
+
+typedef void (*WalReplayFn)(uint8_t type, const unsigned char* payload, size_t len, void* ctx);
+
+// Feed every intact record of path to fn, in order. A missing file
+// replays nothing. Returns the number of records, or -1 on I/O error.
+long wal_replay(const char* path, WalReplayFn fn, void* ctx);
+
+// Open (or create) path for appending and start its persistence thread
+Wal* wal_open(const char* path, const WalOptions* options);
+
+// Queue one record without waiting for the disk. Returns a ticket for
+// wal_commit(), or 0 if the record is too large or cannot be queued.
+uint64_t wal_append(Wal* wal, uint8_t type, const void* payload, size_t len);
+
+// Under WAL_SYNC_ALWAYS, wait until the record behind ticket is durable;
+// returns -1 if its flush failed. Other policies return at once. Kept
+// apart from wal_append so callers can queue under their own locks and
+// wait outside them, letting concurrent commits share one fsync.
+int wal_commit(Wal* wal, uint64_t ticket);
+
+// Write out queued records now, synced unless the policy is NONE.
+// Returns -1 on I/O error.
+int wal_flush(Wal* wal);
+
+// Move the current log (queued records included) to old_path and continue
+// in an empty one at the original path. Used by compaction; old_path is
+// deleted once the snapshot covering it is safely on disk.
+int wal_rotate(Wal* wal, const char* old_path);
+
+// Current length of the log in bytes, queued records included
+size_t wal_size(Wal* wal);
+
+#endif
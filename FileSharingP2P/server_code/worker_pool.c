@@ -0,0 +1,166 @@
+#include "worker_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct {
+    JobFn fn;
+    void* arg;
+} Job;
+
+// Bounded ring of jobs; the owner and thieves both take from the head
+typedef struct {
+    pthread_mutex_t lock;
+    Job* jobs;
+    int head;
+    int count;
+    int capacity;
+} WorkQueue;
+
+typedef struct {
+    WorkerPool* pool;
+    int index;
+} WorkerArg;
+
+struct WorkerPool {
+    int num_workers;
+    WorkQueue* queues;
+    WorkerArg* args;
+    pthread_t* threads;
+
+    int pending;       // jobs queued across all workers (atomic)
+    int sleepers;      // workers blocked on idle_cond (atomic)
+    unsigned int next_queue;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+};
+
+static int queue_push(WorkQueue* q, JobFn fn, void* arg) {
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->capacity) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    Job* job = &q->jobs[(q->head + q->count) % q->capacity];
+    job->fn = fn;
+    job->arg = arg;
+    q->count++;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static int queue_pop(WorkQueue* q, Job* out) {
+    pthread_mutex_lock(&q->lock);
+    if (q->count == 0) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    *out = q->jobs[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+// Own queue first, then steal from the others starting at the neighbour
+static int pool_take(WorkerPool* pool, int self, Job* out) {
+    for (int i = 0; i < pool->num_workers; i++) {
+        WorkQueue* q = &pool->queues[(self + i) % pool->num_workers];
+        if (queue_pop(q, out) == 0) {
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void* worker_main(void* arg) {
+    WorkerArg* worker = (WorkerArg*)arg;
+    WorkerPool* pool = worker->pool;
+    Job job;
+
+    while (1) {
+        if (pool_take(pool, worker->index, &job) == 0) {
+            job.fn(job.arg);
+            continue;
+        }
+
+        // Nothing to run anywhere: sleep until a submit bumps pending.
+        // sleepers is raised before pending is re-checked so a concurrent
+        // submit either sees the sleeper or we see its job.
+        pthread_mutex_lock(&pool->idle_lock);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) <= 0) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return NULL;
+}
+
+int worker_pool_submit(WorkerPool* pool, JobFn fn, void* arg) {
+    unsigned int start = __atomic_fetch_add(&pool->next_queue, 1, __ATOMIC_RELAXED);
+
+    // Round-robin placement; spill to the next queue when one is full
+    int queued = -1;
+    for (int i = 0; i < pool->num_workers && queued < 0; i++) {
+        queued = queue_push(&pool->queues[(start + i) % pool->num_workers], fn, arg);
+    }
+    if (queued < 0) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return 0;
+}
+
+WorkerPool* worker_pool_create(int num_workers, int capacity) {
+    if (num_workers < 1) num_workers = 1;
+    if (capacity < num_workers) capacity = num_workers;
+
+    WorkerPool* pool = (WorkerPool*)calloc(1, sizeof(WorkerPool));
+    if (!pool) return NULL;
+
+    pool->num_workers = num_workers;
+    pool->queues = (WorkQueue*)calloc(num_workers, sizeof(WorkQueue));
+    pool->args = (WorkerArg*)calloc(num_workers, sizeof(WorkerArg));
+    pool->threads = (pthread_t*)calloc(num_workers, sizeof(pthread_t));
+    if (!pool->queues || !pool->args || !pool->threads) {
+        perror("Failed to allocate worker pool");
+        return NULL;
+    }
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+
+    int per_queue = (capacity + num_workers - 1) / num_workers;
+    for (int i = 0; i < num_workers; i++) {
+        WorkQueue* q = &pool->queues[i];
+        pthread_mutex_init(&q->lock, NULL);
+        q->capacity = per_queue;
+        q->jobs = (Job*)calloc(per_queue, sizeof(Job));
+        if (!q->jobs) {
+            perror("Failed to allocate work queue");
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        pool->args[i].pool = pool;
+        pool->args[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->args[i]) != 0) {
+            perror("Could not create worker thread");
+            return NULL;
+        }
+        pthread_detach(pool->threads[i]);
+    }
+
+    printf("Started %d worker thread(s), queue capacity %d\n",
+           num_workers, per_queue * num_workers);
+    return pool;
+}
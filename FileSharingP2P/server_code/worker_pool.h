@@ -0,0 +1,16 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+typedef void (*JobFn)(void* arg);
+
+typedef struct WorkerPool WorkerPool;
+
+// Start num_workers threads sharing at most capacity queued jobs.
+// Each worker owns a bounded deque; idle workers steal from the others.
+WorkerPool* worker_pool_create(int num_workers, int capacity);
+
+// Queue a job. Returns -1 without queueing when the pool is saturated,
+// so the caller can stop reading input until workers catch up.
+int worker_pool_submit(WorkerPool* pool, JobFn fn, void* arg);
+
+#endif
@@ -0,0 +1,379 @@
+// Checks for the v2 frame codec, run by `make check`.
+//
+// wire.c is included rather than linked so the round trips can walk its
+// layout tables: every field of every request and response layout is
+// filled in, encoded, decoded and compared, and a layout added later is
+// covered without touching this file. The rest feeds the codec prefixes
+// and bodies it has to refuse.
+
+#include "../wire.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FRAME_CAP (WIRE_MAX_PREFIX + WIRE_MAX_FRAME)
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                     \
+    do {                                                     \
+        if (!(cond)) {                                       \
+            failures++;                                      \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);      \
+            printf(__VA_ARGS__);                             \
+            printf("\n");                                    \
+        }                                                    \
+    } while (0)
+
+// ----------------------------------------------------------------
+//                           ROUND TRIPS
+// ----------------------------------------------------------------
+
+typedef enum {
+    FILL_EMPTY,  // header only: zeros and empty strings
+    FILL_SHORT,  // short strings, arrays full
+    FILL_LONG,   // every string at its full length, arrays full
+    FILL_TEXT    // hex fields holding text they can't be packed as, one array element
+} FillStyle;
+
+static const char* style_names[] = { "empty", "short", "long", "text" };
+
+static void fill_fields(unsigned char* base, const Field* fields, int count,
+                        FillStyle style, int seed);
+
+static void fill_field(unsigned char* base, const Field* f, FillStyle style, int seed) {
+    unsigned char* p = base + f->offset;
+    switch (f->type) {
+        case FIELD_SINT:
+            if (f->size == sizeof(int32_t)) {
+                static const int32_t values[] = { -1, INT32_MIN, INT32_MAX, 12345, -70000 };
+                memcpy(p, &values[seed % 5], sizeof(int32_t));
+            } else {
+                static const int64_t values[] = { INT64_MIN, INT64_MAX, -7, (int64_t)1 << 40 };
+                memcpy(p, &values[seed % 4], sizeof(int64_t));
+            }
+            break;
+        case FIELD_UINT:
+            if (f->size == sizeof(uint32_t)) {
+                uint32_t v = UINT32_MAX - (uint32_t)seed;
+                memcpy(p, &v, sizeof(v));
+            } else {
+                uint64_t v = UINT64_MAX - (uint64_t)seed;
+                memcpy(p, &v, sizeof(v));
+            }
+            break;
+        case FIELD_FLOAT: {
+            float v = -1.25f * (float)(seed + 1);
+            memcpy(p, &v, sizeof(v));
+            break;
+        }
+        case FIELD_STR: {
+            size_t n = style == FILL_LONG ? f->size - 1 : 1 + (size_t)seed % 7;
+            if (n > f->size - 1) n = f->size - 1;
+            for (size_t i = 0; i < n; i++) {
+                p[i] = (unsigned char)(0x20 + (i * 7 + (size_t)seed) % 0xdf);  // no NUL, some >= 0x80
+            }
+            break;
+        }
+        case FIELD_HEX: {
+            if (style == FILL_TEXT) {
+                static const char text[] = "Not-Hex";
+                size_t n = sizeof(text) - 1 < f->size - 1 ? sizeof(text) - 1 : f->size - 1;
+                memcpy(p, text, n);
+                break;
+            }
+            size_t n = style == FILL_LONG ? (f->size - 1) & ~(size_t)1 : 2 * (1 + (size_t)seed % 4);
+            for (size_t i = 0; i < n; i++) {
+                p[i] = (unsigned char)"0123456789abcdef"[(i * 5 + (size_t)seed) % 16];
+            }
+            break;
+        }
+        case FIELD_ARRAY: {
+            int n = style == FILL_TEXT ? 1 : f->max;
+            memcpy(base + f->count_offset, &n, sizeof(n));
+            for (int i = 0; i < n; i++) {
+                fill_fields(p + (size_t)i * f->size, f->elements, f->element_fields, style, seed + i);
+            }
+            break;
+        }
+    }
+}
+
+static void fill_fields(unsigned char* base, const Field* fields, int count,
+                        FillStyle style, int seed) {
+    for (int i = 0; i < count; i++) {
+        fill_field(base, &fields[i], style, seed + i);
+    }
+}
+
+static void check_round_trip(int command, int response, FillStyle style) {
+    size_t size;
+    const Layout* layout = layout_for(command, response, &size);
+    const char* kind = response ? "response" : "request";
+
+    unsigned char* msg = (unsigned char*)calloc(1, size);
+    unsigned char* back = (unsigned char*)calloc(1, size);
+    unsigned char* frame = (unsigned char*)malloc(FRAME_CAP + 3);
+    if (!msg || !back || !frame) {
+        perror("calloc");
+        exit(1);
+    }
+
+    MessageHeader header = { command, UINT32_MAX - (uint32_t)style };
+    memcpy(msg, &header, sizeof(header));
+    if (style != FILL_EMPTY) {
+        fill_fields(msg, layout->fields, layout->count, style, command);
+    }
+
+    size_t len = wire_encode(msg, size, response, frame, FRAME_CAP);
+    CHECK(len > 0, "cmd %d %s (%s): encode failed", command, kind, style_names[style]);
+    if (len == 0) goto done;
+
+    size_t body_len = 0;
+    int prefix = wire_frame_prefix(frame, len, &body_len);
+    CHECK(prefix > 0 && prefix + body_len == len,
+          "cmd %d %s (%s): prefix %d body %zu frame %zu", command, kind, style_names[style],
+          prefix, body_len, len);
+    if (prefix <= 0 || prefix + body_len != len) goto done;
+    const unsigned char* body = frame + prefix;
+
+    CHECK(wire_decode(body, body_len, response, back, size) == size,
+          "cmd %d %s (%s): decode failed", command, kind, style_names[style]);
+    CHECK(memcmp(msg, back, size) == 0,
+          "cmd %d %s (%s): decoded struct differs", command, kind, style_names[style]);
+
+    // A cut through the prefix only asks for more bytes
+    for (int i = 0; i < prefix; i++) {
+        size_t ignored;
+        CHECK(wire_frame_prefix(frame, (size_t)i, &ignored) == 0,
+              "cmd %d %s (%s): %d prefix bytes not incomplete", command, kind, style_names[style], i);
+    }
+
+    // A cut through the body either ends between fields or is refused,
+    // and the fields before the cut come back as they were sent
+    for (size_t cut = 0; cut < body_len; cut++) {
+        memset(back, 0xa5, size);
+        size_t got = wire_decode(body, cut, response, back, size);
+        CHECK(got == 0 || got == size, "cmd %d %s (%s): cut at %zu returned %zu",
+              command, kind, style_names[style], cut, got);
+        if (got == size) {
+            static unsigned char again[FRAME_CAP];
+            size_t again_len = wire_encode(back, size, response, again, sizeof(again));
+            size_t again_body_len = 0;
+            int again_prefix = again_len ? wire_frame_prefix(again, again_len, &again_body_len) : -1;
+            CHECK(again_prefix > 0 && again_body_len >= cut &&
+                  memcmp(again + again_prefix, body, cut) == 0,
+                  "cmd %d %s (%s): fields before a cut at %zu changed", command, kind,
+                  style_names[style], cut);
+        }
+    }
+    CHECK(wire_decode(body, 0, response, back, size) == 0,
+          "cmd %d %s (%s): empty body accepted", command, kind, style_names[style]);
+
+    // Bytes a newer peer appends are skipped
+    memcpy(frame + len, "\x01\x02\x03", 3);
+    memset(back, 0, size);
+    CHECK(wire_decode(body, body_len + 3, response, back, size) == size &&
+          memcmp(msg, back, size) == 0,
+          "cmd %d %s (%s): trailing bytes not skipped", command, kind, style_names[style]);
+
+    // Too little room fails instead of truncating
+    CHECK(wire_encode(msg, size, response, frame, len - 1) == 0,
+          "cmd %d %s (%s): encode into %zu bytes succeeded", command, kind, style_names[style], len - 1);
+    CHECK(wire_encode(msg, size - 1, response, frame, FRAME_CAP) == 0,
+          "cmd %d %s (%s): encode of a short struct succeeded", command, kind, style_names[style]);
+    CHECK(wire_decode(body, body_len, response, back, size - 1) == 0,
+          "cmd %d %s (%s): decode into a short struct succeeded", command, kind, style_names[style]);
+
+done:
+    free(msg);
+    free(back);
+    free(frame);
+}
+
+static int check_all_layouts(void) {
+    int covered = 0;
+    for (int command = 1; command < LAYOUT_COUNT; command++) {
+        for (int response = 0; response <= 1; response++) {
+            size_t size;
+            if (!layout_for(command, response, &size)) {
+                // HELLO stays a fixed struct; NOTIFY is never requested
+                CHECK(command == CMD_HELLO || (command == CMD_NOTIFY && !response),
+                      "cmd %d %s has no layout", command, response ? "response" : "request");
+                continue;
+            }
+            for (int style = FILL_EMPTY; style <= FILL_TEXT; style++) {
+                check_round_trip(command, response, (FillStyle)style);
+            }
+            covered++;
+        }
+    }
+    return covered;
+}
+
+// ----------------------------------------------------------------
+//                         REFUSED INPUT
+// ----------------------------------------------------------------
+
+static void check_prefixes(void) {
+    unsigned char data[WIRE_MAX_PREFIX + 1];
+    size_t body_len;
+    size_t n;
+
+    n = write_varint(data, WIRE_MAX_FRAME);
+    CHECK(wire_frame_prefix(data, n, &body_len) == (int)n && body_len == WIRE_MAX_FRAME,
+          "largest frame refused");
+    for (size_t i = 0; i < n; i++) {
+        CHECK(wire_frame_prefix(data, i, &body_len) == 0, "%zu of %zu prefix bytes not incomplete", i, n);
+    }
+
+    n = write_varint(data, WIRE_MAX_FRAME + 1);
+    CHECK(wire_frame_prefix(data, n, &body_len) == -1, "oversized frame accepted");
+
+    n = write_varint(data, UINT32_MAX);
+    CHECK(wire_frame_prefix(data, n, &body_len) == -1, "4 GB frame accepted");
+
+    data[0] = 0;
+    CHECK(wire_frame_prefix(data, 1, &body_len) == -1, "empty frame accepted");
+
+    // Still continuing after the widest prefix, however small the value
+    memset(data, 0x80, sizeof(data));
+    CHECK(wire_frame_prefix(data, sizeof(data), &body_len) == -1, "overlong prefix accepted");
+    CHECK(wire_frame_prefix(data, WIRE_MAX_PREFIX - 1, &body_len) == 0,
+          "unfinished prefix refused early");
+
+    // A padded (non-minimal) prefix is fine as long as it ends in time
+    unsigned char padded[] = { 0x85, 0x80, 0x00 };
+    CHECK(wire_frame_prefix(padded, sizeof(padded), &body_len) == 3 && body_len == 5,
+          "padded prefix refused");
+}
+
+// Frame body for command: the header varints, then raw field bytes
+static size_t make_body(unsigned char* out, uint64_t command, uint64_t request_id,
+                        const unsigned char* fields, size_t fields_len) {
+    size_t n = write_varint(out, command);
+    n += write_varint(out + n, request_id);
+    if (fields_len) memcpy(out + n, fields, fields_len);
+    return n + fields_len;
+}
+
+static void check_refused(const char* what, uint64_t command, int response,
+                          const unsigned char* fields, size_t fields_len) {
+    unsigned char body[FRAME_CAP];
+    static unsigned char out[sizeof(BrowseChangesResponse) + sizeof(SearchResponse)];
+    size_t len = make_body(body, command, 7, fields, fields_len);
+    CHECK(wire_decode(body, len, response, out, sizeof(out)) == 0, "%s accepted", what);
+}
+
+static void check_bodies(void) {
+    unsigned char f[4096];
+    size_t n;
+
+    check_refused("unknown command", 99, 0, NULL, 0);
+    check_refused("command 0", 0, 0, NULL, 0);
+    check_refused("HELLO frame", CMD_HELLO, 0, NULL, 0);
+    check_refused("HELLO reply frame", CMD_HELLO, 1, NULL, 0);
+    check_refused("NOTIFY request", CMD_NOTIFY, 0, NULL, 0);
+    check_refused("command past int", (uint64_t)INT32_MAX + 1 + CMD_LOGIN, 0, NULL, 0);
+
+    {
+        unsigned char body[32];
+        unsigned char out[sizeof(LoginRequest)];
+        size_t len = write_varint(body, CMD_LOGIN);
+        len += write_varint(body + len, (uint64_t)UINT32_MAX + 1);
+        CHECK(wire_decode(body, len, 0, out, sizeof(out)) == 0, "request_id past 32 bits accepted");
+
+        len = write_varint(body, CMD_LOGIN);  // request_id missing
+        CHECK(wire_decode(body, len, 0, out, sizeof(out)) == 0, "frame without request_id accepted");
+    }
+
+    // Varint running past 64 bits
+    memset(f, 0xff, 10);
+    f[10] = 0x01;
+    check_refused("overlong varint", CMD_LOGIN, 0, f, 11);
+
+    // Varint cut off by the end of the body
+    f[0] = 0x80;
+    check_refused("unfinished varint", CMD_REGISTER, 0, f, 1);
+
+    // String no shorter than its field, which leaves no room for the NUL
+    n = write_varint(f, (uint64_t)MAX_EMAIL << 1);
+    memset(f + n, 'a', MAX_EMAIL);
+    check_refused("string as long as its field", CMD_REGISTER, 0, f, n + MAX_EMAIL);
+
+    // String longer than what is left of the body
+    n = write_varint(f, 10 << 1);
+    memset(f + n, 'a', 4);
+    check_refused("string past the body", CMD_REGISTER, 0, f, n + 4);
+
+    // Packed hex unpacking to more than the field holds
+    n = write_varint(f, 0);  // email
+    n += write_varint(f + n, (uint64_t)32 << 1 | 1);
+    memset(f + n, 0xab, 32);
+    check_refused("packed hex too long", CMD_LOGOUT, 0, f, n + 32);
+
+    // Packed hex cut off
+    n = write_varint(f, 0);
+    n += write_varint(f + n, 16 << 1 | 1);
+    check_refused("packed hex past the body", CMD_LOGOUT, 0, f, n + 4);
+
+    // int field outside int range
+    n = write_varint(f, 0);  // status
+    n += write_varint(f + n, (uint64_t)INT32_MAX << 1 << 1);
+    check_refused("int out of range", CMD_HEARTBEAT, 1, f, n);
+
+    // Float cut short
+    {
+        unsigned char body[64];
+        SearchResponse out;
+        size_t len = make_body(body, CMD_SEARCH, 1, NULL, 0);
+        len += write_varint(body + len, 0);  // status
+        len += write_varint(body + len, 0);  // next_cursor.key
+        len += write_varint(body + len, 0);  // next_cursor.id
+        len += write_varint(body + len, 1);  // count
+        len += write_varint(body + len, 1 << 1);
+        body[len++] = 'x';
+        len += write_varint(body + len, 0);  // filehash
+        len += write_varint(body + len, 0);  // file_size
+        len += write_varint(body + len, 0);  // chunk_size
+        body[len++] = 0;                     // two bytes of popularity
+        body[len++] = 0;
+        CHECK(wire_decode(body, len, 1, &out, sizeof(out)) == 0, "cut-off float accepted");
+    }
+
+    // Array longer than the struct holds
+    n = write_varint(f, 0);   // status
+    n += write_varint(f + n, 0);
+    n += write_varint(f + n, 0);
+    n += write_varint(f + n, 51);
+    for (int i = 0; i < 51; i++) {
+        n += write_varint(f + n, 7 << 1);
+        memcpy(f + n, "1.2.3.4", 7);
+        n += 7;
+        n += write_varint(f + n, 80 << 1);
+    }
+    check_refused("array past its maximum", CMD_FIND, 1, f, n);
+
+    // Array whose elements stop partway
+    n = write_varint(f, 0);
+    n += write_varint(f + n, 0);
+    n += write_varint(f + n, 0);
+    n += write_varint(f + n, 2);
+    n += write_varint(f + n, 4 << 1);
+    memcpy(f + n, "1.2.", 4);
+    n += 4;
+    n += write_varint(f + n, 80 << 1);  // first peer done
+    check_refused("cut-off array element", CMD_FIND, 1, f, n);
+}
+
+int main(void) {
+    int covered = check_all_layouts();
+    check_prefixes();
+    check_bodies();
+
+    if (failures) {
+        printf("wire_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("wire_test: %d layouts round-tripped, bad input refused\n", covered);
+    return 0;
+}
@@ -0,0 +1,558 @@
+#include "wire.h"
+#include "protocol.h"
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+    FIELD_SINT,   // int or int64_t, zigzag varint
+    FIELD_UINT,   // uint32_t or uint64_t, varint
+    FIELD_FLOAT,  // 4 bytes
+    FIELD_STR,    // NUL-terminated char[size]
+    FIELD_HEX,    // FIELD_STR usually holding lowercase hex
+    FIELD_ARRAY   // element[max], count kept in the int at count_offset
+} FieldType;
+
+typedef struct Field {
+    FieldType type;
+    size_t offset;
+    size_t size;  // of the field, or of one element for FIELD_ARRAY
+    size_t count_offset;
+    int max;
+    const struct Field* elements;
+    int element_fields;
+} Field;
+
+typedef struct {
+    const Field* fields;
+    int count;
+} Layout;
+
+#define MEMBER_SIZE(type, member) sizeof(((type*)0)->member)
+#define SCALAR(kind, type, member) \
+    { kind, offsetof(type, member), MEMBER_SIZE(type, member), 0, 0, NULL, 0 }
+#define SINT(type, member) SCALAR(FIELD_SINT, type, member)
+#define UINT(type, member) SCALAR(FIELD_UINT, type, member)
+#define FLOAT(type, member) SCALAR(FIELD_FLOAT, type, member)
+#define STR(type, member) SCALAR(FIELD_STR, type, member)
+#define HEX(type, member) SCALAR(FIELD_HEX, type, member)
+#define ARRAY(type, member, count_member, element_layout)                       \
+    { FIELD_ARRAY, offsetof(type, member), sizeof(((type*)0)->member[0]),      \
+      offsetof(type, count_member),                                           \
+      (int)(MEMBER_SIZE(type, member) / sizeof(((type*)0)->member[0])),       \
+      element_layout, (int)(sizeof(element_layout) / sizeof(element_layout[0])) }
+#define LAYOUT(fields) { fields, (int)(sizeof(fields) / sizeof(fields[0])) }
+
+// ---- Elements ----
+
+static const Field file_info_fields[] = {
+    STR(SearchFileInfo, filename),
+    HEX(SearchFileInfo, filehash),
+    SINT(SearchFileInfo, file_size),
+    SINT(SearchFileInfo, chunk_size),
+    FLOAT(SearchFileInfo, popularity),
+    FLOAT(SearchFileInfo, success_rate),
+};
+
+static const Field catalog_change_fields[] = {
+    SINT(CatalogChange, removed),
+    STR(CatalogChange, file.filename),
+    HEX(CatalogChange, file.filehash),
+    SINT(CatalogChange, file.file_size),
+    SINT(CatalogChange, file.chunk_size),
+};
+
+static const Field peer_info_fields[] = {
+    STR(PeerInfo, ip),
+    SINT(PeerInfo, port),
+};
+
+// ---- Requests ----
+
+static const Field register_request[] = {
+    STR(RegisterRequest, email),
+    STR(RegisterRequest, username),
+    STR(RegisterRequest, password),
+};
+
+static const Field login_request[] = {
+    STR(LoginRequest, email),
+    STR(LoginRequest, password),
+    SINT(LoginRequest, port),
+};
+
+static const Field search_request[] = {
+    STR(SearchRequest, email),
+    HEX(SearchRequest, access_token),
+    STR(SearchRequest, keyword),
+    UINT(SearchRequest, cursor.key),
+    UINT(SearchRequest, cursor.id),
+    SINT(SearchRequest, limit),
+};
+
+static const Field find_request[] = {
+    STR(FindRequest, email),
+    HEX(FindRequest, access_token),
+    HEX(FindRequest, filehash),
+    UINT(FindRequest, cursor.key),
+    UINT(FindRequest, cursor.id),
+    SINT(FindRequest, limit),
+};
+
+static const Field publish_request[] = {
+    STR(PublishRequest, email),
+    HEX(PublishRequest, access_token),
+    STR(PublishRequest, filename),
+    HEX(PublishRequest, filehash),
+    STR(PublishRequest, ip),
+    SINT(PublishRequest, port),
+    SINT(PublishRequest, file_size),
+    SINT(PublishRequest, chunk_size),
+};
+
+static const Field unpublish_request[] = {
+    STR(UnpublishRequest, email),
+    HEX(UnpublishRequest, access_token),
+    HEX(UnpublishRequest, filehash),
+};
+
+static const Field logout_request[] = {
+    STR(LogoutRequest, email),
+    HEX(LogoutRequest, access_token),
+};
+
+static const Field download_status_request[] = {
+    STR(DownloadStatusRequest, email),
+    HEX(DownloadStatusRequest, access_token),
+    HEX(DownloadStatusRequest, filehash),
+    SINT(DownloadStatusRequest, download_success),
+    STR(DownloadStatusRequest, peer.ip),
+    SINT(DownloadStatusRequest, peer.port),
+    SINT(DownloadStatusRequest, bytes),
+    SINT(DownloadStatusRequest, elapsed_ms),
+};
+
+static const Field browse_request[] = {
+    STR(BrowseFilesRequest, email),
+    HEX(BrowseFilesRequest, access_token),
+    SINT(BrowseFilesRequest, order),
+    SINT(BrowseFilesRequest, limit),
+    UINT(BrowseFilesRequest, cursor.key),
+    UINT(BrowseFilesRequest, cursor.id),
+};
+
+static const Field browse_changes_request[] = {
+    STR(BrowseChangesRequest, email),
+    HEX(BrowseChangesRequest, access_token),
+    UINT(BrowseChangesRequest, since),
+    SINT(BrowseChangesRequest, limit),
+};
+
+static const Field subscribe_request[] = {
+    STR(SubscribeRequest, email),
+    HEX(SubscribeRequest, access_token),
+    SINT(SubscribeRequest, watch),
+    SINT(SubscribeRequest, remove),
+    STR(SubscribeRequest, target),
+};
+
+static const Field heartbeat_request[] = {
+    STR(HeartbeatRequest, email),
+    HEX(HeartbeatRequest, access_token),
+    SINT(HeartbeatRequest, port),
+    SINT(HeartbeatRequest, active_uploads),
+};
+
+// ---- Responses ----
+// Arrays go last so their count travels right before the elements
+
+static const Field status_response[] = {
+    SINT(RegisterResponse, status),  // every plain reply is laid out like this
+};
+
+static const Field login_response[] = {
+    SINT(LoginResponse, status),
+    STR(LoginResponse, username),
+    HEX(LoginResponse, access_token),
+};
+
+static const Field search_response[] = {
+    SINT(SearchResponse, status),
+    UINT(SearchResponse, next_cursor.key),
+    UINT(SearchResponse, next_cursor.id),
+    ARRAY(SearchResponse, files, count, file_info_fields),
+};
+
+static const Field browse_response[] = {
+    SINT(BrowseFilesResponse, status),
+    UINT(BrowseFilesResponse, next_cursor.key),
+    UINT(BrowseFilesResponse, next_cursor.id),
+    ARRAY(BrowseFilesResponse, files, count, file_info_fields),
+};
+
+static const Field find_response[] = {
+    SINT(FindResponse, status),
+    UINT(FindResponse, next_cursor.key),
+    UINT(FindResponse, next_cursor.id),
+    ARRAY(FindResponse, peers, count, peer_info_fields),
+};
+
+static const Field browse_changes_response[] = {
+    SINT(BrowseChangesResponse, status),
+    SINT(BrowseChangesResponse, full),
+    SINT(BrowseChangesResponse, more),
+    UINT(BrowseChangesResponse, catalog_version),
+    UINT(BrowseChangesResponse, next_cursor.key),
+    UINT(BrowseChangesResponse, next_cursor.id),
+    ARRAY(BrowseChangesResponse, changes, count, catalog_change_fields),
+};
+
+static const Field heartbeat_response[] = {
+    SINT(HeartbeatResponse, status),
+    SINT(HeartbeatResponse, lease_seconds),
+};
+
+static const Field notify_message[] = {
+    SINT(NotifyMessage, event),
+    SINT(NotifyMessage, seeders),
+    STR(NotifyMessage, file.filename),
+    HEX(NotifyMessage, file.filehash),
+    SINT(NotifyMessage, file.file_size),
+    SINT(NotifyMessage, file.chunk_size),
+};
+
+// HELLO itself always travels as a fixed struct and has no layout
+static const Layout request_layouts[] = {
+    [CMD_REGISTER] = LAYOUT(register_request),
+    [CMD_LOGIN] = LAYOUT(login_request),
+    [CMD_SEARCH] = LAYOUT(search_request),
+    [CMD_FIND] = LAYOUT(find_request),
+    [CMD_PUBLISH] = LAYOUT(publish_request),
+    [CMD_UNPUBLISH] = LAYOUT(unpublish_request),
+    [CMD_LOGOUT] = LAYOUT(logout_request),
+    [CMD_DOWNLOAD_STATUS] = LAYOUT(download_status_request),
+    [CMD_BROWSE_FILES] = LAYOUT(browse_request),
+    [CMD_HEARTBEAT] = LAYOUT(heartbeat_request),
+    [CMD_BROWSE_CHANGES] = LAYOUT(browse_changes_request),
+    [CMD_SUBSCRIBE] = LAYOUT(subscribe_request),
+    [CMD_NOTIFY] = { NULL, 0 },  // only ever sent by the tracker
+};
+
+static const Layout response_layouts[] = {
+    [CMD_REGISTER] = LAYOUT(status_response),
+    [CMD_LOGIN] = LAYOUT(login_response),
+    [CMD_SEARCH] = LAYOUT(search_response),
+    [CMD_FIND] = LAYOUT(find_response),
+    [CMD_PUBLISH] = LAYOUT(status_response),
+    [CMD_UNPUBLISH] = LAYOUT(status_response),
+    [CMD_LOGOUT] = LAYOUT(status_response),
+    [CMD_DOWNLOAD_STATUS] = LAYOUT(status_response),
+    [CMD_BROWSE_FILES] = LAYOUT(browse_response),
+    [CMD_HEARTBEAT] = LAYOUT(heartbeat_response),
+    [CMD_BROWSE_CHANGES] = LAYOUT(browse_changes_response),
+    [CMD_SUBSCRIBE] = LAYOUT(status_response),
+    [CMD_NOTIFY] = LAYOUT(notify_message),
+};
+
+#define LAYOUT_COUNT ((int)(sizeof(request_layouts) / sizeof(request_layouts[0])))
+
+static const Layout* layout_for(int command, int response, size_t* struct_size) {
+    if (command <= 0 || command >= LAYOUT_COUNT) return NULL;
+    const Layout* layout = response ? &response_layouts[command] : &request_layouts[command];
+    if (!layout->fields) return NULL;
+    *struct_size = response ? response_size_for_command(command) : request_size_for_command(command);
+    return layout;
+}
+
+// ---- Encoding ----
+
+#define VARINT_MAX 10
+
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+    int overflow;
+} Writer;
+
+// Room for up to n more bytes, or NULL once the output is full. Fields
+// reserve their worst case and then write in place.
+static unsigned char* reserve(Writer* w, size_t n) {
+    if (w->overflow || w->cap - w->len < n) {
+        w->overflow = 1;
+        return NULL;
+    }
+    return w->data + w->len;
+}
+
+static size_t write_varint(unsigned char* out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+static void put_varint(Writer* w, uint64_t v) {
+    unsigned char* out = reserve(w, VARINT_MAX);
+    if (out) w->len += write_varint(out, v);
+}
+
+// Digit value + 1 for lowercase hex, 0 for anything else
+static const unsigned char hex_digits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+// Pack s as bytes behind an odd length prefix. Returns 0, having written
+// nothing, if s is not an even run of lowercase hex digits.
+static size_t write_packed_hex(unsigned char* out, const char* s, size_t n) {
+    if (n == 0 || n % 2) return 0;
+    size_t used = write_varint(out, (uint64_t)(n / 2) << 1 | 1);
+    for (size_t i = 0; i < n; i += 2) {
+        unsigned hi = hex_digits[(unsigned char)s[i]];
+        unsigned lo = hex_digits[(unsigned char)s[i + 1]];
+        if (!hi || !lo) return 0;
+        out[used + i / 2] = (unsigned char)((hi - 1) << 4 | (lo - 1));
+    }
+    return used + n / 2;
+}
+
+static void put_fields(Writer* w, const unsigned char* base, const Field* fields, int count);
+
+static void put_field(Writer* w, const unsigned char* base, const Field* f) {
+    const unsigned char* p = base + f->offset;
+    switch (f->type) {
+        case FIELD_SINT: {
+            int64_t v;
+            if (f->size == sizeof(int32_t)) {
+                int32_t v32;
+                memcpy(&v32, p, sizeof(v32));
+                v = v32;
+            } else {
+                memcpy(&v, p, sizeof(v));
+            }
+            put_varint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+            break;
+        }
+        case FIELD_UINT: {
+            uint64_t v;
+            if (f->size == sizeof(uint32_t)) {
+                uint32_t v32;
+                memcpy(&v32, p, sizeof(v32));
+                v = v32;
+            } else {
+                memcpy(&v, p, sizeof(v));
+            }
+            put_varint(w, v);
+            break;
+        }
+        case FIELD_FLOAT: {
+            unsigned char* out = reserve(w, sizeof(float));
+            if (!out) break;
+            memcpy(out, p, sizeof(float));
+            w->len += sizeof(float);
+            break;
+        }
+        case FIELD_STR:
+        case FIELD_HEX: {
+            const char* s = (const char*)p;
+            const char* end = memchr(s, '\0', f->size - 1);  // one byte left for the NUL
+            size_t n = end ? (size_t)(end - s) : f->size - 1;
+            unsigned char* out = reserve(w, VARINT_MAX + n);
+            if (!out) break;
+
+            size_t used = f->type == FIELD_HEX ? write_packed_hex(out, s, n) : 0;
+            if (used == 0) {
+                used = write_varint(out, (uint64_t)n << 1);
+                memcpy(out + used, s, n);
+                used += n;
+            }
+            w->len += used;
+            break;
+        }
+        case FIELD_ARRAY: {
+            int n;
+            memcpy(&n, base + f->count_offset, sizeof(n));
+            if (n < 0) n = 0;
+            if (n > f->max) n = f->max;
+            put_varint(w, (uint64_t)n);
+            for (int i = 0; i < n; i++) {
+                put_fields(w, p + (size_t)i * f->size, f->elements, f->element_fields);
+            }
+            break;
+        }
+    }
+}
+
+static void put_fields(Writer* w, const unsigned char* base, const Field* fields, int count) {
+    for (int i = 0; i < count && !w->overflow; i++) {
+        put_field(w, base, &fields[i]);
+    }
+}
+
+size_t wire_encode(const void* msg, size_t len, int response, unsigned char* out, size_t cap) {
+    MessageHeader header;
+    if (len < sizeof(header)) return 0;
+    memcpy(&header, msg, sizeof(header));
+
+    size_t struct_size;
+    const Layout* layout = layout_for(header.command, response, &struct_size);
+    if (!layout || len < struct_size || cap <= WIRE_MAX_PREFIX) return 0;
+
+    // The body is written past the widest prefix and slid back once its
+    // length, and so the real prefix width, is known
+    size_t body_cap = cap - WIRE_MAX_PREFIX;
+    if (body_cap > WIRE_MAX_FRAME) body_cap = WIRE_MAX_FRAME;
+    Writer body = { out + WIRE_MAX_PREFIX, 0, body_cap, 0 };
+    put_varint(&body, (uint64_t)header.command);
+    put_varint(&body, header.request_id);
+    put_fields(&body, (const unsigned char*)msg, layout->fields, layout->count);
+    if (body.overflow) return 0;
+
+    unsigned char prefix[VARINT_MAX];
+    size_t prefix_len = write_varint(prefix, body.len);
+    memcpy(out, prefix, prefix_len);
+    memmove(out + prefix_len, body.data, body.len);
+    return prefix_len + body.len;
+}
+
+// ---- Decoding ----
+
+typedef struct {
+    const unsigned char* data;
+    size_t len;
+    size_t pos;
+} Reader;
+
+// 1 with *v set, 0 at the end of the data, -1 if malformed
+static int get_varint(Reader* r, uint64_t* v) {
+    if (r->pos == r->len) return 0;
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->pos == r->len) return -1;
+        unsigned char byte = r->data[r->pos++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+static int get_bytes(Reader* r, void* out, size_t n) {
+    if (r->len - r->pos < n) return -1;
+    memcpy(out, r->data + r->pos, n);
+    r->pos += n;
+    return 1;
+}
+
+static int get_fields(Reader* r, unsigned char* base, const Field* fields, int count);
+
+static int get_field(Reader* r, unsigned char* base, const Field* f) {
+    unsigned char* p = base + f->offset;
+    if (f->type == FIELD_FLOAT) {
+        if (r->pos == r->len) return 0;
+        return get_bytes(r, p, sizeof(float));
+    }
+
+    uint64_t v;
+    int rc = get_varint(r, &v);
+    if (rc <= 0) return rc;
+
+    switch (f->type) {
+        case FIELD_SINT: {
+            int64_t s = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            if (f->size == sizeof(int32_t)) {
+                if (s < INT32_MIN || s > INT32_MAX) return -1;
+                int32_t s32 = (int32_t)s;
+                memcpy(p, &s32, sizeof(s32));
+            } else {
+                memcpy(p, &s, sizeof(s));
+            }
+            return 1;
+        }
+        case FIELD_UINT:
+            if (f->size == sizeof(uint32_t)) {
+                if (v > UINT32_MAX) return -1;
+                uint32_t v32 = (uint32_t)v;
+                memcpy(p, &v32, sizeof(v32));
+            } else {
+                memcpy(p, &v, sizeof(v));
+            }
+            return 1;
+        case FIELD_STR:
+        case FIELD_HEX: {
+            uint64_t n = v >> 1;
+            if (!(v & 1)) {
+                if (n >= f->size) return -1;
+                return get_bytes(r, p, (size_t)n);
+            }
+            if (n * 2 >= f->size || r->len - r->pos < n) return -1;
+            static const char hex[] = "0123456789abcdef";
+            for (uint64_t i = 0; i < n; i++) {
+                unsigned char byte = r->data[r->pos++];
+                p[2 * i] = (unsigned char)hex[byte >> 4];
+                p[2 * i + 1] = (unsigned char)hex[byte & 0xf];
+            }
+            return 1;
+        }
+        case FIELD_ARRAY: {
+            if (v > (uint64_t)f->max) return -1;
+            int n = (int)v;
+            memcpy(base + f->count_offset, &n, sizeof(n));
+            for (int i = 0; i < n; i++) {
+                // Elements are not extensible: a cut-off one is malformed
+                if (get_fields(r, p + (size_t)i * f->size, f->elements, f->element_fields) != 1) {
+                    return -1;
+                }
+            }
+            return 1;
+        }
+        default:
+            return -1;
+    }
+}
+
+// 1 when every field was read, 0 when the data ended early, -1 if malformed
+static int get_fields(Reader* r, unsigned char* base, const Field* fields, int count) {
+    for (int i = 0; i < count; i++) {
+        int rc = get_field(r, base, &fields[i]);
+        if (rc <= 0) return rc;
+    }
+    return 1;
+}
+
+int wire_frame_prefix(const unsigned char* data, size_t len, size_t* body_len) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < WIRE_MAX_PREFIX; i++) {
+        if (i == len) return 0;
+        v |= (uint64_t)(data[i] & 0x7f) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            if (v == 0 || v > WIRE_MAX_FRAME) return -1;
+            *body_len = (size_t)v;
+            return (int)i + 1;
+        }
+    }
+    return -1;
+}
+
+size_t wire_decode(const unsigned char* body, size_t len, int response, void* out, size_t cap) {
+    Reader r = { body, len, 0 };
+    uint64_t command, request_id;
+    if (get_varint(&r, &command) <= 0 || get_varint(&r, &request_id) <= 0) return 0;
+    if (command > INT32_MAX || request_id > UINT32_MAX) return 0;
+
+    size_t struct_size;
+    const Layout* layout = layout_for((int)command, response, &struct_size);
+    if (!layout || cap < struct_size) return 0;
+
+    memset(out, 0, struct_size);
+    MessageHeader header = { (int)command, (uint32_t)request_id };
+    memcpy(out, &header, sizeof(header));
+    if (get_fields(&r, (unsigned char*)out, layout->fields, layout->count) < 0) return 0;
+    return struct_size;
+}
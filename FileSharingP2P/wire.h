@@ -0,0 +1,48 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+
+// Framings a tracker connection can use, agreed with CMD_HELLO.
+//
+// WIRE_LEGACY sends the packed structs of protocol.h as they are: every
+// string at its full buffer size and every result array at its maximum
+// length.
+//
+// WIRE_V2 sends each message as one frame:
+//
+//   varint body_length | varint command | varint request_id | fields...
+//
+// Fields follow the struct order. Integers are LEB128 varints (signed
+// ones zigzag-encoded), floats are 4 little-endian bytes, strings are a
+// varint length and their bytes, and arrays are a varint count and that
+// many elements. Hex strings (hashes, tokens) go as raw bytes: their
+// length prefix is (bytes << 1) | 1 instead of (chars << 1).
+// A decoder zero-fills fields missing at the end of a frame and skips
+// unknown trailing bytes, so fields can be appended later.
+//
+// Both sides keep working with the protocol.h structs; this module only
+// converts them to and from frames.
+#define WIRE_LEGACY 1
+#define WIRE_V2 2
+#define WIRE_VERSION_MAX WIRE_V2
+
+#define WIRE_MAX_FRAME (64 * 1024)  // largest body accepted; a full SEARCH page is ~28 KB
+#define WIRE_MAX_PREFIX 5           // varint body_length
+
+// Parse the length prefix at data. Returns the prefix size and sets
+// *body_len, 0 when more bytes are needed, -1 when the length is invalid.
+int wire_frame_prefix(const unsigned char* data, size_t len, size_t* body_len);
+
+// Encode the struct msg (len bytes, starting with a MessageHeader) as one
+// whole frame, prefix included. response selects the reply layout of the
+// command. Returns the frame size, or 0 if the command is unknown or out
+// is too small.
+size_t wire_encode(const void* msg, size_t len, int response, unsigned char* out, size_t cap);
+
+// Decode a frame body (after the prefix) into the zeroed struct at out.
+// Returns the struct size for the command, or 0 if the body is malformed,
+// the command unknown or out smaller than the struct.
+size_t wire_decode(const unsigned char* body, size_t len, int response, void* out, size_t cap);
+
+#endif